@@ -1,25 +1,247 @@
 #include "avr.h"
+#include "reverse.h"
 
 #include <iostream>
 #include <cstdio>
+#include <algorithm>
+#include <stdexcept>
+
+#ifdef AVR_PROFILE
+#define PROFILE(x) prof.x
+#else
+#define PROFILE(x)
+#endif
 
 namespace coresim {
 
-std::string avr::name = "AVR";
+template <typename chip>
+std::string basic_avr<chip>::name = chip::name();
+
+template <typename chip>
+basic_avr<chip>::basic_avr(vmem &m, vio &i)
+	: basic_avr(m, i, std::make_shared<std::vector<insn>>(chip::flash_words)) {
+}
+
+template <typename chip>
+basic_avr<chip>::basic_avr(vmem &m, vio &i, const basic_avr &twin)
+	: basic_avr(m, i, twin.code) {
+}
+
+template <typename chip>
+basic_avr<chip>::basic_avr(vmem &m, vio &i, std::shared_ptr<std::vector<insn>> c)
+	: core(m, i), cycles(0), sched(cycles), irq(sched),
+	  timer0(sched, irq, chip::timer0()), wdt(sched, irq, chip::wdt()),
+	  usart0(sched, irq, chip::usart0()),
+	  coverage(nullptr),
+	  trace_out(nullptr),
+	  journal(nullptr),
+#ifdef AVR_PROFILE
+	  prof(chip::flash_words),
+#endif
+	  code(c), program(*code) {
+	std::memset(iomap, 0, sizeof(iomap));
+
+	const timer8::layout t = chip::timer0();
+
+	for (uint8_t port : { t.tifr, t.tccra, t.tccrb, t.tcnt, t.ocra, t.ocrb, t.timsk }) {
+		attach(port, &timer0);
+	}
+	attach(chip::wdt().wdtcsr, &wdt);
+
+	if (chip::usarts) {
+		const usart::layout u = chip::usart0();
+
+		for (uint8_t port : { u.ucsra, u.ucsrb, u.ucsrc, u.ubrrl, u.ubrrh, u.udr }) {
+			attach(port, &usart0);
+		}
+	}
 
-avr::avr(vmem &m, vio &i) : core(m, i) {
 	reset();
 }
 
-void avr::reset() {
+template <typename chip>
+void basic_avr<chip>::attach(uint8_t port, peripheral *p) {
+	iomap[port] = p;
+}
+
+template <typename chip>
+void basic_avr<chip>::reset() {
 	pc = 0;
-	sp = 0xffff;
-	std::memset(&regs, 0, sizeof(regs));
+	sp = ramend;
+	std::memset(&data, 0, sizeof(data));
 	std::memset(&sreg, 0, sizeof(sreg));
 	cycles = 0;
+	eind = 0;
+	rampz = 0;
+
+	smcr = 0;
+	sleeping = false;
+	held = false;
+	horizon = scheduler::never;
+	std::memset(&loop, 0, sizeof(loop));
+
+	std::memset(dirty, 0, sizeof(dirty));
+	base = nullptr;
+	std::memset(written, 0xff, sizeof(written));
+
+	prev = 0;
+
+	sched.clear();
+	irq.reset();
+	timer0.reset();
+	wdt.reset();
+	usart0.reset();
+}
+
+template <typename chip>
+void basic_avr<chip>::reflash() {
+	std::fill(program.begin(), program.end(), insn());
+	loop.head = 0;
+	loop.impure = true;
+}
+
+template <typename chip>
+usart &basic_avr<chip>::serial() {
+	if (!chip::usarts) {
+		throw std::runtime_error(std::string(chip::name()) + " has no USART");
+	}
+	return usart0;
+}
+
+template <typename chip>
+void basic_avr<chip>::write(uint16_t addr, const uint8_t *src, size_t n) {
+	for (size_t k = 0; k < n; k++) {
+		store(addr + k, src[k]);
+	}
+}
+
+template <typename chip>
+void basic_avr<chip>::profile(size_t top, const std::string &folded) {
+#ifdef AVR_PROFILE
+	prof.report(top);
+	prof.folded(folded, cycles);
+#else
+	throw std::runtime_error("AVR profiling is not compiled in");
+#endif
 }
 
-void avr::debug() {
+// coverage
+
+template <typename chip>
+void basic_avr<chip>::cover(uint8_t *bitmap) {
+	coverage = bitmap;
+	prev = 0;
+}
+
+// The first keyframe goes out right away, so the trace can be replayed
+// from its very first instruction.
+template <typename chip>
+void basic_avr<chip>::record(tracer *t) {
+	if (t && sizeof(pc_t) > 2) {
+		throw std::runtime_error("Traces only record 16-bit program counters");
+	}
+
+	trace_out = t;
+
+	if (trace_out) {
+		trace_out->keyframe(pc, sp, status(), cycles, data, sizeof(data));
+	}
+}
+
+// Called after every control transfer with the address of the new block.
+// Addresses are spread over the map by an odd multiplier; the previous one
+// is shifted so that A->B and B->A land on different entries.
+template <typename chip>
+inline void basic_avr<chip>::edge(uint16_t to) {
+	if (coverage) {
+		uint16_t cur = to * 0x9e37u;
+		coverage[cur ^ prev]++;
+		prev = cur >> 1;
+	}
+}
+
+// snapshots
+
+template <typename chip>
+basic_avr<chip>::snapshot::snapshot(basic_avr &c)
+	: data(data_size), sched(c.sched), irq(c.irq), timer0(c.timer0), wdt(c.wdt), usart0(c.usart0) {
+	c.save(*this);
+}
+
+template <typename chip>
+void basic_avr<chip>::save(snapshot &s) {
+	s.pc = pc;
+	s.sp = sp;
+	s.sreg = sreg;
+	s.cycles = cycles;
+	s.smcr = smcr;
+	s.sleeping = sleeping;
+	s.eind = eind;
+	s.rampz = rampz;
+	s.held = held;
+
+	std::memcpy(s.data.data(), data, sizeof(data));
+
+	s.sched = sched;
+	s.irq = irq;
+	s.timer0 = timer0;
+	s.wdt = wdt;
+	s.usart0 = usart0;
+
+	std::memset(dirty, 0, sizeof(dirty));
+	base = &s;
+}
+
+// Only the pages written since the snapshot was taken or last restored are
+// copied back, plus page 0: registers are written without going through
+// store().
+template <typename chip>
+void basic_avr<chip>::restore(const snapshot &s) {
+	const size_t page = 1 << page_bits;
+
+	if (&s == base) {
+		std::memcpy(data, s.data.data(), page);
+
+		for (int w = 0; w < (int)(sizeof(dirty) / sizeof(dirty[0])); w++) {
+			written[w] |= dirty[w];
+
+			for (uint64_t bits = dirty[w]; bits; bits &= bits - 1) {
+				size_t addr = ((w << 6) | __builtin_ctzll(bits)) << page_bits;
+				std::memcpy(data + addr, s.data.data() + addr, page);
+			}
+		}
+	}
+	else {
+		std::memcpy(data, s.data.data(), sizeof(data));
+		std::memset(written, 0xff, sizeof(written));
+	}
+
+	pc = s.pc;
+	sp = s.sp;
+	sreg = s.sreg;
+	cycles = s.cycles;
+	smcr = s.smcr;
+	sleeping = s.sleeping;
+	eind = s.eind;
+	rampz = s.rampz;
+	held = s.held;
+	loop.head = 0;
+	loop.impure = true;
+
+	sched = s.sched;
+	irq = s.irq;
+	timer0 = s.timer0;
+	wdt = s.wdt;
+	usart0 = s.usart0;
+
+	std::memset(dirty, 0, sizeof(dirty));
+	base = &s;
+
+	prev = 0;
+}
+
+template <typename chip>
+void basic_avr<chip>::debug() {
 	core::debug();
 
 	std::printf("-> Stopped at pc=0x%04x\n", pc << 1);
@@ -32,6 +254,149 @@ void avr::debug() {
 	}
 }
 
+// data space
+
+template <typename chip>
+inline uint8_t basic_avr<chip>::load(uint16_t addr) {
+	if ((uint16_t)(addr - io_start) < io_end - io_start) {
+		return io_read(addr - io_start);
+	}
+
+	return data[addr];
+}
+
+template <typename chip>
+inline void basic_avr<chip>::store(uint16_t addr, uint8_t value) {
+	if ((uint16_t)(addr - io_start) < io_end - io_start) {
+		io_write(addr - io_start, value);
+		return;
+	}
+
+	size_t w = addr >> (page_bits + 6);
+	uint64_t bit = 1ull << ((addr >> page_bits) & 63);
+
+	loop.impure = true;
+	dirty[w] |= bit;
+	written[w] |= bit;
+	data[addr] = value;
+
+	if (trace_out && (trace_out->detail() & tracer::memory)) {
+		trace_out->store(addr, value);
+	}
+}
+
+template <typename chip>
+inline uint8_t basic_avr<chip>::status() const {
+	return (sreg.c << 0) | (sreg.z << 1) | (sreg.n << 2) | (sreg.v << 3) |
+	       (sreg.s << 4) | (sreg.h << 5) | (sreg.t << 6) | (sreg.i << 7);
+}
+
+template <typename chip>
+uint8_t basic_avr<chip>::io_read(uint8_t port) {
+	switch (port) {
+		case chip::smcr: return smcr;
+		case chip::spl: return sp & 0xff;
+		case chip::sph: return (sp & 0xff00) >> 8;
+		case chip::sreg: return status();
+	}
+
+	if (chip::eind != 0 && port == chip::eind) {
+		return eind;
+	}
+	if (chip::rampz != 0 && port == chip::rampz) {
+		return rampz;
+	}
+
+	// anything that may change between two events breaks an idle loop
+	if (iomap[port]) {
+		if (!iomap[port]->stable(port)) {
+			loop.impure = true;
+		}
+		return iomap[port]->read(port);
+	}
+
+	loop.impure = true;
+	return journal ? journal->read(io, port) : io.get(port);
+}
+
+template <typename chip>
+void basic_avr<chip>::io_write(uint8_t port, uint8_t value) {
+	loop.impure = true;
+
+	switch (port) {
+		case chip::smcr: smcr = value & chip::smcr_bits; return;
+		case chip::spl: sp = (sp & 0xff00) | value; return;
+		case chip::sph: sp = (sp & 0x00ff) | (value << 8); return;
+		case chip::sreg:
+			sreg.c = value & 0x01; sreg.z = value & 0x02;
+			sreg.n = value & 0x04; sreg.v = value & 0x08;
+			sreg.s = value & 0x10; sreg.h = value & 0x20;
+			sreg.t = value & 0x40; sreg.i = value & 0x80;
+			if (sreg.i) {
+				sched.poke();
+			}
+			return;
+	}
+
+	if (chip::eind != 0 && port == chip::eind) {
+		eind = value;
+		return;
+	}
+	if (chip::rampz != 0 && port == chip::rampz) {
+		rampz = value;
+		return;
+	}
+
+	if (iomap[port]) {
+		iomap[port]->write(port, value);
+		return;
+	}
+
+	if (journal) {
+		journal->write(io, port, value);
+	}
+	else {
+		io.set(port, value);
+	}
+}
+
+template <typename chip>
+inline void basic_avr<chip>::push(uint8_t value) {
+	store(sp, value);
+	sp--;
+}
+
+template <typename chip>
+inline uint8_t basic_avr<chip>::pop() {
+	if (sp == ramend) {
+		throw fault();
+	}
+
+	sp++;
+	return load(sp);
+}
+
+template <typename chip>
+inline void basic_avr<chip>::push_pc() {
+	push(pc & 0xff);
+	push((pc >> 8) & 0xff);
+	if (chip::pc_bytes == 3) {
+		push((pc >> 16) & 0xff);
+	}
+}
+
+template <typename chip>
+inline void basic_avr<chip>::pop_pc() {
+	if (sp >= ramend - (chip::pc_bytes - 1)) {
+		throw fault();
+	}
+
+	pc = 0;
+	for (unsigned n = 0; n < chip::pc_bytes; n++) {
+		pc = (pc << 8) | pop();
+	}
+}
+
 // instruction execution
 
 namespace {
@@ -76,10 +441,10 @@ MASK_OP11  = 0xfe0f,
 	NEG    = 0x9401,
 	SWAP   = 0x9402,
 	INC    = 0x9403,
-	ASR    = 0x9404,
-	LSR    = 0x9405,
-	ROR    = 0x9406,
-	DEC    = 0x9407,
+	ASR    = 0x9405,
+	LSR    = 0x9406,
+	ROR    = 0x9407,
+	DEC    = 0x940a,
 	LDX    = 0x900c,
 	LDXI   = 0x900d,
 	LDXD   = 0x900e,
@@ -175,16 +540,6 @@ MASK_OP4   = 0xf000,
 	LDI    = 0xe000,
 };
 
-bool is_2words(uint16_t op) {
-	if (((op & MASK_OP10J) == CALL) ||
-	    ((op & MASK_OP10J) == JMP)  ||
-	    ((op & MASK_OP11) == LDS32) ||
-	    ((op & MASK_OP11) == STS32)) {
-		return true;
-	}
-	return false;
-}
-
 uint8_t clearb(uint8_t r, int b) {
 	return r & ~(1 << b);
 }
@@ -208,6 +563,11 @@ bool overflown(uint8_t rr, uint8_t r0, uint8_t r1, int n) {
 	       (! bitn(r0, n) && ! bitn(r1, n) && bitn(rr, n));
 }
 
+bool overflown_sub(uint8_t rr, uint8_t r0, uint8_t r1, int n) {
+	return (bitn(r0, n) && ! bitn(r1, n) && ! bitn(rr, n)) ||
+	       (! bitn(r0, n) && bitn(r1, n) && bitn(rr, n));
+}
+
 bool borrown(uint8_t rr, uint8_t r0, uint8_t r1, int n) {
 	return (! bitn(r0, n) && bitn(r1, n)) ||
 	       (bitn(r1, n) && bitn(rr, n)) ||
@@ -216,14 +576,122 @@ bool borrown(uint8_t rr, uint8_t r0, uint8_t r1, int n) {
 
 }
 
-void avr::_nop() {
+template <typename chip>
+uint8_t basic_avr<chip>::add8(uint8_t a, uint8_t b, bool carry) {
+	uint8_t R = a + b + carry;
+
+	sreg.h = carryn(R, a, b, 3);
+	sreg.v = overflown(R, a, b, 7);
+	sreg.n = bitn(R, 7);
+	sreg.s = sreg.n ^ sreg.v;
+	sreg.z = (R == 0);
+	sreg.c = carryn(R, a, b, 7);
+
+	return R;
+}
+
+// chained subtractions (cpc, sbc, sbci) only keep Z if it was already set
+template <typename chip>
+uint8_t basic_avr<chip>::sub8(uint8_t a, uint8_t b, bool carry, bool chain) {
+	uint8_t R = a - b - carry;
+
+	sreg.h = borrown(R, a, b, 3);
+	sreg.v = overflown_sub(R, a, b, 7);
+	sreg.n = bitn(R, 7);
+	sreg.s = sreg.n ^ sreg.v;
+	sreg.z = (R == 0) && (sreg.z || ! chain);
+	sreg.c = borrown(R, a, b, 7);
+
+	return R;
+}
+
+template <typename chip>
+void basic_avr<chip>::_fused(const insn &i) {
+	const insn *x = &i;
+	int n = i.n;
+
+	switch (i.id) {
+		case op_ldi:
+			for (int j = 0; j < n; j++) {
+				regs[x[j].a] = x[j].k;
+			}
+			cycles += n;
+			break;
+
+		case op_push:
+			for (int j = 0; j < n; j++) {
+				push(regs[x[j].a]);
+			}
+			cycles += 2 * n;
+			break;
+
+		case op_pop:
+			for (int j = 0; j < n; j++) {
+				regs[x[j].a] = pop();
+			}
+			cycles += 2 * n;
+			break;
+
+		case op_add:
+			regs[x[0].a] = add8(regs[x[0].a], regs[x[0].b], false);
+			for (int j = 1; j < n; j++) {
+				regs[x[j].a] = add8(regs[x[j].a], regs[x[j].b], sreg.c);
+			}
+			cycles += n;
+			break;
+
+		case op_sub:
+			regs[x[0].a] = sub8(regs[x[0].a], regs[x[0].b], false, false);
+			for (int j = 1; j < n; j++) {
+				regs[x[j].a] = sub8(regs[x[j].a], regs[x[j].b], sreg.c, true);
+			}
+			cycles += n;
+			break;
+
+		case op_subi:
+			regs[x[0].a] = sub8(regs[x[0].a], x[0].k, false, false);
+			for (int j = 1; j < n; j++) {
+				regs[x[j].a] = sub8(regs[x[j].a], x[j].k, sreg.c, true);
+			}
+			cycles += n;
+			break;
+
+		case op_cp:
+		case op_cpi:
+			sub8(regs[x[0].a], i.id == op_cp ? regs[x[0].b] : x[0].k,
+			     false, false);
+			for (int j = 1; j < n - 1; j++) {
+				sub8(regs[x[j].a], regs[x[j].b], sreg.c, true);
+			}
+			cycles += n;
+			if (sreg.z == false) {
+				pc += x[n-1].k;
+				cycles++;
+				if (x[n-1].k < 0) {
+					pc += n;
+					spin();
+					edge(pc);
+					return;
+				}
+			}
+			pc += n;
+			edge(pc);
+			return;
+	}
+
+	pc += n;
+}
+
+template <typename chip>
+void basic_avr<chip>::_nop() {
 	disas("nop");
 
 	pc++;
 	cycles++;
 }
 
-void avr::_movw(reg rd, reg rr) {
+template <typename chip>
+void basic_avr<chip>::_movw(reg rd, reg rr) {
 	disas("movw\tr%d:r%d, r%d:r%d", rd+1, rd, rr+1, rr);
 
 	regs[rd] = regs[rr];
@@ -232,7 +700,8 @@ void avr::_movw(reg rd, reg rr) {
 	pc++; cycles++;
 }
 
-void avr::_muls(reg rd, reg rr) {
+template <typename chip>
+void basic_avr<chip>::_muls(reg rd, reg rr) {
 	disas("muls\tr%d, r%d", rd, rr);
 
 	int16_t R = (int8_t)regs[rd] * (int8_t)regs[rr];
@@ -246,7 +715,8 @@ void avr::_muls(reg rd, reg rr) {
 	pc++; cycles += 2;
 }
 
-void avr::_mulsu(reg rd, reg rr) {
+template <typename chip>
+void basic_avr<chip>::_mulsu(reg rd, reg rr) {
 	disas("muls\tr%d, r%d", rd, rr);
 
 	int16_t R = (int8_t)regs[rd] * regs[rr];
@@ -260,7 +730,8 @@ void avr::_mulsu(reg rd, reg rr) {
 	pc++; cycles += 2;
 }
 
-void avr::_fmul(reg rd, reg rr) {
+template <typename chip>
+void basic_avr<chip>::_fmul(reg rd, reg rr) {
 	disas("fmul\tr%d, r%d", rd, rr);
 	
 	uint16_t R = (regs[rd] * regs[rr]) << 1;
@@ -274,7 +745,8 @@ void avr::_fmul(reg rd, reg rr) {
 	pc++; cycles += 2;
 }
 
-void avr::_fmuls(reg rd, reg rr) {
+template <typename chip>
+void basic_avr<chip>::_fmuls(reg rd, reg rr) {
 	disas("fmuls\tr%d, r%d", rd, rr);
 	
 	int16_t R = ((int8_t)regs[rd] * (int8_t)regs[rr]) << 1;
@@ -288,7 +760,8 @@ void avr::_fmuls(reg rd, reg rr) {
 	pc++; cycles+=2;
 }
 
-void avr::_fmulsu(reg rd, reg rr) {
+template <typename chip>
+void basic_avr<chip>::_fmulsu(reg rd, reg rr) {
 	disas("fmulsu\tr%d, r%d", rd, rr);
 	
 	int16_t R = ((int8_t)regs[rd] * regs[rr]) << 1;
@@ -302,121 +775,73 @@ void avr::_fmulsu(reg rd, reg rr) {
 	pc++; cycles+=2;
 }
 
-void avr::_cpc(reg rd, reg rr) {
+template <typename chip>
+void basic_avr<chip>::_cpc(reg rd, reg rr) {
 	disas("cpc\tr%d, r%d", rd, rr);
-	
-	uint8_t R = regs[rd] - regs[rr] - sreg.c;
 
-	sreg.h = borrown(R, regs[rd], regs[rr], 3);
-	sreg.n = bitn(regs[rd], 7);
-	sreg.v = overflown(R, regs[rd], regs[rr], 7);
-	sreg.s = sreg.n ^ sreg.v;
-	sreg.z = (R == 0) && sreg.z;
-	sreg.c = borrown(R, regs[rd], regs[rr], 7);
+	sub8(regs[rd], regs[rr], sreg.c, true);
 
 	pc++; cycles++;
 }
 
-void avr::_sbc(reg rd, reg rr) {
+template <typename chip>
+void basic_avr<chip>::_sbc(reg rd, reg rr) {
 	disas("sbc\tr%d, r%d", rd, rr);
 
-	uint8_t R = regs[rd] - regs[rr] - sreg.c;
-
-	sreg.h = borrown(R, regs[rd], regs[rr], 3);
-	sreg.v = overflown(R, regs[rd], regs[rr], 7);
-	sreg.n = bitn(R, 7);
-	sreg.s = sreg.n ^ sreg.v;
-	sreg.z = (R == 0) && sreg.z;
-	sreg.c = borrown(R, regs[rd], regs[rr], 7);
-
-	regs[rd] = R;
+	regs[rd] = sub8(regs[rd], regs[rr], sreg.c, true);
 
-	pc++; cycles+=2;
+	pc++; cycles++;
 }
 
-void avr::_add(reg rd, reg rr) {
+template <typename chip>
+void basic_avr<chip>::_add(reg rd, reg rr) {
 	disas("add\tr%d, r%d", rd, rr);
 
-	uint8_t R = regs[rd] + regs[rr];
-
-	sreg.h = carryn(R, regs[rd], regs[rr], 3);
-	sreg.v = overflown(R, regs[rd], regs[rr], 7);
-	sreg.n = bitn(R, 7);
-	sreg.s = sreg.n ^ sreg.v;
-	sreg.z = (R == 0);
-	sreg.c = carryn(R, regs[rd], regs[rr], 7);
-
-	regs[rd] = R;
+	regs[rd] = add8(regs[rd], regs[rr], false);
 
 	pc++; cycles++;
 }
 
-void avr::_cpse(reg rd, reg rr) {
+template <typename chip>
+void basic_avr<chip>::_cpse(reg rd, reg rr) {
 	disas("cpse\tr%d, r%d", rd, rr);
 
 	if (regs[rd] == regs[rr]) {
-		uint16_t op;
-		pc++; cycles++;
-		
-		mem.get(pc, &op);
-		if (is_2words(op)) {
-			pc++; cycles++;
-		}
+		skip();
 	}
 
 	pc++; cycles++;
 }
 
-void avr::_cp(reg rd, reg rr) {
+template <typename chip>
+void basic_avr<chip>::_cp(reg rd, reg rr) {
 	disas("cp\tr%d, r%d", rd, rr);
 
-	uint8_t R = regs[rd] - regs[rr];
-
-	sreg.h = borrown(R, regs[rd], regs[rr], 3);
-	sreg.n = bitn(regs[rd], 7);
-	sreg.v = overflown(R, regs[rd], regs[rr], 7);
-	sreg.s = sreg.n ^ sreg.v;
-	sreg.z = (R == 0);
-	sreg.c = borrown(R, regs[rd], regs[rr], 7);
+	sub8(regs[rd], regs[rr], false, false);
 
 	pc++; cycles++;
 }
 
-void avr::_sub(reg rd, reg rr) {
+template <typename chip>
+void basic_avr<chip>::_sub(reg rd, reg rr) {
 	disas("sub\tr%d, r%d", rd, rr);
-	
-	uint8_t R = regs[rd] - regs[rr];
 
-	sreg.h = borrown(R, regs[rd], regs[rr], 3);
-	sreg.v = overflown(R, regs[rd], regs[rr], 7);
-	sreg.n = bitn(R, 7);
-	sreg.s = sreg.n ^ sreg.v;
-	sreg.z = (R == 0);
-	sreg.c = borrown(R, regs[rd], regs[rr], 7);
-
-	regs[rd] = R;
+	regs[rd] = sub8(regs[rd], regs[rr], false, false);
 
 	pc++; cycles++;
 }
 
-void avr::_adc(reg rd, reg rr) {
+template <typename chip>
+void basic_avr<chip>::_adc(reg rd, reg rr) {
 	disas("adc\tr%d, r%d", rd, rr);
 
-	uint8_t R = regs[rd] + regs[rr] + sreg.c;
-
-	sreg.h = carryn(R, regs[rd], regs[rr], 3);
-	sreg.v = overflown(R, regs[rd], regs[rr], 7);
-	sreg.n = bitn(R, 7);
-	sreg.s = sreg.n ^ sreg.v;
-	sreg.z = (R == 0);
-	sreg.c = carryn(R, regs[rd], regs[rr], 7);
-
-	regs[rd] = R;
+	regs[rd] = add8(regs[rd], regs[rr], sreg.c);
 
 	pc++; cycles++;
 }
 
-void avr::_and(reg rd, reg rr) {
+template <typename chip>
+void basic_avr<chip>::_and(reg rd, reg rr) {
 	disas("and\tr%d, r%d", rd, rr);
 	
 	uint8_t R = regs[rd] & regs[rr];
@@ -431,10 +856,11 @@ void avr::_and(reg rd, reg rr) {
 	pc++; cycles++;
 }
 
-void avr::_eor(reg rd, reg rr) {
+template <typename chip>
+void basic_avr<chip>::_eor(reg rd, reg rr) {
 	disas("eor\tr%d, r%d", rd, rr);
 
-	uint8_t R = regs[rd] | regs[rr];
+	uint8_t R = regs[rd] ^ regs[rr];
 
 	sreg.v = false;
 	sreg.n = bitn(R, 7);
@@ -446,7 +872,8 @@ void avr::_eor(reg rd, reg rr) {
 	pc++; cycles++;
 }
 
-void avr::_or(reg rd, reg rr) {
+template <typename chip>
+void basic_avr<chip>::_or(reg rd, reg rr) {
 	disas("or\tr%d, r%d", rd, rr);
 
 	uint8_t R = regs[rd] | regs[rr];
@@ -461,7 +888,8 @@ void avr::_or(reg rd, reg rr) {
 	pc++; cycles++;
 }
 
-void avr::_mov(reg rd, reg rr) {
+template <typename chip>
+void basic_avr<chip>::_mov(reg rd, reg rr) {
 	disas("mov\tr%d, r%d", rd, rr);
 
 	regs[rd] = regs[rr];
@@ -469,58 +897,37 @@ void avr::_mov(reg rd, reg rr) {
 	pc++; cycles++;
 }
 
-void avr::_cpi(reg rd, uint8_t k) {
+template <typename chip>
+void basic_avr<chip>::_cpi(reg rd, uint8_t k) {
 	disas("cpi\tr%d, 0x%.2x", rd, k);
 
-	uint8_t R = regs[rd] - k;
-
-	sreg.h = borrown(R, regs[rd], k, 3);
-	sreg.v = overflown(R, regs[rd], k, 7);
-	sreg.n = bitn(R, 7);
-	sreg.s = sreg.n ^ sreg.v;
-	sreg.z = (R == 0);
-	sreg.c = borrown(R, regs[rd], k, 7);
+	sub8(regs[rd], k, false, false);
 
 	pc++; cycles++;
 }
 
-void avr::_sbci(reg rd, uint8_t k) {
+template <typename chip>
+void basic_avr<chip>::_sbci(reg rd, uint8_t k) {
 	disas("sbci\tr%d, 0x%x", rd, k);
-	
-	uint8_t R = regs[rd] - k - sreg.c;
 
-	sreg.h = borrown(R, regs[rd], k, 3);
-	sreg.v = overflown(R, regs[rd], k, 7);
-	sreg.n = bitn(R, 7);
-	sreg.s = sreg.n ^ sreg.v;
-	sreg.z = (R == 0) && sreg.z;
-	sreg.c = borrown(R, regs[rd], k, 7);
-
-	regs[rd] = R;
+	regs[rd] = sub8(regs[rd], k, sreg.c, true);
 
 	pc++; cycles++;
 }
 
 
-void avr::_subi(reg rd, uint8_t k) {
+template <typename chip>
+void basic_avr<chip>::_subi(reg rd, uint8_t k) {
 	disas("subi\tr%d, 0x%x", rd, k);
-	
-	uint8_t R = regs[rd] - k;
 
-	sreg.h = borrown(R, regs[rd], k, 3);
-	sreg.v = overflown(R, regs[rd], k, 7);
-	sreg.n = bitn(R, 7);
-	sreg.s = sreg.n ^ sreg.v;
-	sreg.z = (R == 0);
-	sreg.c = borrown(R, regs[rd], k, 7);
-
-	regs[rd] = R;
+	regs[rd] = sub8(regs[rd], k, false, false);
 
 	pc++; cycles++;
 }
 
-void avr::_ori(reg rd, uint8_t k) {
-	disas("subi\tr%d, 0x%x", rd, k);
+template <typename chip>
+void basic_avr<chip>::_ori(reg rd, uint8_t k) {
+	disas("ori\tr%d, 0x%x", rd, k);
 
 	uint8_t R = regs[rd] | k;
 
@@ -534,7 +941,8 @@ void avr::_ori(reg rd, uint8_t k) {
 	pc++; cycles++;
 }
 
-void avr::_andi(reg rd, uint8_t k) {
+template <typename chip>
+void basic_avr<chip>::_andi(reg rd, uint8_t k) {
 	disas("andi\tr%d, 0x%x", rd, k);
 
 	uint8_t R = regs[rd] & k;
@@ -549,7 +957,8 @@ void avr::_andi(reg rd, uint8_t k) {
 	pc++; cycles++;
 }
 
-void avr::_ld(reg rd, ireg ir, int inc) {
+template <typename chip>
+void basic_avr<chip>::_ld(reg rd, ireg ir, int inc) {
 	disas("ld\tr%d, %s%s%s", rd,
 	                        (inc == -1)?"-":"",
 	                        (ir == X)? "X": (ir == Y)? "Y" : "Z",
@@ -560,7 +969,7 @@ void avr::_ld(reg rd, ireg ir, int inc) {
 		cycles++;
 	}
 
-	mem.get(iregs[ir], &regs[rd]);
+	regs[rd] = load(iregs[ir]);
 
 	if (inc == +1) {
 		iregs[ir] += 1;
@@ -570,7 +979,8 @@ void avr::_ld(reg rd, ireg ir, int inc) {
 	pc++; cycles++;
 }
 
-void avr::_st(ireg ir, reg rr, int inc) {
+template <typename chip>
+void basic_avr<chip>::_st(ireg ir, reg rr, int inc) {
 	disas("st\t%s%s%s, r%d", (inc == -1)?"-":"",
 	                        (ir == X)? "X": (ir == Y)? "Y" : "Z",
 	                        (inc == +1)?"+":"",
@@ -581,7 +991,7 @@ void avr::_st(ireg ir, reg rr, int inc) {
 		cycles++;
 	}
 
-	mem.set(iregs[ir], regs[rr]);
+	store(iregs[ir], regs[rr]);
 
 	if (inc == +1) {
 		iregs[ir] += 1;
@@ -591,87 +1001,90 @@ void avr::_st(ireg ir, reg rr, int inc) {
 	pc++; cycles++;
 }
 
-void avr::_ldd(reg rd, ireg ir, uint8_t k) {
+template <typename chip>
+void basic_avr<chip>::_ldd(reg rd, ireg ir, uint8_t k) {
 	disas("ldd\tr%d, %s+%d", rd,
 	                        (ir == X)? "X": (ir == Y)? "Y" : "Z",
 	                        k);
 
-	mem.get(iregs[ir]+k, &regs[rd]);
+	regs[rd] = load(iregs[ir] + k);
 
 	pc++; cycles++;
 }
 
-void avr::_std(ireg ir, reg rr, uint8_t k) {
+template <typename chip>
+void basic_avr<chip>::_std(ireg ir, reg rr, uint8_t k) {
 	disas("std\t%s+%d, r%d", (ir == X)? "X": (ir == Y)? "Y" : "Z",
 	                        k,
 	                        rr);
 
-	mem.set(iregs[ir]+k, regs[rr]);
+	store(iregs[ir] + k, regs[rr]);
 
 	pc++; cycles++;
 }
 
-void avr::_pop(reg rr) {
+template <typename chip>
+void basic_avr<chip>::_pop(reg rr) {
 	disas("pop\tr%d", rr);
 
-	if (sp == 0xffff) {
-		throw fault();
-	}
-
-	sp++;
-	mem.get(pc, &regs[rr]);
+	regs[rr] = pop();
 
 	pc++; cycles+=2;
 }
 
-void avr::_push(reg rr) {
+template <typename chip>
+void basic_avr<chip>::_push(reg rr) {
 	disas("push\tr%d", rr);
 
-	mem.set(pc, regs[rr]);
-	sp--;
+	push(regs[rr]);
 
 	pc++; cycles+=2;
 }
 
-void avr::_lds(reg rd) {
+template <typename chip>
+void basic_avr<chip>::_lds(reg rd) {
 	uint16_t k;
 	mem.get((pc+1) << 1, &k, 2);
 
 	disas("lds\tr%d, 0x%x", rd, k);
 	
-	mem.get(k, &regs[rd]);
+	regs[rd] = load(k);
 
 	pc+=2; cycles+=2;
 }
 
-void avr::_lds(reg rd, uint8_t k) {
+template <typename chip>
+void basic_avr<chip>::_lds(reg rd, uint8_t k) {
 	disas("lds\tr%d, 0x%x", rd, k);
 
-	mem.get(k, &regs[rd]);
+	regs[rd] = load(k);
 
 	pc++; cycles++;
 }
 
-void avr::_sts(reg rr) {
+template <typename chip>
+void basic_avr<chip>::_sts(reg rr) {
 	uint16_t k;
 	mem.get((pc+1) << 1, &k, 2);
 
 	disas("sts\t0x%x, r%d", rr, k);
 	
-	mem.set(k, regs[rr]);
+	store(k, regs[rr]);
 
 	pc+=2; cycles+=2;
 }
 
-void avr::_sts(reg rr, uint8_t k) {
+template <typename chip>
+void basic_avr<chip>::_sts(reg rr, uint8_t k) {
 	disas("sts\t0x%x, r%d", rr, k);
 
-	mem.set(k, regs[rr]);
+	store(k, regs[rr]);
 
 	pc++; cycles++;
 }
 
-void avr::_lpm(reg rd, int inc) {
+template <typename chip>
+void basic_avr<chip>::_lpm(reg rd, int inc) {
 	disas("lpm\tr%d, Z%s", rd, (inc == +1)?"+":"");
 
 	mem.get(iregs[Z], &regs[rd]);
@@ -682,13 +1095,28 @@ void avr::_lpm(reg rd, int inc) {
 	pc++; cycles+=3;
 }
 
-void avr::_elpm(reg rd, int inc) {
+template <typename chip>
+void basic_avr<chip>::_elpm(reg rd, int inc) {
 	disas("elpm\tr%d, Z%s", rd, (inc == +1)?"+":"");
 
-	throw unimplemented();
+	if (chip::rampz == 0) {
+		throw illegal();
+	}
+
+	uint32_t z = (rampz << 16) | iregs[Z];
+
+	mem.get(z, &regs[rd]);
+	if (inc == +1) {
+		z++;
+		iregs[Z] = z;
+		rampz = z >> 16;
+	}
+
+	pc++; cycles+=3;
 }
 
-void avr::_jmp(uint32_t h) {
+template <typename chip>
+void basic_avr<chip>::_jmp(uint32_t h) {
 	uint16_t k;
 	mem.get((pc+1) << 1, &k, 2);
 	h = (h << 16) + k;
@@ -696,32 +1124,36 @@ void avr::_jmp(uint32_t h) {
 	disas("jmp\t0x%x", h << 1);
 
 	pc = h;
+	edge(pc);
 
 	cycles+=3;
 }
 
-void avr::_call(uint32_t h) {
+template <typename chip>
+void basic_avr<chip>::_call(uint32_t h) {
 	uint16_t k;
 	mem.get((pc+1) << 1, &k, 2);
 	h = (h << 16) + k;
 
 	disas("call\t0x%x", h << 1);
 
-	pc+=2; sp--;
-	mem.set(sp, pc);
-	sp--;
+	pc+=2;
+	push_pc();
 	pc = h;
+	edge(pc);
 
-	cycles+=4;
+	cycles+=4 + (chip::pc_bytes == 3);
+	PROFILE(call(pc, cycles));
 }
 
-void avr::_com(reg rd) {
+template <typename chip>
+void basic_avr<chip>::_com(reg rd) {
 	disas("com\tr%d", rd);
 
 	uint8_t R = ~regs[rd];
 
 	sreg.v = false;
-	sreg.n = bitn(regs[rd], 7);
+	sreg.n = bitn(R, 7);
 	sreg.s = sreg.n ^ sreg.v;
 	sreg.z = (R == 0);
 	sreg.c = true;
@@ -731,7 +1163,8 @@ void avr::_com(reg rd) {
 	pc++; cycles++;
 }
 
-void avr::_neg(reg rd) {
+template <typename chip>
+void basic_avr<chip>::_neg(reg rd) {
 	disas("neg\tr%d", rd);
 
 	uint8_t R = 0 - regs[rd];
@@ -748,15 +1181,17 @@ void avr::_neg(reg rd) {
 	pc++; cycles++;
 }
 
-void avr::_swap(reg rd) {
+template <typename chip>
+void basic_avr<chip>::_swap(reg rd) {
 	disas("swap\tr%d", rd);
 
-	regs[rd] = (regs[rd] & 0x0f) << 4 && (regs[rd] & 0xf0) >> 4;
+	regs[rd] = (regs[rd] & 0x0f) << 4 | (regs[rd] & 0xf0) >> 4;
 
 	pc++; cycles++;
 }
 
-void avr::_inc(reg rd) {
+template <typename chip>
+void basic_avr<chip>::_inc(reg rd) {
 	disas("inc\tr%d", rd);
 
 	uint8_t R = regs[rd] + 1;
@@ -771,7 +1206,8 @@ void avr::_inc(reg rd) {
 	pc++; cycles++;
 }
 
-void avr::_asr(reg rd) {
+template <typename chip>
+void basic_avr<chip>::_asr(reg rd) {
 	disas("asr\tr%d", rd);
 	
 	uint8_t R = (regs[rd] & 0x80) | (regs[rd] >> 1);
@@ -787,7 +1223,8 @@ void avr::_asr(reg rd) {
 	pc++; cycles++;
 }
 
-void avr::_lsr(reg rd) {
+template <typename chip>
+void basic_avr<chip>::_lsr(reg rd) {
 	disas("lsr\tr%d", rd);
 
 	uint8_t R = (regs[rd] >> 1);
@@ -803,7 +1240,8 @@ void avr::_lsr(reg rd) {
 	pc++; cycles++;
 }
 
-void avr::_ror(reg rd) {
+template <typename chip>
+void basic_avr<chip>::_ror(reg rd) {
 	disas("ror\tr%d", rd);
 
 	uint8_t R = (sreg.c << 7) | (regs[rd] >> 1);
@@ -819,22 +1257,24 @@ void avr::_ror(reg rd) {
 	pc++; cycles++;
 }
 
-void avr::_dec(reg rd) {
+template <typename chip>
+void basic_avr<chip>::_dec(reg rd) {
 	disas("dec\tr%d", rd);
 
 	uint8_t R = regs[rd] - 1;
 
-	sreg.n = bitn(regs[rd], 7);
+	sreg.n = bitn(R, 7);
 	sreg.v = (regs[rd] == 0x80);
 	sreg.s = sreg.n ^ sreg.v;
-	sreg.z = (R == 0x7f);
+	sreg.z = (R == 0);
 
 	regs[rd] = R;
 
 	pc++; cycles++;
 }
 
-void avr::_mul(reg rd, reg rr) {
+template <typename chip>
+void basic_avr<chip>::_mul(reg rd, reg rr) {
 	disas("mul\tr%d, r%d", rd, rr);
 
 	uint16_t R = regs[rd] * regs[rr];
@@ -848,21 +1288,32 @@ void avr::_mul(reg rd, reg rr) {
 	pc++; cycles+=2;
 }
 
-void avr::_ijmp() {
+template <typename chip>
+void basic_avr<chip>::_ijmp() {
 	disas("ijmp");
 
 	pc = iregs[Z];
+	edge(pc);
 
-	pc++; cycles+=2;
+	cycles+=2;
 }
 
-void avr::_eijmp() {
+template <typename chip>
+void basic_avr<chip>::_eijmp() {
 	disas("eijmp");
 
-	throw unimplemented();
+	if (chip::eind == 0) {
+		throw illegal();
+	}
+
+	pc = (eind << 16) | iregs[Z];
+	edge(pc);
+
+	cycles+=2;
 }
 
-void avr::_sec() {
+template <typename chip>
+void basic_avr<chip>::_sec() {
 	disas("sec");
 
 	sreg.c = true;
@@ -870,7 +1321,8 @@ void avr::_sec() {
 	pc++; cycles++;
 }
 
-void avr::_sez() {
+template <typename chip>
+void basic_avr<chip>::_sez() {
 	disas("sez");
 
 	sreg.z = true;
@@ -878,7 +1330,8 @@ void avr::_sez() {
 	pc++; cycles++;
 }
 
-void avr::_sen() {
+template <typename chip>
+void basic_avr<chip>::_sen() {
 	disas("sen");
 
 	sreg.n = true;
@@ -886,7 +1339,8 @@ void avr::_sen() {
 	pc++; cycles++;
 }
 
-void avr::_sev() {
+template <typename chip>
+void basic_avr<chip>::_sev() {
 	disas("sev");
 
 	sreg.v = true;
@@ -894,7 +1348,8 @@ void avr::_sev() {
 	pc++; cycles++;
 }
 
-void avr::_ses() {
+template <typename chip>
+void basic_avr<chip>::_ses() {
 	disas("ses");
 
 	sreg.s = true;
@@ -902,7 +1357,8 @@ void avr::_ses() {
 	pc++; cycles++;
 }
 
-void avr::_seh() {
+template <typename chip>
+void basic_avr<chip>::_seh() {
 	disas("seh");
 
 	sreg.h = true;
@@ -910,7 +1366,8 @@ void avr::_seh() {
 	pc++; cycles++;
 }
 
-void avr::_set() {
+template <typename chip>
+void basic_avr<chip>::_set() {
 	disas("set");
 
 	sreg.t = true;
@@ -918,15 +1375,18 @@ void avr::_set() {
 	pc++; cycles++;
 }
 
-void avr::_sei() {
+template <typename chip>
+void basic_avr<chip>::_sei() {
 	disas("sei");
 
 	sreg.i = true;
+	hold();
 
 	pc++; cycles++;
 }
 
-void avr::_clc() {
+template <typename chip>
+void basic_avr<chip>::_clc() {
 	disas("clc");
 
 	sreg.c = false;
@@ -934,7 +1394,8 @@ void avr::_clc() {
 	pc++; cycles++;
 }
 
-void avr::_clz() {
+template <typename chip>
+void basic_avr<chip>::_clz() {
 	disas("clz");
 
 	sreg.z = false;
@@ -942,7 +1403,8 @@ void avr::_clz() {
 	pc++; cycles++;
 }
 
-void avr::_cln() {
+template <typename chip>
+void basic_avr<chip>::_cln() {
 	disas("cln");
 
 	sreg.n = false;
@@ -950,7 +1412,8 @@ void avr::_cln() {
 	pc++; cycles++;
 }
 
-void avr::_clv() {
+template <typename chip>
+void basic_avr<chip>::_clv() {
 	disas("clv");
 
 	sreg.v = false;
@@ -958,7 +1421,8 @@ void avr::_clv() {
 	pc++; cycles++;
 }
 
-void avr::_cls() {
+template <typename chip>
+void basic_avr<chip>::_cls() {
 	disas("cls");
 
 	sreg.s = false;
@@ -966,7 +1430,8 @@ void avr::_cls() {
 	pc++; cycles++;
 }
 
-void avr::_clh() {
+template <typename chip>
+void basic_avr<chip>::_clh() {
 	disas("clh");
 
 	sreg.h = false;
@@ -974,7 +1439,8 @@ void avr::_clh() {
 	pc++; cycles++;
 }
 
-void avr::_clt() {
+template <typename chip>
+void basic_avr<chip>::_clt() {
 	disas("clt");
 
 	sreg.t = false;
@@ -982,7 +1448,8 @@ void avr::_clt() {
 	pc++; cycles++;
 }
 
-void avr::_cli() {
+template <typename chip>
+void basic_avr<chip>::_cli() {
 	disas("cli");
 
 	sreg.i = false;
@@ -990,61 +1457,75 @@ void avr::_cli() {
 	pc++; cycles++;
 }
 
-void avr::_icall() {
+template <typename chip>
+void basic_avr<chip>::_icall() {
 	disas("icall");
 
 	pc++;
-	sp--;
-	mem.set(sp, pc);
-	sp--;
+	push_pc();
 	pc = iregs[Z];
+	edge(pc);
 
-	cycles+=3;
+	cycles+=3 + (chip::pc_bytes == 3);
+	PROFILE(call(pc, cycles));
 }
 
-void avr::_eicall() {
+template <typename chip>
+void basic_avr<chip>::_eicall() {
 	disas("eicall");
 
-	throw unimplemented();
+	if (chip::eind == 0) {
+		throw illegal();
+	}
+
+	pc++;
+	push_pc();
+	pc = (eind << 16) | iregs[Z];
+	edge(pc);
+
+	cycles+=4;
+	PROFILE(call(pc, cycles));
 }
 
-void avr::_ret() {
+template <typename chip>
+void basic_avr<chip>::_ret() {
 	disas("ret");
 
-	if (sp >= 0xfffe) {
-		throw fault();
-	}
-
-	sp++;
-	mem.get(sp, &pc);
-	sp++;
+	pop_pc();
+	edge(pc);
 
-	cycles+=4;
+	cycles+=4 + (chip::pc_bytes == 3);
+	PROFILE(ret(cycles));
 }
 
-void avr::_reti() {
+template <typename chip>
+void basic_avr<chip>::_reti() {
 	disas("iret");
 	
-	if (sp >= 0xfffe) {
-		throw fault();
-	}
-
-	sp++;
-	mem.get(sp, &pc);
-	sp++;
+	pop_pc();
+	edge(pc);
 
 	sreg.i = true;
+	hold();
 
-	cycles+=4;
+	cycles+=4 + (chip::pc_bytes == 3);
+	PROFILE(ret(cycles));
 }
 
-void avr::_sleep() {
+template <typename chip>
+void basic_avr<chip>::_sleep() {
 	disas("sleep");
 
-	throw unimplemented();
+	if (smcr & chip::se) {
+		sleeping = true;
+		loop.impure = true;
+	}
+
+	pc++; cycles++;
 }
 
-void avr::_break() {
+template <typename chip>
+void basic_avr<chip>::_break() {
 	disas("break");
 
 	debug();
@@ -1052,15 +1533,18 @@ void avr::_break() {
 	pc++;
 }
 
-void avr::_wdr() {
+template <typename chip>
+void basic_avr<chip>::_wdr() {
 	disas("wdr");
 
-	watchdog = 0;
+	wdt.restart();
+	loop.impure = true;
 
 	pc++; cycles++;
 }
 
-void avr::_lpm() {
+template <typename chip>
+void basic_avr<chip>::_lpm() {
 	disas("lpm");
 
 	mem.get(iregs[Z], &regs[r0]);
@@ -1068,22 +1552,31 @@ void avr::_lpm() {
 	pc++; cycles+=3;
 }
 
-void avr::_elpm() {
+template <typename chip>
+void basic_avr<chip>::_elpm() {
 	disas("elpm");
 
-	throw unimplemented();
+	if (chip::rampz == 0) {
+		throw illegal();
+	}
+
+	mem.get((rampz << 16) | iregs[Z], &regs[r0]);
+
+	pc++; cycles+=3;
 }
 
-void avr::_spm() {
+template <typename chip>
+void basic_avr<chip>::_spm() {
 	disas("spm");
 
 	throw unimplemented();
 }
 
-void avr::_adiw(reg rd, uint8_t k) {
+template <typename chip>
+void basic_avr<chip>::_adiw(reg rd, uint8_t k) {
 	disas("adiw\tr%d:r%d, 0x%x" , rd+1, rd, k);
 
-	uint16_t R = (regs[rd+1] << 8) | regs[rd] + k;
+	uint16_t R = ((regs[rd+1] << 8) | regs[rd]) + k;
 
 	sreg.v = ! bitn(regs[rd+1], 7) && bitn(R, 15);
 	sreg.n = bitn(R, 15);
@@ -1097,10 +1590,11 @@ void avr::_adiw(reg rd, uint8_t k) {
 	pc++; cycles+=2;
 }
 
-void avr::_sbiw(reg rd, uint8_t k) {
+template <typename chip>
+void basic_avr<chip>::_sbiw(reg rd, uint8_t k) {
 	disas("sbiw\tr%d:r%d, 0x%x" , rd+1, rd, k);
 
-	uint16_t R = (regs[rd+1] << 8) | regs[rd] - k;
+	uint16_t R = ((regs[rd+1] << 8) | regs[rd]) - k;
 
 	sreg.v = bitn(regs[rd+1], 7) && ! bitn(R, 15);
 	sreg.n = bitn(R, 15);
@@ -1114,73 +1608,66 @@ void avr::_sbiw(reg rd, uint8_t k) {
 	pc++; cycles+=2;
 }
 
-void avr::_cbi(uint8_t port, uint8_t k) {
-	disas("cbi 0x%x, %d", port, k);
+template <typename chip>
+void basic_avr<chip>::_cbi(uint8_t port, uint8_t k) {
+	disas("cbi\t0x%x, %d", port, k);
 
-	throw unimplemented();
+	io_write(port, clearb(io_read(port), k));
+
+	pc++; cycles+=2;
 }
 
-void avr::_sbic(uint8_t port, uint8_t k) {
-	disas("sbic 0x%x, %d", port, k);
+template <typename chip>
+void basic_avr<chip>::_sbic(uint8_t port, uint8_t k) {
+	disas("sbic\t0x%x, %d", port, k);
 
-	throw unimplemented();
+	if (bitn(io_read(port), k) == false) {
+		skip();
+	}
+
+	pc++; cycles++;
 }
 
-void avr::_sbi(uint8_t port, uint8_t k) {
-	disas("sbi 0x%x, %d", port, k);
+template <typename chip>
+void basic_avr<chip>::_sbi(uint8_t port, uint8_t k) {
+	disas("sbi\t0x%x, %d", port, k);
 
-	throw unimplemented();
+	io_write(port, setb(io_read(port), k));
+
+	pc++; cycles+=2;
 }
 
-void avr::_sbis(uint8_t port, uint8_t k) {
-	disas("sbis 0x%x, %d", port, k);
+template <typename chip>
+void basic_avr<chip>::_sbis(uint8_t port, uint8_t k) {
+	disas("sbis\t0x%x, %d", port, k);
 
-	throw unimplemented();
+	if (bitn(io_read(port), k) == true) {
+		skip();
+	}
+
+	pc++; cycles++;
 }
 
-void avr::_in(reg rd, uint8_t port) {
+template <typename chip>
+void basic_avr<chip>::_in(reg rd, uint8_t port) {
 	disas("in\tr%d, 0x%x", rd, port);
 
-	enum {
-		sph = 0x3e,
-		spl = 0x3d,
-	};
-
-	if (port == sph) {
-		regs[rd] = (sp & 0xff00) >> 8;
-	}
-	else if (port == spl) {
-		regs[rd] = sp & 0xff;
-	}
-	else {
-		regs[rd] = io.get(port);
-	}
+	regs[rd] = io_read(port);
 
 	pc++; cycles++;
 }
 
-void avr::_out(uint8_t port, reg rr) {
+template <typename chip>
+void basic_avr<chip>::_out(uint8_t port, reg rr) {
 	disas("out\t0x%x, r%d", port, rr);
 
-	enum {
-		sph = 0x3e,
-		spl = 0x3d,
-	};
-
-	if (port == sph) {
-		sp = (sp & 0x00ff) | (regs[rr] << 8);
-	}
-	else if (port == spl) {
-		sp = (sp & 0xff00) | regs[rr];
-	}
-	else {
-		io.set(port, regs[rr]);
-	}
+	io_write(port, regs[rr]);
 
 	pc++; cycles++;
 }
 
-void avr::_rjmp(int16_t offset) {
+template <typename chip>
+void basic_avr<chip>::_rjmp(int16_t offset) {
 	disas("rjmp\t.%+d", offset << 1);
 
 	if (is_verbose) {
@@ -1191,22 +1678,30 @@ void avr::_rjmp(int16_t offset) {
 	}
 
 	pc += offset + 1;
+	edge(pc);
 
 	cycles+=2;
+
+	if (offset < 0) {
+		spin();
+	}
 }
 
-void avr::_rcall(int16_t offset) {
+template <typename chip>
+void basic_avr<chip>::_rcall(int16_t offset) {
 	disas("rcall\t.%+d", offset << 1);
 
-	pc++; sp--;
-	mem.set(sp, pc);
-	sp--;
+	pc++;
+	push_pc();
 	pc += offset;
+	edge(pc);
 
-	cycles+=3;
+	cycles+=3 + (chip::pc_bytes == 3);
+	PROFILE(call(pc, cycles));
 }
 
-void avr::_ldi(reg rd, uint8_t k) {
+template <typename chip>
+void basic_avr<chip>::_ldi(reg rd, uint8_t k) {
 	disas("ldi\tr%d, 0x%.2x", rd, k);
 	
 	regs[rd] = k;
@@ -1214,179 +1709,136 @@ void avr::_ldi(reg rd, uint8_t k) {
 	pc++; cycles++;
 }
 
-void avr::_brcs(int8_t offset) {
-	disas("brcs\t.%+d", (offset << 1));
+template <typename chip>
+inline void basic_avr<chip>::branch(bool taken, int8_t offset) {
+	pc++; cycles++;
 
-	if (sreg.c) {
+	if (taken) {
 		pc += offset;
 		cycles++;
+
+		if (offset < 0) {
+			spin();
+		}
 	}
 
-	pc++; cycles++;
+	edge(pc);
 }
 
-void avr::_breq(int8_t offset) {
-	disas("breq\t.%+d", (offset << 1));
+template <typename chip>
+void basic_avr<chip>::_brcs(int8_t offset) {
+	disas("brcs\t.%+d", (offset << 1));
 
-	if (sreg.z) {
-		pc += offset;
-		cycles++;
-	}
+	branch(sreg.c, offset);
+}
 
-	pc++; cycles++;
+template <typename chip>
+void basic_avr<chip>::_breq(int8_t offset) {
+	disas("breq\t.%+d", (offset << 1));
+
+	branch(sreg.z, offset);
 }
 
-void avr::_brmi(int8_t offset) {
+template <typename chip>
+void basic_avr<chip>::_brmi(int8_t offset) {
 	disas("brmi\t.%+d", (offset << 1));
 
-	if (sreg.n) {
-		pc += offset;
-		cycles++;
-	}
-
-	pc++; cycles++;
+	branch(sreg.n, offset);
 }
 
-void avr::_brvs(int8_t offset) {
+template <typename chip>
+void basic_avr<chip>::_brvs(int8_t offset) {
 	disas("brvs\t.%+d", (offset << 1));
 
-	if (sreg.v) {
-		pc += offset;
-		cycles++;
-	}
-
-	pc++; cycles++;
+	branch(sreg.v, offset);
 }
 
-void avr::_brlt(int8_t offset) {
+template <typename chip>
+void basic_avr<chip>::_brlt(int8_t offset) {
 	disas("brlt\t.%+d", (offset << 1));
 
-	if (sreg.s) {
-		pc += offset;
-		cycles++;
-	}
-
-	pc++; cycles++;
+	branch(sreg.s, offset);
 }
 
-void avr::_brhs(int8_t offset) {
+template <typename chip>
+void basic_avr<chip>::_brhs(int8_t offset) {
 	disas("brhs\t.%+d", (offset << 1));
 
-	if (sreg.h) {
-		pc += offset;
-		cycles++;
-	}
-
-	pc++; cycles++;
+	branch(sreg.h, offset);
 }
 
-void avr::_brts(int8_t offset) {
+template <typename chip>
+void basic_avr<chip>::_brts(int8_t offset) {
 	disas("brts\t.%+d", (offset << 1));
 
-	if (sreg.t) {
-		pc += offset;
-		cycles++;
-	}
-
-	pc++; cycles++;
+	branch(sreg.t, offset);
 }
 
-void avr::_brie(int8_t offset) {
+template <typename chip>
+void basic_avr<chip>::_brie(int8_t offset) {
 	disas("brie\t.%+d", (offset << 1));
 
-	if (sreg.i) {
-		pc += offset;
-		cycles++;
-	}
-
-	pc++; cycles++;
+	branch(sreg.i, offset);
 }
 
-void avr::_brcc(int8_t offset) {
+template <typename chip>
+void basic_avr<chip>::_brcc(int8_t offset) {
 	disas("brcc\t.%+d", (offset << 1));
 
-	if (sreg.c == false) {
-		pc += offset;
-		cycles++;
-	}
-
-	pc++; cycles++;
+	branch(sreg.c == false, offset);
 }
 
-void avr::_brne(int8_t offset) {
+template <typename chip>
+void basic_avr<chip>::_brne(int8_t offset) {
 	disas("brne\t.%+d", (offset << 1));
 
-	if (sreg.z == false) {
-		pc += offset;
-		cycles++;
-	}
-
-	pc++; cycles++;
+	branch(sreg.z == false, offset);
 }
 
-void avr::_brpl(int8_t offset) {
+template <typename chip>
+void basic_avr<chip>::_brpl(int8_t offset) {
 	disas("brpl\t.%+d", (offset << 1));
 
-	if (sreg.n == false) {
-		pc += offset;
-		cycles++;
-	}
-
-	pc++; cycles++;
+	branch(sreg.n == false, offset);
 }
 
-void avr::_brvc(int8_t offset) {
+template <typename chip>
+void basic_avr<chip>::_brvc(int8_t offset) {
 	disas("brvc\t.%+d", (offset << 1));
 
-	if (sreg.v == false) {
-		pc += offset;
-		cycles++;
-	}
-
-	pc++; cycles++;
+	branch(sreg.v == false, offset);
 }
 
-void avr::_brge(int8_t offset) {
+template <typename chip>
+void basic_avr<chip>::_brge(int8_t offset) {
 	disas("brge\t.%+d", (offset << 1));
 
-	if (sreg.s == false) {
-		pc += offset;
-		cycles++;
-	}
-
-	pc++; cycles++;}
+	branch(sreg.s == false, offset);
+}
 
-void avr::_brhc(int8_t offset) {
+template <typename chip>
+void basic_avr<chip>::_brhc(int8_t offset) {
 	disas("brhc\t.%+d", (offset << 1));
 
-	if (sreg.h == false) {
-		pc += offset;
-		cycles++;
-	}
-
-	pc++; cycles++;}
+	branch(sreg.h == false, offset);
+}
 
-void avr::_brtc(int8_t offset) {
+template <typename chip>
+void basic_avr<chip>::_brtc(int8_t offset) {
 	disas("brtc\t.%+d", (offset << 1));
 
-	if (sreg.t == false) {
-		pc += offset;
-		cycles++;
-	}
-
-	pc++; cycles++;}
+	branch(sreg.t == false, offset);
+}
 
-void avr::_brid(int8_t offset) {
+template <typename chip>
+void basic_avr<chip>::_brid(int8_t offset) {
 	disas("brid\t%d", (offset << 1));
 
-	if (sreg.i == false) {
-		pc += offset;
-		cycles++;
-	}
-
-	pc++; cycles++;}
+	branch(sreg.i == false, offset);
+}
 
-void avr::_bld(reg rd, uint8_t k) {
+template <typename chip>
+void basic_avr<chip>::_bld(reg rd, uint8_t k) {
 	disas("bld\tr%d, %d", rd, k);
 
 	if (sreg.t) {
@@ -1399,7 +1851,8 @@ void avr::_bld(reg rd, uint8_t k) {
 	pc++; cycles++;
 }
 
-void avr::_bst(reg rd, uint8_t k) {
+template <typename chip>
+void basic_avr<chip>::_bst(reg rd, uint8_t k) {
 	disas("bst\tr%d, %d", rd, k);
 
 	sreg.t = bitn(regs[rd], k);
@@ -1407,33 +1860,23 @@ void avr::_bst(reg rd, uint8_t k) {
 	pc++; cycles++;
 }
 
-void avr::_sbrc(reg rd, uint8_t k) {
+template <typename chip>
+void basic_avr<chip>::_sbrc(reg rd, uint8_t k) {
 	disas("sbrc\tr%d, %d", rd, k);
 
 	if (bitn(regs[rd], k) == false) {
-		uint16_t op;
-		mem.get(pc+1, &op);
-
-		pc++; cycles++;
-		if (is_2words(op)) {
-			pc++; cycles++;
-		}
+		skip();
 	}
 
 	pc++; cycles++;
 }
 
-void avr::_sbrs(reg rd, uint8_t k) {
+template <typename chip>
+void basic_avr<chip>::_sbrs(reg rd, uint8_t k) {
 	disas("sbrs\tr%d, %d", rd, k);
 
 	if (bitn(regs[rd], k) == true) {
-		uint16_t op;
-		mem.get(pc+1, &op);
-
-		pc++; cycles++;
-		if (is_2words(op)) {
-			pc++; cycles++;
-		}
+		skip();
 	}
 
 	pc++; cycles++;
@@ -1441,255 +1884,681 @@ void avr::_sbrs(reg rd, uint8_t k) {
 
 // instruction decoding
 
-avr::reg avr::_2d(uint16_t op) {
+template <typename chip>
+typename basic_avr<chip>::reg basic_avr<chip>::_2d(uint16_t op) {
 	return static_cast<reg>(24 + (((op & 0x30) >> 4) << 1));
 }
 
-avr::reg avr::_3d(uint16_t op) {
+template <typename chip>
+typename basic_avr<chip>::reg basic_avr<chip>::_3d(uint16_t op) {
 	return static_cast<reg>(16 + ((op & 0x70) >> 4));
 }
 
-avr::reg avr::_3r(uint16_t op) {
+template <typename chip>
+typename basic_avr<chip>::reg basic_avr<chip>::_3r(uint16_t op) {
 	return static_cast<reg>(16 + ((op & 0x07) >> 0));
 }
 
-avr::reg avr::_4d(uint16_t op) {
+template <typename chip>
+typename basic_avr<chip>::reg basic_avr<chip>::_4d(uint16_t op) {
 	return static_cast<reg>(16 + ((op & 0xf0) >> 4));
 }
 
-avr::reg avr::_4dl(uint16_t op) {
+template <typename chip>
+typename basic_avr<chip>::reg basic_avr<chip>::_4dl(uint16_t op) {
 	return static_cast<reg>(((op & 0xf0) >> 4) << 1);
 }
 
-avr::reg avr::_4r(uint16_t op) {
+template <typename chip>
+typename basic_avr<chip>::reg basic_avr<chip>::_4r(uint16_t op) {
 	return static_cast<reg>(16 + (op & 0x0f));
 }
 
-avr::reg avr::_4rl(uint16_t op) {
+template <typename chip>
+typename basic_avr<chip>::reg basic_avr<chip>::_4rl(uint16_t op) {
 	return static_cast<reg>((op & 0x0f) << 1);
 }
 
-avr::reg avr::_5d(uint16_t op) {
+template <typename chip>
+typename basic_avr<chip>::reg basic_avr<chip>::_5d(uint16_t op) {
 	return static_cast<reg>((op & 0x1f0) >> 4);
 }
 
-avr::reg avr::_5r(uint16_t op) {
+template <typename chip>
+typename basic_avr<chip>::reg basic_avr<chip>::_5r(uint16_t op) {
 	return static_cast<reg>(((op & 0x200) >> 5) + (op & 0xf));
 }
 
-uint8_t avr::_5p(uint16_t op) {
+template <typename chip>
+uint8_t basic_avr<chip>::_5p(uint16_t op) {
 	return (op & 0xf8) >> 3;
 }
 
-uint8_t avr::_6p(uint16_t op) {
+template <typename chip>
+uint8_t basic_avr<chip>::_6p(uint16_t op) {
 	return ((op & 0x600) >> 5) + (op & 0xf);
 }
 
-uint8_t avr::_6q(uint16_t op) {
+template <typename chip>
+uint8_t basic_avr<chip>::_6q(uint16_t op) {
 	return ((op & 0x2000) >> 8) + ((op & 0xc00) >> 7) + (op & 0x7);
 }
 
-uint8_t avr::_3k(uint16_t op) {
+template <typename chip>
+uint8_t basic_avr<chip>::_3k(uint16_t op) {
 	return op & 0x7;
 }
 
-uint8_t avr::_6k(uint16_t op) {
+template <typename chip>
+uint8_t basic_avr<chip>::_6k(uint16_t op) {
 	return ((op & 0xc0) >> 2) + (op & 0xf);
 }
 
-uint8_t avr::_7k(uint16_t op) {
+template <typename chip>
+uint8_t basic_avr<chip>::_7k(uint16_t op) {
 	return ((op & 0xc0) >> 2) + (op & 0xf);
 }
 
-uint8_t avr::_8k(uint16_t op) {
+template <typename chip>
+uint8_t basic_avr<chip>::_8k(uint16_t op) {
 	return ((op & 0xf00) >> 4) + (op & 0xf);
 }
 
-uint8_t avr::_6h(uint16_t op) {
+template <typename chip>
+uint8_t basic_avr<chip>::_6h(uint16_t op) {
 	return ((op & 0x1f0) >> 3) + (op & 0x1);
 }
 
-bool avr::_1i(uint16_t op) {
+template <typename chip>
+bool basic_avr<chip>::_1i(uint16_t op) {
 	return op & 0x1;
 }
 
-int8_t avr::_7o(uint16_t op) {
+template <typename chip>
+int8_t basic_avr<chip>::_7o(uint16_t op) {
 	return ((op & 0x200) >> 2) | ((op & 0x3f8) >> 3);
 }
 
-int16_t avr::_12o(uint16_t op) {
+template <typename chip>
+int16_t basic_avr<chip>::_12o(uint16_t op) {
 	return ((op&0x800)? 0xf000 : 0) + (op & 0xfff);
 }
 
-void avr::step() {
+template <typename chip>
+typename basic_avr<chip>::insn basic_avr<chip>::decode(pc_t addr) {
 	uint16_t op;
 
-	mem.get(pc << 1, &op);
-
-	if (is_verbose) {
-		printf("0x%04x: %02x %02x\t", pc<<1, op&0xff, (op>>8)&0xff);
-	}
+	mem.get(addr << 1, &op);
 
 	switch (op & MASK_OP16) {
-		case NOP:    _nop(); goto done;
-		case IJMP:   _ijmp(); goto done;
-		case EIJMP:  _eijmp(); goto done;
-		case SEC:    _sec(); goto done;
-		case SEZ:    _sez(); goto done;
-		case SEN:    _sen(); goto done;
-		case SEV:    _sev(); goto done;
-		case SES:    _ses(); goto done;
-		case SEH:    _seh(); goto done;
-		case SET:    _set(); goto done;
-		case SEI:    _sei(); goto done;
-		case CLC:    _clc(); goto done;
-		case CLZ:    _clz(); goto done;
-		case CLN:    _cln(); goto done;
-		case CLV:    _clv(); goto done;
-		case CLS:    _cls(); goto done;
-		case CLH:    _clh(); goto done;
-		case CLT:    _clt(); goto done;
-		case CLI:    _cli(); goto done;
-		case ICALL:  _icall(); goto done;
-		case EICALL: _eicall(); goto done;
-		case RET:    _ret(); goto done;
-		case RETI:   _reti(); goto done;
-		case SLEEP:  _sleep(); goto done;
-		case BREAK:  _break(); goto done;
-		case WDR:    _wdr(); goto done;
-		case LPM0:   _lpm(); goto done;
-		case ELPM0:  _elpm(); goto done;
-		case SPM:    _spm(); goto done;
+		case NOP:    return insn(op_nop, 0, 0, 0);
+		case IJMP:   return insn(op_ijmp, 0, 0, 0);
+		case EIJMP:  return insn(op_eijmp, 0, 0, 0);
+		case SEC:    return insn(op_sec, 0, 0, 0);
+		case SEZ:    return insn(op_sez, 0, 0, 0);
+		case SEN:    return insn(op_sen, 0, 0, 0);
+		case SEV:    return insn(op_sev, 0, 0, 0);
+		case SES:    return insn(op_ses, 0, 0, 0);
+		case SEH:    return insn(op_seh, 0, 0, 0);
+		case SET:    return insn(op_set, 0, 0, 0);
+		case SEI:    return insn(op_sei, 0, 0, 0);
+		case CLC:    return insn(op_clc, 0, 0, 0);
+		case CLZ:    return insn(op_clz, 0, 0, 0);
+		case CLN:    return insn(op_cln, 0, 0, 0);
+		case CLV:    return insn(op_clv, 0, 0, 0);
+		case CLS:    return insn(op_cls, 0, 0, 0);
+		case CLH:    return insn(op_clh, 0, 0, 0);
+		case CLT:    return insn(op_clt, 0, 0, 0);
+		case CLI:    return insn(op_cli, 0, 0, 0);
+		case ICALL:  return insn(op_icall, 0, 0, 0);
+		case EICALL: return insn(op_eicall, 0, 0, 0);
+		case RET:    return insn(op_ret, 0, 0, 0);
+		case RETI:   return insn(op_reti, 0, 0, 0);
+		case SLEEP:  return insn(op_sleep, 0, 0, 0);
+		case BREAK:  return insn(op_break, 0, 0, 0);
+		case WDR:    return insn(op_wdr, 0, 0, 0);
+		case LPM0:   return insn(op_lpm0, 0, 0, 0);
+		case ELPM0:  return insn(op_elpm0, 0, 0, 0);
+		case SPM:    return insn(op_spm, 0, 0, 0);
 	}
 
 	switch (op & MASK_OP11) {
-		case POP:   _pop(_5d(op)); goto done;
-		case PUSH:  _push(_5d(op)); goto done;
-		case LDS32: _lds(_5d(op)); goto done;
-		case STS32: _sts(_5d(op)); goto done;
-		case COM:   _com(_5d(op)); goto done;
-		case NEG:   _neg(_5d(op)); goto done;
-		case SWAP:  _swap(_5d(op)); goto done;
-		case INC:   _inc(_5d(op)); goto done;
-		case ASR:   _asr(_5d(op)); goto done;
-		case LSR:   _lsr(_5d(op)); goto done;
-		case ROR:   _ror(_5d(op)); goto done;
-		case DEC:   _dec(_5d(op)); goto done;
-		case LDX:   _ld(_5d(op), X,  0); goto done;
-		case LDXI:  _ld(_5d(op), X, +1); goto done;
-		case LDXD:  _ld(_5d(op), X, -1); goto done;
-		case LDY:   _ld(_5d(op), Y,  0); goto done;
-		case LDYI:  _ld(_5d(op), Y, +1); goto done;
-		case LDYD:  _ld(_5d(op), Y, -1); goto done;
-		case LDZ:   _ld(_5d(op), Z,  0); goto done;
-		case LDZI:  _ld(_5d(op), Z, +1); goto done;
-		case LDZD:  _ld(_5d(op), Z, -1); goto done;
-		case STX:   _st(X, _5d(op),  0); goto done;
-		case STXI:  _st(X, _5d(op), +1); goto done;
-		case STXD:  _st(X, _5d(op), -1); goto done;
-		case STY:   _st(Y, _5d(op),  0); goto done;
-		case STYI:  _st(Y, _5d(op), +1); goto done;
-		case STYD:  _st(Y, _5d(op), -1); goto done;
-		case STZ:   _st(Z, _5d(op),  0); goto done;
-		case STZI:  _st(Z, _5d(op), +1); goto done;
-		case STZD:  _st(Z, _5d(op), -1); goto done;
+		case POP:   return insn(op_pop, _5d(op), 0, 0);
+		case PUSH:  return insn(op_push, _5d(op), 0, 0);
+		case LDS32: return insn(op_lds32, _5d(op), 0, 0);
+		case STS32: return insn(op_sts32, _5d(op), 0, 0);
+		case COM:   return insn(op_com, _5d(op), 0, 0);
+		case NEG:   return insn(op_neg, _5d(op), 0, 0);
+		case SWAP:  return insn(op_swap, _5d(op), 0, 0);
+		case INC:   return insn(op_inc, _5d(op), 0, 0);
+		case ASR:   return insn(op_asr, _5d(op), 0, 0);
+		case LSR:   return insn(op_lsr, _5d(op), 0, 0);
+		case ROR:   return insn(op_ror, _5d(op), 0, 0);
+		case DEC:   return insn(op_dec, _5d(op), 0, 0);
+		case LDX:   return insn(op_ld, _5d(op), X, 0);
+		case LDXI:  return insn(op_ld, _5d(op), X, +1);
+		case LDXD:  return insn(op_ld, _5d(op), X, -1);
+		case LDY:   return insn(op_ld, _5d(op), Y, 0);
+		case LDYI:  return insn(op_ld, _5d(op), Y, +1);
+		case LDYD:  return insn(op_ld, _5d(op), Y, -1);
+		case LDZ:   return insn(op_ld, _5d(op), Z, 0);
+		case LDZI:  return insn(op_ld, _5d(op), Z, +1);
+		case LDZD:  return insn(op_ld, _5d(op), Z, -1);
+		case STX:   return insn(op_st, X, _5d(op), 0);
+		case STXI:  return insn(op_st, X, _5d(op), +1);
+		case STXD:  return insn(op_st, X, _5d(op), -1);
+		case STY:   return insn(op_st, Y, _5d(op), 0);
+		case STYI:  return insn(op_st, Y, _5d(op), +1);
+		case STYD:  return insn(op_st, Y, _5d(op), -1);
+		case STZ:   return insn(op_st, Z, _5d(op), 0);
+		case STZI:  return insn(op_st, Z, _5d(op), +1);
+		case STZD:  return insn(op_st, Z, _5d(op), -1);
 	}
 
 	switch (op & MASK_OP10M) {
-		case MULSU:  _mulsu(_3d(op), _3r(op)); goto done;
-		case FMUL:   _fmul(_3d(op), _3r(op)); goto done;
-		case FMULS:  _fmuls(_3d(op), _3r(op)); goto done;
-		case FMULSU: _fmulsu(_3d(op), _3r(op)); goto done;
+		case MULSU:  return insn(op_mulsu, _3d(op), _3r(op), 0);
+		case FMUL:   return insn(op_fmul, _3d(op), _3r(op), 0);
+		case FMULS:  return insn(op_fmuls, _3d(op), _3r(op), 0);
+		case FMULSU: return insn(op_fmulsu, _3d(op), _3r(op), 0);
 	}
 
 	switch (op & MASK_OP10J) {
-		case LPM:  _lpm(_5d(op), _1i(op)); goto done;
-		case ELPM: _elpm(_5d(op), _1i(op)); goto done;
-		case JMP:  _jmp(_6h(op)); goto done;
-		case CALL: _call(_6h(op)); goto done;
+		case LPM:  return insn(op_lpm, _5d(op), 0, _1i(op));
+		case ELPM: return insn(op_elpm, _5d(op), 0, _1i(op));
+		case JMP:  return insn(op_jmp, 0, 0, _6h(op));
+		case CALL: return insn(op_call, 0, 0, _6h(op));
 	}
 
 	switch (op & MASK_OP9) {
-		case BRCS: _brcs(_7o(op)); goto done;
-		case BREQ: _breq(_7o(op)); goto done;
-		case BRMI: _brmi(_7o(op)); goto done;
-		case BRVS: _brvs(_7o(op)); goto done;
-		case BRLT: _brlt(_7o(op)); goto done;
-		case BRHS: _brhs(_7o(op)); goto done;
-		case BRTS: _brts(_7o(op)); goto done;
-		case BRIE: _brie(_7o(op)); goto done;
-		case BRCC: _brcc(_7o(op)); goto done;
-		case BRNE: _brne(_7o(op)); goto done;
-		case BRPL: _brpl(_7o(op)); goto done;
-		case BRVC: _brvc(_7o(op)); goto done;
-		case BRGE: _brge(_7o(op)); goto done;
-		case BRHC: _brhc(_7o(op)); goto done;
-		case BRTC: _brtc(_7o(op)); goto done;
-		case BRID: _brid(_7o(op)); goto done;
+		case BRCS: return insn(op_brcs, 0, 0, _7o(op));
+		case BREQ: return insn(op_breq, 0, 0, _7o(op));
+		case BRMI: return insn(op_brmi, 0, 0, _7o(op));
+		case BRVS: return insn(op_brvs, 0, 0, _7o(op));
+		case BRLT: return insn(op_brlt, 0, 0, _7o(op));
+		case BRHS: return insn(op_brhs, 0, 0, _7o(op));
+		case BRTS: return insn(op_brts, 0, 0, _7o(op));
+		case BRIE: return insn(op_brie, 0, 0, _7o(op));
+		case BRCC: return insn(op_brcc, 0, 0, _7o(op));
+		case BRNE: return insn(op_brne, 0, 0, _7o(op));
+		case BRPL: return insn(op_brpl, 0, 0, _7o(op));
+		case BRVC: return insn(op_brvc, 0, 0, _7o(op));
+		case BRGE: return insn(op_brge, 0, 0, _7o(op));
+		case BRHC: return insn(op_brhc, 0, 0, _7o(op));
+		case BRTC: return insn(op_brtc, 0, 0, _7o(op));
+		case BRID: return insn(op_brid, 0, 0, _7o(op));
 	}
 
 	switch (op & MASK_OP8L) {
-		case MOVW: _movw(_4dl(op), _4rl(op)); goto done;
-		case MULS: _muls(_4d(op), _4r(op)); goto done;
-		case ADIW: _adiw(_2d(op), _6k(op)); goto done;
-		case SBIW: _sbiw(_2d(op), _6k(op)); goto done;
-		case CBI:  _cbi(_5p(op), _3k(op)); goto done;
-		case SBI:  _sbi(_5p(op), _3k(op)); goto done;
-		case SBIC: _sbic(_5p(op), _3k(op)); goto done;
-		case SBIS: _sbis(_5p(op), _3k(op)); goto done;
+		case MOVW: return insn(op_movw, _4dl(op), _4rl(op), 0);
+		case MULS: return insn(op_muls, _4d(op), _4r(op), 0);
+		case ADIW: return insn(op_adiw, _2d(op), 0, _6k(op));
+		case SBIW: return insn(op_sbiw, _2d(op), 0, _6k(op));
+		case CBI:  return insn(op_cbi, _5p(op), _3k(op), 0);
+		case SBI:  return insn(op_sbi, _5p(op), _3k(op), 0);
+		case SBIC: return insn(op_sbic, _5p(op), _3k(op), 0);
+		case SBIS: return insn(op_sbis, _5p(op), _3k(op), 0);
 	}
 
 	switch (op & MASK_OP8B) {
-		case BLD:  _bld(_5d(op), _3k(op)); goto done;
-		case BST:  _bst(_5d(op), _3k(op)); goto done;
-		case SBRC: _sbrc(_5d(op), _3k(op)); goto done;
-		case SBRS: _sbrs(_5d(op), _3k(op)); goto done;
+		case BLD:  return insn(op_bld, _5d(op), _3k(op), 0);
+		case BST:  return insn(op_bst, _5d(op), _3k(op), 0);
+		case SBRC: return insn(op_sbrc, _5d(op), _3k(op), 0);
+		case SBRS: return insn(op_sbrs, _5d(op), _3k(op), 0);
 	}
 
 	switch (op & MASK_OP6) {
-		case CPC:  _cpc(_5d(op), _5r(op)); goto done;
-		case SBC:  _sbc(_5d(op), _5r(op)); goto done;
-		case ADD:  _add(_5d(op), _5r(op)); goto done;
-		case CPSE: _cpse(_5d(op), _5r(op)); goto done;
-		case CP:   _cp(_5d(op), _5r(op)); goto done;
-		case SUB:  _sub(_5d(op), _5r(op)); goto done;
-		case ADC:  _adc(_5d(op), _5r(op)); goto done;
-		case AND:  _and(_5d(op), _5r(op)); goto done;
-		case EOR:  _eor(_5d(op), _5r(op)); goto done;
-		case OR:   _or(_5d(op), _5r(op)); goto done;
-		case MOV:  _mov(_5d(op), _5r(op)); goto done;
-		case MUL:  _mul(_5d(op), _5r(op)); goto done;
+		case CPC:  return insn(op_cpc, _5d(op), _5r(op), 0);
+		case SBC:  return insn(op_sbc, _5d(op), _5r(op), 0);
+		case ADD:  return insn(op_add, _5d(op), _5r(op), 0);
+		case CPSE: return insn(op_cpse, _5d(op), _5r(op), 0);
+		case CP:   return insn(op_cp, _5d(op), _5r(op), 0);
+		case SUB:  return insn(op_sub, _5d(op), _5r(op), 0);
+		case ADC:  return insn(op_adc, _5d(op), _5r(op), 0);
+		case AND:  return insn(op_and, _5d(op), _5r(op), 0);
+		case EOR:  return insn(op_eor, _5d(op), _5r(op), 0);
+		case OR:   return insn(op_or, _5d(op), _5r(op), 0);
+		case MOV:  return insn(op_mov, _5d(op), _5r(op), 0);
+		case MUL:  return insn(op_mul, _5d(op), _5r(op), 0);
 	}
 
 	switch (op & MASK_OP5P) {
-		case IN:  _in (_5d(op), _6p(op)); goto done;
-		case OUT: _out(_6p(op), _5d(op)); goto done;
-		case LDS: _lds(_4d(op), _7k(op)); goto done;
-		case STS: _sts(_4d(op), _7k(op)); goto done;
+		case IN:  return insn(op_in, _5d(op), _6p(op), 0);
+		case OUT: return insn(op_out, _6p(op), _5d(op), 0);
+		case LDS: return insn(op_lds, _4d(op), 0, _7k(op));
+		case STS: return insn(op_sts, _4d(op), 0, _7k(op));
 	}
 
 	switch (op & MASK_OP5M) {
-		case LDDY: _ldd(_5d(op), Y, _6q(op)); goto done;
-		case LDDZ: _ldd(_5d(op), Z, _6q(op)); goto done;
-		case STDY: _std(Y, _5d(op), _6q(op)); goto done;
-		case STDZ: _std(Z, _5d(op), _6q(op)); goto done;
+		case LDDY: return insn(op_ldd, _5d(op), Y, _6q(op));
+		case LDDZ: return insn(op_ldd, _5d(op), Z, _6q(op));
+		case STDY: return insn(op_std, Y, _5d(op), _6q(op));
+		case STDZ: return insn(op_std, Z, _5d(op), _6q(op));
 	}
 
 	switch (op & MASK_OP4) {
-		case CPI:   _cpi(_4d(op), _8k(op)); goto done;
-		case SBCI:  _sbci(_4d(op), _8k(op)); goto done;
-		case SUBI:  _subi(_4d(op), _8k(op)); goto done;
-		case ORI:   _ori(_4d(op), _8k(op)); goto done;
-		case ANDI:  _andi(_4d(op), _8k(op)); goto done;
-		case LDI:   _ldi(_4d(op), _8k(op)); goto done;
-		case RJMP:  _rjmp(_12o(op)); goto done;
-		case RCALL: _rcall(_12o(op)); goto done;
+		case CPI:   return insn(op_cpi, _4d(op), 0, _8k(op));
+		case SBCI:  return insn(op_sbci, _4d(op), 0, _8k(op));
+		case SUBI:  return insn(op_subi, _4d(op), 0, _8k(op));
+		case ORI:   return insn(op_ori, _4d(op), 0, _8k(op));
+		case ANDI:  return insn(op_andi, _4d(op), 0, _8k(op));
+		case LDI:   return insn(op_ldi, _4d(op), 0, _8k(op));
+		case RJMP:  return insn(op_rjmp, 0, 0, _12o(op));
+		case RCALL: return insn(op_rcall, 0, 0, _12o(op));
+	}
+
+	return insn(op_illegal, 0, 0, 0);
+}
+
+template <typename chip>
+int basic_avr<chip>::size(const insn &i) {
+	switch (i.id) {
+		case op_lds32:
+		case op_sts32:
+		case op_jmp:
+		case op_call:
+			return 2;
+	}
+	return 1;
+}
+
+template <typename chip>
+void basic_avr<chip>::skip() {
+	int n = size(fetch(pc+1));
+
+	pc += n; cycles += n;
+	edge(pc + 1);
+}
+
+template <typename chip>
+const typename basic_avr<chip>::insn &basic_avr<chip>::plain(pc_t addr) {
+	addr &= chip::flash_words - 1;
+
+	insn &i = program[addr];
+
+	if (i.id == op_none) {
+		i = decode(addr);
+	}
+
+	return i;
+}
+
+template <typename chip>
+const typename basic_avr<chip>::insn &basic_avr<chip>::fetch(pc_t addr) {
+	addr &= chip::flash_words - 1;
+
+	insn &i = program[addr];
+
+	if (i.n == 0) {
+		plain(addr);
+		fuse(addr);
+	}
+
+	return i;
+}
+
+// superinstructions for the usual avr-gcc idioms: ldi runs (register pair
+// and wider constants), add/adc and sub/sbc chains, cp/cpc chains ending in
+// brne, and push/pop runs in prologues and epilogues
+template <typename chip>
+void basic_avr<chip>::fuse(pc_t addr) {
+	const int max_fused = std::min<int>(16, program.size() - addr);
+	insn &i = program[addr];
+	int n = 1;
+
+	switch (i.id) {
+		case op_ldi:
+		case op_push:
+		case op_pop:
+			while (n < max_fused && plain(addr + n).id == i.id) {
+				n++;
+			}
+			break;
+
+		case op_add:
+			while (n < max_fused && plain(addr + n).id == op_adc) {
+				n++;
+			}
+			break;
+
+		case op_sub:
+			while (n < max_fused && plain(addr + n).id == op_sbc) {
+				n++;
+			}
+			break;
+
+		case op_subi:
+			while (n < max_fused && plain(addr + n).id == op_sbci) {
+				n++;
+			}
+			break;
+
+		case op_cp:
+		case op_cpi:
+			while (n < max_fused - 1 && plain(addr + n).id == op_cpc) {
+				n++;
+			}
+			if (n < max_fused && plain(addr + n).id == op_brne) {
+				n++;
+			}
+			else {
+				n = 1;
+			}
+			break;
+	}
+
+	i.n = n;
+}
+
+template <typename chip>
+void basic_avr<chip>::fusion_report(uint16_t words) {
+	enum { ldi, add, sub, cmp, push, pop, other };
+	const char *names[] = {
+		"ldi run", "add/adc", "sub/sbc", "cp/cpc/brne", "push run", "pop run",
+	};
+	unsigned fused[other] = {0};
+	unsigned total = 0;
+	unsigned covered = 0;
+
+	for (uint32_t addr = 0; addr < words; ) {
+		const insn &i = fetch(addr);
+
+		if (i.n > 1) {
+			int kind = other;
+			switch (i.id) {
+				case op_ldi:  kind = ldi; break;
+				case op_add:  kind = add; break;
+				case op_sub:
+				case op_subi: kind = sub; break;
+				case op_cp:
+				case op_cpi:  kind = cmp; break;
+				case op_push: kind = push; break;
+				case op_pop:  kind = pop; break;
+			}
+			fused[kind] += i.n;
+			covered += i.n;
+			total += i.n;
+			addr += i.n;
+		}
+		else {
+			total++;
+			addr += size(i);
+		}
+	}
+
+	std::printf("-> Fusion coverage: %u/%u instructions (%.1f%%)\n",
+	            covered, total, total ? 100.0 * covered / total : 0.0);
+	for (int k = 0; k < other; k++) {
+		std::printf("   %-12s %u\n", names[k], fused[k]);
 	}
+}
+
+template <typename chip>
+void basic_avr<chip>::exec(const insn &i) {
+	switch (i.id) {
+		case op_nop:    _nop(); break;
+		case op_ijmp:   _ijmp(); break;
+		case op_eijmp:  _eijmp(); break;
+		case op_sec:    _sec(); break;
+		case op_sez:    _sez(); break;
+		case op_sen:    _sen(); break;
+		case op_sev:    _sev(); break;
+		case op_ses:    _ses(); break;
+		case op_seh:    _seh(); break;
+		case op_set:    _set(); break;
+		case op_sei:    _sei(); break;
+		case op_clc:    _clc(); break;
+		case op_clz:    _clz(); break;
+		case op_cln:    _cln(); break;
+		case op_clv:    _clv(); break;
+		case op_cls:    _cls(); break;
+		case op_clh:    _clh(); break;
+		case op_clt:    _clt(); break;
+		case op_cli:    _cli(); break;
+		case op_icall:  _icall(); break;
+		case op_eicall: _eicall(); break;
+		case op_ret:    _ret(); break;
+		case op_reti:   _reti(); break;
+		case op_sleep:  _sleep(); break;
+		case op_break:  _break(); break;
+		case op_wdr:    _wdr(); break;
+		case op_lpm0:   _lpm(); break;
+		case op_elpm0:  _elpm(); break;
+		case op_spm:    _spm(); break;
+		case op_pop:    _pop(reg(i.a)); break;
+		case op_push:   _push(reg(i.a)); break;
+		case op_lds32:  _lds(reg(i.a)); break;
+		case op_sts32:  _sts(reg(i.a)); break;
+		case op_com:    _com(reg(i.a)); break;
+		case op_neg:    _neg(reg(i.a)); break;
+		case op_swap:   _swap(reg(i.a)); break;
+		case op_inc:    _inc(reg(i.a)); break;
+		case op_asr:    _asr(reg(i.a)); break;
+		case op_lsr:    _lsr(reg(i.a)); break;
+		case op_ror:    _ror(reg(i.a)); break;
+		case op_dec:    _dec(reg(i.a)); break;
+		case op_ld:     _ld(reg(i.a), ireg(i.b), i.k); break;
+		case op_st:     _st(ireg(i.a), reg(i.b), i.k); break;
+		case op_mulsu:  _mulsu(reg(i.a), reg(i.b)); break;
+		case op_fmul:   _fmul(reg(i.a), reg(i.b)); break;
+		case op_fmuls:  _fmuls(reg(i.a), reg(i.b)); break;
+		case op_fmulsu: _fmulsu(reg(i.a), reg(i.b)); break;
+		case op_lpm:    _lpm(reg(i.a), i.k); break;
+		case op_elpm:   _elpm(reg(i.a), i.k); break;
+		case op_jmp:    _jmp(i.k); break;
+		case op_call:   _call(i.k); break;
+		case op_brcs:   _brcs(i.k); break;
+		case op_breq:   _breq(i.k); break;
+		case op_brmi:   _brmi(i.k); break;
+		case op_brvs:   _brvs(i.k); break;
+		case op_brlt:   _brlt(i.k); break;
+		case op_brhs:   _brhs(i.k); break;
+		case op_brts:   _brts(i.k); break;
+		case op_brie:   _brie(i.k); break;
+		case op_brcc:   _brcc(i.k); break;
+		case op_brne:   _brne(i.k); break;
+		case op_brpl:   _brpl(i.k); break;
+		case op_brvc:   _brvc(i.k); break;
+		case op_brge:   _brge(i.k); break;
+		case op_brhc:   _brhc(i.k); break;
+		case op_brtc:   _brtc(i.k); break;
+		case op_brid:   _brid(i.k); break;
+		case op_movw:   _movw(reg(i.a), reg(i.b)); break;
+		case op_muls:   _muls(reg(i.a), reg(i.b)); break;
+		case op_adiw:   _adiw(reg(i.a), i.k); break;
+		case op_sbiw:   _sbiw(reg(i.a), i.k); break;
+		case op_cbi:    _cbi(i.a, i.b); break;
+		case op_sbi:    _sbi(i.a, i.b); break;
+		case op_sbic:   _sbic(i.a, i.b); break;
+		case op_sbis:   _sbis(i.a, i.b); break;
+		case op_bld:    _bld(reg(i.a), i.b); break;
+		case op_bst:    _bst(reg(i.a), i.b); break;
+		case op_sbrc:   _sbrc(reg(i.a), i.b); break;
+		case op_sbrs:   _sbrs(reg(i.a), i.b); break;
+		case op_cpc:    _cpc(reg(i.a), reg(i.b)); break;
+		case op_sbc:    _sbc(reg(i.a), reg(i.b)); break;
+		case op_add:    _add(reg(i.a), reg(i.b)); break;
+		case op_cpse:   _cpse(reg(i.a), reg(i.b)); break;
+		case op_cp:     _cp(reg(i.a), reg(i.b)); break;
+		case op_sub:    _sub(reg(i.a), reg(i.b)); break;
+		case op_adc:    _adc(reg(i.a), reg(i.b)); break;
+		case op_and:    _and(reg(i.a), reg(i.b)); break;
+		case op_eor:    _eor(reg(i.a), reg(i.b)); break;
+		case op_or:     _or(reg(i.a), reg(i.b)); break;
+		case op_mov:    _mov(reg(i.a), reg(i.b)); break;
+		case op_mul:    _mul(reg(i.a), reg(i.b)); break;
+		case op_in:     _in(reg(i.a), i.b); break;
+		case op_out:    _out(i.a, reg(i.b)); break;
+		case op_lds:    _lds(reg(i.a), i.k); break;
+		case op_sts:    _sts(reg(i.a), i.k); break;
+		case op_ldd:    _ldd(reg(i.a), ireg(i.b), i.k); break;
+		case op_std:    _std(ireg(i.a), reg(i.b), i.k); break;
+		case op_cpi:    _cpi(reg(i.a), i.k); break;
+		case op_sbci:   _sbci(reg(i.a), i.k); break;
+		case op_subi:   _subi(reg(i.a), i.k); break;
+		case op_ori:    _ori(reg(i.a), i.k); break;
+		case op_andi:   _andi(reg(i.a), i.k); break;
+		case op_ldi:    _ldi(reg(i.a), i.k); break;
+		case op_rjmp:   _rjmp(i.k); break;
+		case op_rcall:  _rcall(i.k); break;
+		default: throw illegal();
+	}
+}
+
+template <typename chip>
+void basic_avr<chip>::step() {
+	if (is_verbose) {
+		uint16_t op;
+		mem.get(pc << 1, &op);
+		printf("0x%04x: %02x %02x\t", pc<<1, op&0xff, (op>>8)&0xff);
+	}
+
+	if (sleeping) {
+		doze();
+		return;
+	}
+
+	const insn &i = fetch(pc);
+
+	// fused instructions would hide the words in between from the trace
+	if (trace_out) {
+		uint16_t at = pc;
+
+		exec(i);
+		trace_out->step(at, cycles, regs, status(), sp);
+		if (trace_out->due()) {
+			trace_out->keyframe(pc, sp, status(), cycles, data, sizeof(data));
+		}
+		return;
+	}
+
+#ifdef AVR_PROFILE
+	// no fusion, so that every word gets its own count; the profiler is
+	// sized to flash, the pc may have run past its end
+	pc_t at = pc & (chip::flash_words - 1);
+	uint64_t before = cycles;
+
+	exec(i);
+	prof.count(at, cycles - before);
+#else
+	if (i.n > 1 && ! is_verbose && ! journal) {
+		_fused(i);
+	}
+	else {
+		exec(i);
+	}
+#endif
+}
+
+// Run for n cycles. The only per-instruction cost of the peripherals is the
+// deadline compare; timers and the watchdog catch up in dispatch().
+template <typename chip>
+void basic_avr<chip>::run(uint64_t n) {
+	uint64_t end = cycles + n;
+
+	horizon = end;
+
+	while (cycles < end) {
+		if (cycles >= sched.deadline()) {
+			dispatch();
+		}
+		step();
+	}
+
+	horizon = scheduler::never;
+}
 
-	throw illegal();
+template <typename chip>
+void basic_avr<chip>::dispatch() {
+	sched.run();
+	loop.impure = true;
 
-done:
-	return;
+	if (wdt.expired) {
+		reset();
+		return;
+	}
+
+	if (held) {
+		held = false;
+		sched.poke();
+		return;
+	}
+
+	if (sreg.i && irq.pending()) {
+		interrupt(irq.next());
+	}
+}
+
+// After sei and reti one more instruction runs before any interrupt: the
+// next dispatch only drops the hold and asks for another one.
+template <typename chip>
+inline void basic_avr<chip>::hold() {
+	held = true;
+	sched.poke();
+}
+
+template <typename chip>
+void basic_avr<chip>::interrupt(int vector) {
+	if (sleeping) {
+		sleeping = false;
+		cycles += 4;
+	}
+
+	push_pc();
+	sreg.i = false;
+	pc = vector * chip::vector_words;
+	cycles += 4 + (chip::pc_bytes == 3);
+	edge(pc);
+	PROFILE(call(pc, cycles));
+
+	if (trace_out) {
+		trace_out->enter(cycles, regs, status(), sp);
+	}
+
+	irq.acknowledge(vector);
+}
+
+// Nothing executes while asleep. All sleep modes are treated as idle:
+// peripheral clocks keep running, so firmware using power-down is expected
+// to have stopped the timers it does not want to be woken by.
+template <typename chip>
+void basic_avr<chip>::doze() {
+	uint64_t until = std::min(horizon, sched.deadline());
+
+	if (until != scheduler::never && until > cycles) {
+		cycles = until;
+	}
+	else {
+		cycles++;
+	}
 }
 
+// Called on every taken backward branch. If the loop came back to the same
+// head with the same registers and SREG, and the iteration stored nothing
+// and only read values that cannot change between events, every following
+// iteration is identical until the next event: skip as many whole ones as
+// fit before it and let the last few run for real.
+template <typename chip>
+void basic_avr<chip>::spin() {
+	if (pc == loop.head && !loop.impure &&
+	    !std::memcmp(regs, loop.regs, sizeof(loop.regs)) &&
+	    !std::memcmp(&sreg, &loop.flags, sizeof(sreg))) {
+		uint64_t period = cycles - loop.cycles;
+		uint64_t until = std::min(horizon, sched.deadline());
+
+		if (until != scheduler::never && until > cycles) {
+			cycles += (until - cycles) / period * period;
+		}
+	}
+
+	loop.head = pc;
+	loop.cycles = cycles;
+	loop.impure = false;
+	std::memcpy(loop.regs, regs, sizeof(loop.regs));
+	std::memcpy(&loop.flags, &sreg, sizeof(sreg));
+}
+
+template class basic_avr<attiny85>;
+template class basic_avr<atmega328p>;
+template class basic_avr<atmega2560>;
+
 }
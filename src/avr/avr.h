@@ -2,20 +2,74 @@
 #define AVR_H
 
 #include "core.h"
+#include "scheduler.h"
+#include "interrupts.h"
+#include "timer.h"
+#include "chips.h"
+#include "trace.h"
+#ifdef AVR_PROFILE
+#include "profile.h"
+#endif
+
+#include <vector>
+#include <memory>
 
 namespace coresim {
 
-class avr : public core {
+class io_log;
+
+// The interpreter, specialized for one device profile from chips.h.
+template <typename chip>
+class basic_avr : public core {
 public:
-	avr(vmem &m, vio &i);
+	basic_avr(vmem &m, vio &i);
+	basic_avr(vmem &m, vio &i, const basic_avr &twin);
 	void step();
+	void run(uint64_t n);
 	void reset();
 	void debug();
 
+	// flash was rewritten from outside: drop the predecode cache, for the
+	// twins sharing it as well; a reset leaves it alone
+	void reflash();
+	void fusion_report(uint16_t words);
+
+	class snapshot;
+	void save(snapshot &s);
+	void restore(const snapshot &s);
+
+	// AFL-style edge coverage into a 64KB bitmap, nullptr to turn it off
+	enum {
+		coverage_size = 0x10000,
+	};
+
+	void cover(uint8_t *bitmap);
+
+	// copy bytes into the data space from outside, e.g. a test case
+	void write(uint16_t addr, const uint8_t *src, size_t n);
+
+	// hot spots and a folded-stack file, needs a build with AVR_PROFILE
+	void profile(size_t top, const std::string &folded);
+
+	// stream every instruction to a binary trace, nullptr to stop; the
+	// tracer belongs to the caller and must outlive the recording
+	void record(tracer *t);
+
+	// USART0, to connect a sink and source to, e.g. a uart_bridge; throws
+	// on parts without one
+	usart &serial();
+
 	static std::string name;
 
+	friend class avr_jit;
+	friend class avr_batch;
+	friend class avr_reverse;
+	friend class avr_system;
+
 private:
-	uint16_t pc;
+	typedef typename chip::pc_type pc_t;
+
+	pc_t pc;
 	uint16_t sp;
 
 	enum reg {
@@ -25,7 +79,18 @@ private:
 		r24, r25, r26, r27, r28, r29, r30, r31
 	};
 	enum ireg { X, Y, Z  };
+
+	// data space layout
+	enum : uint32_t {
+		io_start  = 0x0020,
+		io_end    = chip::io_end,
+		ramend    = chip::ramend,
+		data_size = 0x10000,
+	};
+
+	// register file, IO and SRAM share a single data space
 	union {
+		uint8_t data[data_size];
 		uint8_t regs[32];
 		struct {
 			uint8_t iregs_r[26];
@@ -39,9 +104,139 @@ private:
 
 	uint64_t cycles;
 
-	int watchdog;
+	// extended addressing, on parts that have it
+	uint8_t eind;
+	uint8_t rampz;
+
+	// on-chip peripherals, IO ports not claimed here go to vio
+	scheduler sched;
+	interrupts irq;
+	timer8 timer0;
+	watchdog wdt;
+	usart usart0;
+
+	peripheral *iomap[io_end - io_start];
+
+	static_assert(chip::vectors <= 64, "interrupt lines are a 64-bit mask");
+
+	void attach(uint8_t port, peripheral *p);
+	void dispatch();
+	void interrupt(int vector);
+
+	bool held;
+	void hold();
+
+	// sleep and idle loops, both skip ahead to the next event or to the
+	// end of the current run()
+	uint8_t smcr;
+	bool sleeping;
+	uint64_t horizon;
+
+	struct {
+		pc_t head;
+		uint64_t cycles;
+		uint8_t regs[32];
+		decltype(sreg) flags;
+		bool impure;
+	} loop;
+
+	// SRAM pages written since the last save() or restore(), so restoring
+	// the same snapshot again only copies those back
+	enum {
+		page_bits = 8,
+	};
+
+	uint64_t dirty[data_size >> (page_bits + 6)];
+	const snapshot *base;
+
+	// the same for avr_reverse, since its last checkpoint or restore
+	uint64_t written[data_size >> (page_bits + 6)];
+
+	uint8_t *coverage;
+	uint16_t prev;
+
+	void edge(uint16_t to);
+
+	tracer *trace_out;
+
+	// vio traffic goes through here while reverse execution is on
+	io_log *journal;
+	uint8_t status() const;
+
+#ifdef AVR_PROFILE
+	profiler prof;
+#endif
+
+	void doze();
+	void spin();
+	void branch(bool taken, int8_t offset);
+
+	// predecoded instructions
+	enum opcode {
+		op_none,
+		op_nop, op_ijmp, op_eijmp, op_sec, op_sez, op_sen,
+		op_sev, op_ses, op_seh, op_set, op_sei, op_clc,
+		op_clz, op_cln, op_clv, op_cls, op_clh, op_clt,
+		op_cli, op_icall, op_eicall, op_ret, op_reti, op_sleep,
+		op_break, op_wdr, op_lpm0, op_elpm0, op_spm, op_pop,
+		op_push, op_lds32, op_sts32, op_com, op_neg, op_swap,
+		op_inc, op_asr, op_lsr, op_ror, op_dec, op_ld,
+		op_st, op_mulsu, op_fmul, op_fmuls, op_fmulsu, op_lpm,
+		op_elpm, op_jmp, op_call, op_brcs, op_breq, op_brmi,
+		op_brvs, op_brlt, op_brhs, op_brts, op_brie, op_brcc,
+		op_brne, op_brpl, op_brvc, op_brge, op_brhc, op_brtc,
+		op_brid, op_movw, op_muls, op_adiw, op_sbiw, op_cbi,
+		op_sbi, op_sbic, op_sbis, op_bld, op_bst, op_sbrc,
+		op_sbrs, op_cpc, op_sbc, op_add, op_cpse, op_cp,
+		op_sub, op_adc, op_and, op_eor, op_or, op_mov,
+		op_mul, op_in, op_out, op_lds, op_sts, op_ldd,
+		op_std, op_cpi, op_sbci, op_subi, op_ori, op_andi,
+		op_ldi, op_rjmp, op_rcall, op_illegal,
+	};
+
+	// n counts the instructions fused into a superinstruction starting
+	// here, 0 until the fusion pass has looked at the entry
+	struct insn {
+		insn() : id(op_none), a(0), b(0), n(0), k(0) {}
+		insn(uint8_t id_, uint8_t a_, uint8_t b_, int16_t k_)
+			: id(id_), a(a_), b(b_), n(0), k(k_) {}
+
+		uint8_t id;
+		uint8_t a, b;
+		uint8_t n;
+		int16_t k;
+	};
+
+	// predecode cache, shared between cores running the same flash
+	std::shared_ptr<std::vector<insn>> code;
+	std::vector<insn> &program;
+
+	basic_avr(vmem &m, vio &i, std::shared_ptr<std::vector<insn>> c);
+
+	insn decode(pc_t addr);
+	const insn &plain(pc_t addr);
+	const insn &fetch(pc_t addr);
+	void fuse(pc_t addr);
+	void exec(const insn &i);
+	static int size(const insn &i);
+	void skip();
+
+	// data space access
+	uint8_t load(uint16_t addr);
+	void store(uint16_t addr, uint8_t value);
+	uint8_t io_read(uint8_t port);
+	void io_write(uint8_t port, uint8_t value);
+	void push(uint8_t value);
+	uint8_t pop();
+	void push_pc();
+	void pop_pc();
+
+	// flags
+	uint8_t add8(uint8_t a, uint8_t b, bool carry);
+	uint8_t sub8(uint8_t a, uint8_t b, bool carry, bool chain);
 
 	// opcodes
+	void _fused(const insn &i);
 	void _nop();
 	void _ijmp();
 	void _eijmp();
@@ -171,6 +366,44 @@ private:
 	int16_t _12o(uint16_t op);
 };
 
+// Complete machine state of one core: registers, data space and the
+// on-chip peripherals. Flash is assumed unchanged and devices behind vio
+// keep their own state, as do whatever the USART sends to and reads from. A snapshot can only be restored into the core it
+// was taken from.
+template <typename chip>
+class basic_avr<chip>::snapshot {
+public:
+	explicit snapshot(basic_avr &c);
+
+private:
+	friend class basic_avr;
+
+	pc_t pc;
+	uint16_t sp;
+	decltype(basic_avr::sreg) sreg;
+	uint64_t cycles;
+	uint8_t smcr;
+	bool sleeping;
+	uint8_t eind;
+	uint8_t rampz;
+	bool held;
+
+	std::vector<uint8_t> data;
+
+	scheduler sched;
+	interrupts irq;
+	timer8 timer0;
+	watchdog wdt;
+	usart usart0;
+};
+
+extern template class basic_avr<attiny85>;
+extern template class basic_avr<atmega328p>;
+extern template class basic_avr<atmega2560>;
+
+// the part the JIT, batch, reverse and system engines are built for
+typedef basic_avr<atmega328p> avr;
+
 }
 
 #endif
@@ -0,0 +1,237 @@
+#include "batch.h"
+
+#include "lanes.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace coresim {
+
+namespace {
+
+const int width = avr_batch::width;
+
+// plain loops, left to the auto-vectorizer
+struct vec {
+	uint8_t v[width];
+
+	static vec load(const uint8_t *p) { vec r; std::memcpy(r.v, p, width); return r; }
+	static vec splat(uint8_t k) { vec r; std::memset(r.v, k, width); return r; }
+};
+
+#define LOOP_OP(e) { vec r; for (int l = 0; l < width; l++) r.v[l] = (e); return r; }
+
+inline void store(uint8_t *p, vec a) { std::memcpy(p, a.v, width); }
+inline vec operator+(vec a, vec b) LOOP_OP(a.v[l] + b.v[l])
+inline vec operator-(vec a, vec b) LOOP_OP(a.v[l] - b.v[l])
+inline vec operator&(vec a, vec b) LOOP_OP(a.v[l] & b.v[l])
+inline vec operator|(vec a, vec b) LOOP_OP(a.v[l] | b.v[l])
+inline vec operator^(vec a, vec b) LOOP_OP(a.v[l] ^ b.v[l])
+inline vec andnot(vec a, vec b) LOOP_OP(~a.v[l] & b.v[l])
+inline vec eq(vec a, vec b) LOOP_OP(a.v[l] == b.v[l] ? 0xff : 0)
+inline vec msb(vec a) LOOP_OP((a.v[l] & 0x80) ? 0xff : 0)
+inline vec shr(vec a, int n) LOOP_OP(a.v[l] >> n)
+inline vec shl(vec a, int n) LOOP_OP(a.v[l] << n)
+
+#undef LOOP_OP
+
+}
+
+const avr_batch::kernel avr_batch::plain = avr_batch::step<vec>;
+
+typedef avr_batch::group group;
+
+// the widest kernel that was built and that this CPU runs
+avr_batch::kernel avr_batch::widest() {
+#if defined(__x86_64__) || defined(__i386__)
+	if (avx512 && __builtin_cpu_supports("avx512bw")) {
+		return avx512;
+	}
+	if (avx2 && __builtin_cpu_supports("avx2")) {
+		return avx2;
+	}
+#endif
+	return plain;
+}
+
+avr_batch::avr_batch(vmem &m, vio &i, size_t n) : vector_steps(0), scalar_steps(0), vector(widest()) {
+	for (size_t l = 0; l < n; l++) {
+		if (l == 0) {
+			cores.emplace_back(new avr(m, i));
+		}
+		else {
+			cores.emplace_back(new avr(m, i, *cores[0]));
+		}
+	}
+
+	for (size_t base = 0; base < n; base += width) {
+		groups.push_back(new group());
+	}
+}
+
+avr_batch::~avr_batch() {
+	for (auto g : groups) {
+		delete g;
+	}
+}
+
+void avr_batch::reset() {
+	for (auto &c : cores) {
+		c->reset();
+	}
+}
+
+// scalar core -> lane
+void avr_batch::get(group &g, int l, const avr &c) {
+	const bool *flags = &c.sreg.c;
+
+	for (int k = 0; k < 32; k++) {
+		g.r[k][l] = c.regs[k];
+	}
+	for (int k = 0; k < 8; k++) {
+		g.f[k][l] = flags[k] ? 0xff : 0;
+	}
+
+	g.pc[l] = c.pc;
+	g.cycles[l] = c.cycles;
+	g.deadline[l] = c.sched.deadline();
+	g.parked[l] = c.sleeping;
+}
+
+// lane -> scalar core
+void avr_batch::put(const group &g, int l, avr &c) {
+	bool *flags = &c.sreg.c;
+
+	for (int k = 0; k < 32; k++) {
+		c.regs[k] = g.r[k][l];
+	}
+	for (int k = 0; k < 8; k++) {
+		flags[k] = g.f[k][l] != 0;
+	}
+
+	c.pc = g.pc[l];
+	c.cycles = g.cycles[l];
+}
+
+void avr_batch::run(uint64_t n) {
+	for (size_t gi = 0; gi < groups.size(); gi++) {
+		group &g = *groups[gi];
+		size_t base = gi * width;
+
+		for (int l = 0; l < width; l++) {
+			g.live[l] = base + l < cores.size();
+
+			if (g.live[l]) {
+				avr &c = *cores[base + l];
+				get(g, l, c);
+				g.end[l] = c.cycles + n;
+				c.horizon = g.end[l];
+			}
+		}
+
+		run(g, base);
+
+		for (int l = 0; l < width; l++) {
+			if (g.live[l]) {
+				avr &c = *cores[base + l];
+				put(g, l, c);
+				c.horizon = scheduler::never;
+			}
+		}
+	}
+}
+
+// Lowest PC first: lanes that took a forward branch wait for the others,
+// which lets if/else shapes reconverge at their join point.
+void avr_batch::run(group &g, size_t base) {
+	uint8_t m[width];
+
+	for (;;) {
+		uint16_t low = 0xffff;
+		bool busy = false;
+
+		for (int l = 0; l < width; l++) {
+			if (!g.live[l] || g.cycles[l] >= g.end[l]) {
+				continue;
+			}
+
+			busy = true;
+
+			if (g.parked[l] || g.cycles[l] >= g.deadline[l]) {
+				scalar(g, base, l);
+				continue;
+			}
+
+			low = std::min(low, g.pc[l]);
+		}
+
+		if (!busy) {
+			break;
+		}
+
+		bool any = false;
+
+		for (int l = 0; l < width; l++) {
+			bool on = g.live[l] && g.cycles[l] < g.end[l] && !g.parked[l] &&
+			          g.cycles[l] < g.deadline[l] && g.pc[l] == low;
+			m[l] = on ? 0xff : 0;
+			any |= on;
+		}
+
+		if (!any) {
+			continue;
+		}
+
+		const avr::insn &i = cores[base]->plain(low);
+
+		if (vector(g, i, m)) {
+			if (i.id == avr::op_rjmp || (i.id >= avr::op_brcs && i.id <= avr::op_brid)) {
+				transfer(g, base, m, low);
+			}
+			vector_steps++;
+			continue;
+		}
+
+		for (int l = 0; l < width; l++) {
+			if (m[l]) {
+				scalar(g, base, l);
+			}
+		}
+	}
+}
+
+void avr_batch::scalar(group &g, size_t base, int l) {
+	avr &c = *cores[base + l];
+
+	put(g, l, c);
+
+	if (c.cycles >= c.sched.deadline()) {
+		c.dispatch();
+	}
+	c.step();
+
+	get(g, l, c);
+	scalar_steps++;
+}
+
+// What the scalar core does after a branch or jump, for each lane that
+// made it: a taken backward branch may be the idle loop spin() skips, and
+// every transfer is an edge for coverage.
+void avr_batch::transfer(group &g, size_t base, const uint8_t *m, uint16_t from) {
+	for (int l = 0; l < width; l++) {
+		if (!m[l]) {
+			continue;
+		}
+
+		avr &c = *cores[base + l];
+
+		if (g.pc[l] <= from) {
+			put(g, l, c);
+			c.spin();
+			g.cycles[l] = c.cycles;
+		}
+		c.edge(g.pc[l]);
+	}
+}
+
+}
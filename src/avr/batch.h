@@ -0,0 +1,70 @@
+#ifndef AVR_BATCH_H
+#define AVR_BATCH_H
+
+#include "avr.h"
+
+#include <vector>
+#include <memory>
+
+namespace coresim {
+
+// Runs many copies of the same firmware in lockstep. Registers, SREG, PC
+// and the cycle counters are kept in structure-of-arrays form, 64 lanes to
+// a group. Each step picks the lowest PC in a group and executes that
+// instruction for every lane sitting on it: register-only instructions as
+// one vector operation masked to those lanes, anything touching memory, IO
+// or the stack through the lane's own scalar core. Lanes that diverge wait
+// under the mask until the lowest PC catches up with them.
+//
+// The vector operations are built for each instruction set the target
+// has, see lanes.h, and the widest one this CPU runs is used.
+//
+// Outside of run() the scalar cores hold the authoritative state, so
+// inputs are set and results read through lane().
+class avr_batch {
+public:
+	enum {
+		width = 64,
+	};
+
+	avr_batch(vmem &m, vio &i, size_t n);
+	~avr_batch();
+
+	size_t size() const { return cores.size(); }
+	avr &lane(size_t n) { return *cores[n]; }
+
+	void run(uint64_t n);
+	void reset();
+
+	// instructions executed for a whole group at once, and per lane
+	uint64_t vector_steps;
+	uint64_t scalar_steps;
+
+	struct group;
+
+private:
+	std::vector<std::unique_ptr<avr>> cores;
+	std::vector<group *> groups;
+
+	void get(group &g, int l, const avr &c);
+	void put(const group &g, int l, avr &c);
+	void run(group &g, size_t base);
+	void scalar(group &g, size_t base, int l);
+	void transfer(group &g, size_t base, const uint8_t *m, uint16_t from);
+
+	// executes i for the lanes in mask, false if it has to go through the
+	// scalar cores
+	typedef bool (*kernel)(group &g, const avr::insn &i, const uint8_t *mask);
+
+	// in lanes.h, built once per instruction set, null where not built
+	template <typename vec>
+	static bool step(group &g, const avr::insn &i, const uint8_t *mask);
+	static const kernel plain, avx2, avx512;
+	static kernel widest();
+
+	kernel vector;
+};
+
+}
+
+#endif
@@ -0,0 +1,64 @@
+#include "lanes.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace coresim {
+
+#if defined(__AVX2__)
+
+namespace {
+
+#define AVX2_OP(f) { { f(a.v[0], b.v[0]), f(a.v[1], b.v[1]) } }
+
+// 64 byte lanes as two halves
+struct vec {
+	__m256i v[2];
+
+	static vec load(const uint8_t *p) {
+		return { { _mm256_loadu_si256((const __m256i *)p),
+		           _mm256_loadu_si256((const __m256i *)(p + 32)) } };
+	}
+	static vec splat(uint8_t k) { __m256i x = _mm256_set1_epi8(k); return { { x, x } }; }
+};
+
+inline void store(uint8_t *p, vec a) {
+	_mm256_storeu_si256((__m256i *)p, a.v[0]);
+	_mm256_storeu_si256((__m256i *)(p + 32), a.v[1]);
+}
+inline vec operator+(vec a, vec b) { return AVX2_OP(_mm256_add_epi8); }
+inline vec operator-(vec a, vec b) { return AVX2_OP(_mm256_sub_epi8); }
+inline vec operator&(vec a, vec b) { return AVX2_OP(_mm256_and_si256); }
+inline vec operator|(vec a, vec b) { return AVX2_OP(_mm256_or_si256); }
+inline vec operator^(vec a, vec b) { return AVX2_OP(_mm256_xor_si256); }
+inline vec andnot(vec a, vec b) { return AVX2_OP(_mm256_andnot_si256); }
+inline vec eq(vec a, vec b) { return AVX2_OP(_mm256_cmpeq_epi8); }
+inline vec msb(vec a) {
+	__m256i z = _mm256_setzero_si256();
+	return { { _mm256_cmpgt_epi8(z, a.v[0]), _mm256_cmpgt_epi8(z, a.v[1]) } };
+}
+inline vec shr(vec a, int n) {
+	__m256i k = _mm256_set1_epi8(0xff >> n);
+	return { { _mm256_and_si256(_mm256_srli_epi16(a.v[0], n), k),
+	           _mm256_and_si256(_mm256_srli_epi16(a.v[1], n), k) } };
+}
+inline vec shl(vec a, int n) {
+	__m256i k = _mm256_set1_epi8((uint8_t)(0xff << n));
+	return { { _mm256_and_si256(_mm256_slli_epi16(a.v[0], n), k),
+	           _mm256_and_si256(_mm256_slli_epi16(a.v[1], n), k) } };
+}
+
+#undef AVX2_OP
+
+}
+
+const avr_batch::kernel avr_batch::avx2 = avr_batch::step<vec>;
+
+#else
+
+const avr_batch::kernel avr_batch::avx2 = nullptr;
+
+#endif
+
+}
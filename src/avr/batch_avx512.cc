@@ -0,0 +1,42 @@
+#include "lanes.h"
+
+#if defined(__AVX512BW__)
+#include <immintrin.h>
+#endif
+
+namespace coresim {
+
+#if defined(__AVX512BW__)
+
+namespace {
+
+struct vec {
+	__m512i v;
+
+	static vec load(const uint8_t *p) { return { _mm512_loadu_si512(p) }; }
+	static vec splat(uint8_t k) { return { _mm512_set1_epi8(k) }; }
+};
+
+inline void store(uint8_t *p, vec a) { _mm512_storeu_si512(p, a.v); }
+inline vec operator+(vec a, vec b) { return { _mm512_add_epi8(a.v, b.v) }; }
+inline vec operator-(vec a, vec b) { return { _mm512_sub_epi8(a.v, b.v) }; }
+inline vec operator&(vec a, vec b) { return { _mm512_and_si512(a.v, b.v) }; }
+inline vec operator|(vec a, vec b) { return { _mm512_or_si512(a.v, b.v) }; }
+inline vec operator^(vec a, vec b) { return { _mm512_xor_si512(a.v, b.v) }; }
+inline vec andnot(vec a, vec b) { return { _mm512_ternarylogic_epi32(a.v, b.v, b.v, 0x0c) }; }
+inline vec eq(vec a, vec b) { return { _mm512_movm_epi8(_mm512_cmpeq_epi8_mask(a.v, b.v)) }; }
+inline vec msb(vec a) { return { _mm512_movm_epi8(_mm512_movepi8_mask(a.v)) }; }
+inline vec shr(vec a, int n) { return { _mm512_and_si512(_mm512_srli_epi16(a.v, n), _mm512_set1_epi8(0xff >> n)) }; }
+inline vec shl(vec a, int n) { return { _mm512_and_si512(_mm512_slli_epi16(a.v, n), _mm512_set1_epi8(0xff << n)) }; }
+
+}
+
+const avr_batch::kernel avr_batch::avx512 = avr_batch::step<vec>;
+
+#else
+
+const avr_batch::kernel avr_batch::avx512 = nullptr;
+
+#endif
+
+}
@@ -0,0 +1,150 @@
+#include "bridge.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <unistd.h>
+#include <poll.h>
+
+namespace coresim {
+
+namespace {
+
+const size_t ring_bytes = 1 << 20;
+const size_t incoming_bytes = 1 << 16;
+const size_t block_bytes = 4096;
+
+// how long the writer lets output pile up once it has caught up
+const auto idle = std::chrono::microseconds(200);
+
+}
+
+uart_bridge::uart_bridge(int out, int in)
+	: output(out), input(in), ring(ring_bytes), head(0), tail(0),
+	  incoming(incoming_bytes), ended(in < 0), stopping(false) {
+	writer = std::thread(&uart_bridge::drain, this);
+
+	if (input >= 0) {
+		reader = std::thread(&uart_bridge::fill, this);
+	}
+}
+
+uart_bridge::~uart_bridge() {
+	stopping.store(true, std::memory_order_release);
+	writer.join();
+
+	if (reader.joinable()) {
+		reader.join();
+	}
+}
+
+void uart_bridge::attach(usart &u) {
+	u.connect(static_cast<usart::sink *>(this));
+
+	if (input >= 0) {
+		u.connect(static_cast<usart::source *>(this));
+	}
+}
+
+void uart_bridge::send(uint64_t when, uint8_t byte) {
+	size_t h = head.load(std::memory_order_relaxed);
+
+	while (h - tail.load(std::memory_order_acquire) == ring.size()) {
+		std::this_thread::yield();
+	}
+
+	ring[h & (ring.size() - 1)] = byte;
+	head.store(h + 1, std::memory_order_release);
+}
+
+// the reader may push its last bytes between the two looks
+int uart_bridge::receive() {
+	for (int look = 0; look < 2; look++) {
+		const uint8_t *byte = incoming.front();
+
+		if (byte) {
+			uint8_t v = *byte;
+			incoming.pop();
+			return v;
+		}
+		if (!ended.load(std::memory_order_acquire)) {
+			return none;
+		}
+	}
+
+	return closed;
+}
+
+void uart_bridge::flush() {
+	while (tail.load(std::memory_order_acquire) != head.load(std::memory_order_acquire)) {
+		std::this_thread::yield();
+	}
+}
+
+// Writes straight out of the ring, up to its end when the data wraps. A
+// failed output drops what it was given rather than stalling the core.
+void uart_bridge::drain() {
+	for (;;) {
+		size_t t = tail.load(std::memory_order_relaxed);
+		size_t h = head.load(std::memory_order_acquire);
+
+		if (t == h) {
+			if (stopping.load(std::memory_order_acquire) &&
+			    head.load(std::memory_order_acquire) == t) {
+				return;
+			}
+			std::this_thread::sleep_for(idle);
+			continue;
+		}
+
+		size_t at = t & (ring.size() - 1);
+		size_t n = std::min(h - t, ring.size() - at);
+		ssize_t done = ::write(output, &ring[at], n);
+
+		if (done < 0) {
+			if (errno == EINTR || errno == EAGAIN) {
+				continue;
+			}
+			done = n;
+		}
+
+		tail.store(t + done, std::memory_order_release);
+	}
+}
+
+// Polls with a timeout so that a quiet pipe doesn't keep the destructor
+// waiting.
+void uart_bridge::fill() {
+	uint8_t block[block_bytes];
+
+	while (!stopping.load(std::memory_order_acquire)) {
+		pollfd p = { input, POLLIN, 0 };
+		int ready = ::poll(&p, 1, 50);
+
+		if (ready == 0 || (ready < 0 && errno == EINTR)) {
+			continue;
+		}
+
+		ssize_t n = ready < 0 ? -1 : ::read(input, block, sizeof(block));
+
+		if (n < 0 && (errno == EINTR || errno == EAGAIN)) {
+			continue;
+		}
+		if (n <= 0) {
+			break;
+		}
+
+		for (ssize_t k = 0; k < n; k++) {
+			while (!incoming.push(block[k])) {
+				if (stopping.load(std::memory_order_acquire)) {
+					return;
+				}
+				std::this_thread::sleep_for(idle);
+			}
+		}
+	}
+
+	ended.store(true, std::memory_order_release);
+}
+
+}
@@ -0,0 +1,54 @@
+#ifndef AVR_BRIDGE_H
+#define AVR_BRIDGE_H
+
+#include "usart.h"
+#include "queue.h"
+
+#include <vector>
+#include <atomic>
+#include <thread>
+
+namespace coresim {
+
+// Connects a USART to host file descriptors, stdout or a file going out and
+// a file or pipe coming in. Transmitted bytes are stored into a ring that a
+// writer thread hands to write(2) in place, as large a span as has built
+// up, so logging firmware costs one store per byte on the simulation
+// thread. Input is read by its own thread in blocks and picked up by the
+// USART at line rate. Descriptors stay owned by the caller.
+class uart_bridge : public usart::sink, public usart::source {
+public:
+	explicit uart_bridge(int output, int input = -1);
+	~uart_bridge();
+
+	// takes what u transmits, and feeds it the input if there is one
+	void attach(usart &u);
+
+	void send(uint64_t when, uint8_t byte);
+	int receive();
+
+	// wait for everything sent so far to be written out
+	void flush();
+
+private:
+	int output;
+	int input;
+
+	std::vector<uint8_t> ring;
+	std::atomic<size_t> head;
+	std::atomic<size_t> tail;
+
+	spsc_queue<uint8_t> incoming;
+	std::atomic<bool> ended;
+
+	std::atomic<bool> stopping;
+	std::thread writer;
+	std::thread reader;
+
+	void drain();
+	void fill();
+};
+
+}
+
+#endif
@@ -0,0 +1,159 @@
+#ifndef AVR_CHIPS_H
+#define AVR_CHIPS_H
+
+#include "timer.h"
+#include "usart.h"
+
+#include <cstdint>
+
+namespace coresim {
+
+// Device profiles. The core is instantiated once per profile, so flash
+// size, the IO window, PC width and the core register ports are all
+// immediates in the interpreter.
+//
+//   flash_words  program memory in 16-bit words, a power of two
+//   io_end       end of the IO window in the data space; SRAM, or
+//                extended IO that is not modelled, follows
+//   ramend       initial stack pointer
+//   pc_bytes     width of a return address on the stack
+//   vector_words size of an interrupt vector table entry
+//   vectors      entries in the vector table, reset included
+//   usarts       1 when the part has a USART0, whose layout is usart0()
+//
+// Ports are IO addresses (data space - 0x20). se is the sleep enable bit in
+// the sleep control register and smcr_bits its implemented bits. EIND and
+// RAMPZ are 0 on parts without them, which makes eijmp, eicall and elpm
+// illegal there.
+
+struct attiny85 {
+	static const char *name() { return "ATtiny85"; }
+
+	typedef uint16_t pc_type;
+
+	enum : uint32_t {
+		flash_words  = 0x1000,
+		io_end       = 0x0060,
+		ramend       = 0x025f,
+		pc_bytes     = 2,
+		vector_words = 1,
+		vectors      = 15,
+		usarts       = 0,
+	};
+
+	enum : uint8_t {
+		spl       = 0x3d,
+		sph       = 0x3e,
+		sreg      = 0x3f,
+		smcr      = 0x35,   // MCUCR
+		se        = 0x20,   // sleep enable
+		smcr_bits = 0xff,
+		eind      = 0,
+		rampz     = 0,
+	};
+
+	static timer8::layout timer0() {
+		return { 0x38, 0x2a, 0x33, 0x32, 0x29, 0x28, 0x39,
+		         0x02, 0x10, 0x08,
+		         5, 10, 11 };
+	}
+
+	static watchdog::layout wdt() {
+		return { 0x21, 12 };
+	}
+
+	// USI only
+	static usart::layout usart0() {
+		return { 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+	}
+};
+
+struct atmega328p {
+	static const char *name() { return "ATmega328P"; }
+
+	typedef uint16_t pc_type;
+
+	enum : uint32_t {
+		flash_words  = 0x4000,
+		io_end       = 0x0100,
+		ramend       = 0x08ff,
+		pc_bytes     = 2,
+		vector_words = 2,
+		vectors      = 26,
+		usarts       = 1,
+	};
+
+	enum : uint8_t {
+		spl       = 0x3d,
+		sph       = 0x3e,
+		sreg      = 0x3f,
+		smcr      = 0x33,
+		se        = 0x01,
+		smcr_bits = 0x0f,
+		eind      = 0,
+		rampz     = 0,
+	};
+
+	static timer8::layout timer0() {
+		return { 0x15, 0x24, 0x25, 0x26, 0x27, 0x28, 0x4e,
+		         0x01, 0x02, 0x04,
+		         16, 14, 15 };
+	}
+
+	static watchdog::layout wdt() {
+		return { 0x40, 6 };
+	}
+
+	static usart::layout usart0() {
+		return { 0xa0, 0xa1, 0xa2, 0xa4, 0xa5, 0xa6,
+		         18, 19, 20 };
+	}
+};
+
+// Extended IO from 0x100 to 0x1ff (USART1-3, timers 3-5, ports H-L) is
+// outside the IO window and behaves as plain memory.
+struct atmega2560 {
+	static const char *name() { return "ATmega2560"; }
+
+	typedef uint32_t pc_type;
+
+	enum : uint32_t {
+		flash_words  = 0x20000,
+		io_end       = 0x0100,
+		ramend       = 0x21ff,
+		pc_bytes     = 3,
+		vector_words = 2,
+		vectors      = 57,
+		usarts       = 1,
+	};
+
+	enum : uint8_t {
+		spl       = 0x3d,
+		sph       = 0x3e,
+		sreg      = 0x3f,
+		smcr      = 0x33,
+		se        = 0x01,
+		smcr_bits = 0x0f,
+		eind      = 0x3c,
+		rampz     = 0x3b,
+	};
+
+	static timer8::layout timer0() {
+		return { 0x15, 0x24, 0x25, 0x26, 0x27, 0x28, 0x4e,
+		         0x01, 0x02, 0x04,
+		         23, 21, 22 };
+	}
+
+	static watchdog::layout wdt() {
+		return { 0x40, 12 };
+	}
+
+	static usart::layout usart0() {
+		return { 0xa0, 0xa1, 0xa2, 0xa4, 0xa5, 0xa6,
+		         25, 26, 27 };
+	}
+};
+
+}
+
+#endif
@@ -0,0 +1,286 @@
+#include "firmware.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace coresim {
+
+namespace {
+
+enum {
+	rec_data          = 0,
+	rec_eof           = 1,
+	rec_segment       = 2,
+	rec_start_segment = 3,
+	rec_linear        = 4,
+	rec_start_linear  = 5,
+};
+
+// count, address, type, up to 255 data bytes and the checksum
+const size_t max_bytes = 1 + 2 + 1 + 255 + 1;
+const size_t max_record = 1 + 2 * max_bytes;
+
+const size_t block_bytes = 64 << 10;
+
+inline int nibble(char c) {
+	if (c >= '0' && c <= '9') {
+		return c - '0';
+	}
+	c |= 0x20;
+	if (c >= 'a' && c <= 'f') {
+		return c - 'a' + 10;
+	}
+	return -1;
+}
+
+// n bytes from 2n hex digits, false if any of them isn't one
+bool unhex(const char *src, size_t n, uint8_t *dst) {
+	size_t k = 0;
+
+#ifdef __SSE2__
+	for (; k + 8 <= n; k += 8) {
+		__m128i c = _mm_loadu_si128((const __m128i *)(src + 2 * k));
+		__m128i lower = _mm_or_si128(c, _mm_set1_epi8(0x20));
+
+		__m128i digit = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('0' - 1)),
+		                              _mm_cmplt_epi8(c, _mm_set1_epi8('9' + 1)));
+		__m128i letter = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+		                               _mm_cmplt_epi8(lower, _mm_set1_epi8('f' + 1)));
+
+		if (_mm_movemask_epi8(_mm_or_si128(digit, letter)) != 0xffff) {
+			return false;
+		}
+
+		__m128i v = _mm_or_si128(_mm_and_si128(digit, _mm_sub_epi8(c, _mm_set1_epi8('0'))),
+		                         _mm_andnot_si128(digit, _mm_sub_epi8(lower, _mm_set1_epi8('a' - 10))));
+
+		// each 16-bit lane holds the high nibble then the low one
+		__m128i b = _mm_or_si128(_mm_slli_epi16(v, 4), _mm_srli_epi16(v, 8));
+		b = _mm_and_si128(b, _mm_set1_epi16(0xff));
+		_mm_storel_epi64((__m128i *)(dst + k), _mm_packus_epi16(b, b));
+	}
+#endif
+
+	for (; k < n; k++) {
+		int hi = nibble(src[2 * k]);
+		int lo = nibble(src[2 * k + 1]);
+
+		if (hi < 0 || lo < 0) {
+			return false;
+		}
+		dst[k] = hi << 4 | lo;
+	}
+
+	return true;
+}
+
+void write(vmem &flash, uint32_t addr, const uint8_t *bytes, size_t n) {
+	size_t k = 0;
+
+	for (; k + 8 <= n; k += 8) {
+		uint64_t w;
+		std::memcpy(&w, bytes + k, 8);
+		flash.set(addr + k, w);
+	}
+	for (; k < n; k++) {
+		flash.set(addr + k, bytes[k]);
+	}
+}
+
+bool ends_with(const std::string &s, const char *suffix) {
+	size_t n = std::strlen(suffix);
+	return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+}
+
+}
+
+ihex::ihex(vmem &f, size_t l)
+	: flash(f), limit(l), base(0), end(0), records(0), done(false) {
+}
+
+void ihex::fail(const char *what) const {
+	throw std::runtime_error("Intel HEX record " + std::to_string(records + 1) + ": " + what);
+}
+
+void ihex::data(uint32_t addr, const uint8_t *bytes, size_t n) {
+	if (addr + n > limit) {
+		fail("data past the end of flash");
+	}
+
+	write(flash, addr, bytes, n);
+	end = std::max<size_t>(end, addr + n);
+}
+
+// One record starting at the ':' in p; returns its length, or 0 if the
+// text stops before its end.
+size_t ihex::record(const char *p, size_t n) {
+	uint8_t bytes[max_bytes];
+
+	if (n < 3) {
+		return 0;
+	}
+	if (!unhex(p + 1, 1, bytes)) {
+		fail("bad byte count");
+	}
+
+	size_t count = bytes[0];
+	size_t size = 1 + 2 * (5 + count);
+
+	if (n < size) {
+		return 0;
+	}
+	if (!unhex(p + 1, 5 + count, bytes)) {
+		fail("bad hex digit");
+	}
+
+	uint8_t sum = 0;
+	for (size_t k = 0; k < 5 + count; k++) {
+		sum += bytes[k];
+	}
+	if (sum) {
+		fail("bad checksum");
+	}
+
+	uint16_t offset = bytes[1] << 8 | bytes[2];
+	const uint8_t *payload = bytes + 4;
+
+	switch (bytes[3]) {
+		case rec_data:
+			data(base + offset, payload, count);
+			break;
+		case rec_eof:
+			done = true;
+			break;
+		case rec_segment:
+		case rec_linear:
+			if (count != 2) {
+				fail("bad address record");
+			}
+			base = (uint32_t)(payload[0] << 8 | payload[1]) << (bytes[3] == rec_segment ? 4 : 16);
+			break;
+		case rec_start_segment:
+		case rec_start_linear:
+			// the core always starts from the reset vector
+			break;
+		default:
+			fail("unknown record type");
+	}
+
+	records++;
+	return size;
+}
+
+void ihex::feed(const char *text, size_t n) {
+	const char *p = text;
+	const char *stop = text + n;
+
+	if (done) {
+		return;
+	}
+
+	// a record cut by the previous piece: complete it from this one
+	if (!partial.empty()) {
+		size_t had = partial.size();
+		size_t take = std::min<size_t>(stop - p, max_record - had);
+
+		partial.append(p, take);
+
+		size_t used = record(partial.data(), partial.size());
+
+		if (!used) {
+			return;
+		}
+
+		p += used - had;
+		partial.clear();
+	}
+
+	while (p < stop && !done) {
+		switch (*p) {
+			case ':': {
+				size_t used = record(p, stop - p);
+
+				if (!used) {
+					partial.assign(p, stop);
+					return;
+				}
+				p += used;
+				break;
+			}
+			case '\r':
+			case '\n':
+			case ' ':
+			case '\t':
+				p++;
+				break;
+			default:
+				fail("junk between records");
+		}
+	}
+}
+
+size_t ihex::finish() {
+	if (!partial.empty()) {
+		fail("truncated record");
+	}
+	if (!done) {
+		fail("no end of file record");
+	}
+
+	return end;
+}
+
+// The extension decides when there is one, the first character otherwise.
+size_t load_firmware(const std::string &filename, vmem &flash, size_t limit) {
+	std::unique_ptr<FILE, int (*)(FILE *)> file(std::fopen(filename.c_str(), "rb"), std::fclose);
+
+	if (!file) {
+		throw std::runtime_error("Can't open " + filename);
+	}
+
+	std::vector<char> block(block_bytes);
+	size_t n = std::fread(block.data(), 1, block.size(), file.get());
+	bool hex;
+
+	if (ends_with(filename, ".hex") || ends_with(filename, ".ihx") || ends_with(filename, ".ihex")) {
+		hex = true;
+	}
+	else if (ends_with(filename, ".bin")) {
+		hex = false;
+	}
+	else {
+		hex = n && block[0] == ':';
+	}
+
+	if (hex) {
+		ihex parser(flash, limit);
+
+		while (n) {
+			parser.feed(block.data(), n);
+			n = std::fread(block.data(), 1, block.size(), file.get());
+		}
+		return parser.finish();
+	}
+
+	size_t at = 0;
+
+	while (n) {
+		if (at + n > limit) {
+			throw std::runtime_error(filename + " is larger than flash");
+		}
+		write(flash, at, (const uint8_t *)block.data(), n);
+		at += n;
+		n = std::fread(block.data(), 1, block.size(), file.get());
+	}
+	return at;
+}
+
+}
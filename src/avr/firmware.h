@@ -0,0 +1,50 @@
+#ifndef AVR_FIRMWARE_H
+#define AVR_FIRMWARE_H
+
+#include "core.h"
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+namespace coresim {
+
+// Streaming Intel HEX parser writing straight into flash. Text can come in
+// pieces of any size; a record split across two of them is put back
+// together, everything else is decoded in place, sixteen hex digits at a
+// time where SSE2 is available. Extended segment (02) and linear (04)
+// address records are honoured and every checksum is verified.
+class ihex {
+public:
+	ihex(vmem &flash, size_t limit);
+
+	void feed(const char *text, size_t n);
+
+	// after the last piece; returns the end of the highest byte written
+	size_t finish();
+
+private:
+	vmem &flash;
+	size_t limit;
+
+	uint32_t base;
+	size_t end;
+	size_t records;
+	bool done;
+
+	std::string partial;
+
+	size_t record(const char *p, size_t n);
+	void data(uint32_t addr, const uint8_t *bytes, size_t n);
+	[[noreturn]] void fail(const char *what) const;
+};
+
+// Loads a firmware image into flash: Intel HEX when the file starts with a
+// record mark, raw binary from address 0 otherwise. Either is read and
+// written a block at a time. Returns the end of the highest byte written;
+// anything at or past limit is an error.
+size_t load_firmware(const std::string &filename, vmem &flash, size_t limit);
+
+}
+
+#endif
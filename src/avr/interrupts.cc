@@ -0,0 +1,63 @@
+#include "interrupts.h"
+
+#include <cstring>
+
+namespace coresim {
+
+interrupts::interrupts(scheduler &s) : sched(s) {
+	reset();
+}
+
+interrupts &interrupts::operator=(const interrupts &i) {
+	lines = i.lines;
+	enabled = i.enabled;
+	std::memcpy(sources, i.sources, sizeof(sources));
+	return *this;
+}
+
+void interrupts::reset() {
+	lines = 0;
+	enabled = 0;
+	std::memset(sources, 0, sizeof(sources));
+}
+
+// only a line that just became active needs the core to look
+void interrupts::update(uint64_t before) {
+	if ((lines & enabled) & ~before) {
+		sched.poke();
+	}
+}
+
+void interrupts::raise(int vector, peripheral *source) {
+	uint64_t before = lines & enabled;
+
+	sources[vector] = source;
+	lines |= 1ull << vector;
+	update(before);
+}
+
+void interrupts::clear(int vector) {
+	lines &= ~(1ull << vector);
+}
+
+void interrupts::enable(int vector, bool on) {
+	uint64_t before = lines & enabled;
+
+	if (on) {
+		enabled |= 1ull << vector;
+	}
+	else {
+		enabled &= ~(1ull << vector);
+	}
+	update(before);
+}
+
+void interrupts::acknowledge(int vector) {
+	lines &= ~(1ull << vector);
+
+	if (sources[vector]) {
+		sources[vector]->acknowledge(vector);
+	}
+}
+
+}
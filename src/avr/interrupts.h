@@ -0,0 +1,38 @@
+#ifndef AVR_INTERRUPTS_H
+#define AVR_INTERRUPTS_H
+
+#include "scheduler.h"
+
+namespace coresim {
+
+// Interrupt flags and enable bits, one bit per vector. Peripherals raise
+// and clear their flags and mirror their enable bits here; a vector is
+// taken when both are set, lower vectors first. The core never polls: a
+// line becoming active pokes the scheduler, so the check only happens at
+// the next dispatch.
+class interrupts {
+public:
+	interrupts(scheduler &s);
+	interrupts &operator=(const interrupts &i);
+
+	void raise(int vector, peripheral *source);
+	void clear(int vector);
+	void enable(int vector, bool on);
+	void acknowledge(int vector);
+	void reset();
+
+	bool pending() const { return (lines & enabled) != 0; }
+	int next() const { return __builtin_ctzll(lines & enabled); }
+
+private:
+	scheduler &sched;
+	uint64_t lines;
+	uint64_t enabled;
+	peripheral *sources[64];
+
+	void update(uint64_t before);
+};
+
+}
+
+#endif
@@ -0,0 +1,432 @@
+#include "jit.h"
+
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+#include <sys/mman.h>
+
+namespace coresim {
+
+namespace {
+
+const size_t buffer_size = 16 << 20;
+const int max_block = 64;
+const int max_insn_bytes = 128;
+
+// upper bound on the cycles a block can retire: two per instruction plus
+// the taken branch at the end
+const uint64_t max_block_cycles = 2 * max_block + 2;
+
+// marks addresses the translator gave up on
+void interpret(uint8_t *) {}
+
+enum { al = 0, cl = 1, dl = 2, ah = 4 };
+
+enum {
+	cc_o  = 0x0,
+	cc_c  = 0x2,
+	cc_z  = 0x4,
+	cc_nz = 0x5,
+	cc_s  = 0x8,
+};
+
+enum {
+	x_add  = 0x02, x_addi = 0x04,
+	x_or   = 0x0a, x_ori  = 0x0c,
+	x_adc  = 0x12, x_adci = 0x14,
+	x_sbb  = 0x1a, x_sbbi = 0x1c,
+	x_and  = 0x22, x_andi = 0x24,
+	x_sub  = 0x2a, x_subi = 0x2c,
+	x_xor  = 0x32,
+	x_cmp  = 0x3a, x_cmpi = 0x3c,
+};
+
+}
+
+// x86-64 encoder for the few forms the translator needs; every memory
+// operand is [rbx + disp32]
+struct avr_jit::emitter {
+	emitter(uint8_t *p) : cur(p) {}
+
+	uint8_t *cur;
+
+	void byte(uint8_t b) { *cur++ = b; }
+	void imm16(uint16_t v) { std::memcpy(cur, &v, 2); cur += 2; }
+	void imm32(uint32_t v) { std::memcpy(cur, &v, 4); cur += 4; }
+	void mem(int r, int32_t d) { byte(0x80 | (r << 3) | 3); imm32(d); }
+
+	// push rbx; mov rbx, rdi
+	void prologue() { byte(0x53); byte(0x48); byte(0x89); byte(0xfb); }
+	// pop rbx; ret
+	void epilogue() { byte(0x5b); byte(0xc3); }
+
+	void load8(int r, int32_t d) { byte(0x8a); mem(r, d); }
+	void store8(int32_t d, int r) { byte(0x88); mem(r, d); }
+	void store8i(int32_t d, uint8_t v) { byte(0xc6); mem(0, d); byte(v); }
+	void alu8(int op, int r, int32_t d) { byte(op); mem(r, d); }
+	void alu8i(int op, uint8_t v) { byte(op); byte(v); }
+	void and8(int32_t d, int r) { byte(0x20); mem(r, d); }
+	void inc8() { byte(0xfe); byte(0xc0); }
+	void dec8() { byte(0xfe); byte(0xc8); }
+
+	void load16(int32_t d) { byte(0x66); byte(0x8b); mem(al, d); }
+	void store16(int32_t d) { byte(0x66); byte(0x89); mem(al, d); }
+	void store16i(int32_t d, uint16_t v) { byte(0x66); byte(0xc7); mem(0, d); imm16(v); }
+	void add16i(int32_t d, uint16_t v) { byte(0x66); byte(0x81); mem(0, d); imm16(v); }
+	void sub16i(int32_t d, uint16_t v) { byte(0x66); byte(0x81); mem(5, d); imm16(v); }
+	void add64i(int32_t d, uint32_t v) { byte(0x48); byte(0x81); mem(0, d); imm32(v); }
+	void cmp8i(int32_t d, uint8_t v) { byte(0x80); mem(7, d); byte(v); }
+
+	void setcc(int cc, int32_t d) { byte(0x0f); byte(0x90 | cc); mem(0, d); }
+	void setcc_r(int cc, int r) { byte(0x0f); byte(0x90 | cc); byte(0xc0 | r); }
+
+	// cf = cl & 1
+	void carry_cl() { byte(0xd0); byte(0xe9); }
+	// cl = (ah >> 4) & 1, AF after lahf
+	void half_cl() {
+		byte(0x9f);
+		byte(0x88); byte(0xe1);
+		byte(0xc0); byte(0xe9); byte(0x04);
+		byte(0x80); byte(0xe1); byte(0x01);
+	}
+
+	uint8_t *jcc(int cc) { byte(0x0f); byte(0x80 | cc); imm32(0); return cur; }
+	void patch(uint8_t *after) {
+		int32_t rel = cur - after;
+		std::memcpy(after - 4, &rel, 4);
+	}
+};
+
+avr_jit::avr_jit(avr &c) : core(c), blocks(0x10000, nullptr), used(0) {
+	void *p = mmap(nullptr, buffer_size, PROT_READ | PROT_WRITE | PROT_EXEC,
+	               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED) {
+		throw std::runtime_error("Can't allocate translation buffer.");
+	}
+	buffer = (uint8_t *)p;
+}
+
+avr_jit::~avr_jit() {
+	munmap(buffer, buffer_size);
+}
+
+void avr_jit::flush() {
+	std::fill(blocks.begin(), blocks.end(), nullptr);
+	used = 0;
+}
+
+void avr_jit::step() {
+#ifdef AVR_PROFILE
+	core.step();
+	return;
+#endif
+
+	if (core.is_verbose || core.sleeping || core.coverage ||
+	    core.trace_out || core.journal) {
+		core.step();
+		return;
+	}
+
+	block &b = blocks[core.pc];
+	if (!b) {
+		b = compile(core.pc);
+	}
+
+	if (b == interpret) {
+		core.step();
+	}
+	else {
+		b(core.data);
+	}
+}
+
+// Blocks run to completion, so near a scheduler deadline fall back to the
+// interpreter to land on it exactly.
+void avr_jit::run(uint64_t n) {
+	uint64_t end = core.cycles + n;
+
+	core.horizon = end;
+
+	while (core.cycles < end) {
+		if (core.cycles >= core.sched.deadline()) {
+			core.dispatch();
+		}
+
+		if (core.cycles + max_block_cycles > core.sched.deadline()) {
+			core.step();
+		}
+		else {
+			step();
+		}
+	}
+
+	core.horizon = scheduler::never;
+}
+
+int32_t avr_jit::off(const void *field) {
+	return (const uint8_t *)field - core.data;
+}
+
+avr_jit::block avr_jit::compile(uint16_t addr) {
+	if (buffer_size - used < (max_block + 2) * max_insn_bytes) {
+		flush();
+	}
+
+	uint8_t *start = buffer + used;
+	emitter e(start);
+	uint16_t pc = addr;
+	unsigned cycles = 0;
+	int n;
+
+	e.prologue();
+
+	for (n = 0; n < max_block; n++) {
+		const avr::insn &i = core.fetch(pc);
+
+		// rjmp . is an idle loop, the interpreter skips it in one go
+		if (n == 0 && i.id == avr::op_rjmp && i.k == -1) {
+			return interpret;
+		}
+
+		if (branch(e, i, pc, cycles)) {
+			n++;
+			goto done;
+		}
+		if (!translate(e, i, cycles)) {
+			break;
+		}
+		pc++;
+	}
+
+	if (n == 0) {
+		return interpret;
+	}
+
+	exit(e, pc, cycles);
+
+done:
+	used = e.cur - buffer;
+	return (block)start;
+}
+
+void avr_jit::exit(emitter &e, uint16_t addr, unsigned cycles) {
+	e.store16i(off(&core.pc), addr);
+	e.add64i(off(&core.cycles), cycles);
+	e.epilogue();
+}
+
+// C, V, N, Z and S from the host flags, H from AF. Chained ops (cpc, sbc,
+// sbci) keep Z only if it was already set.
+void avr_jit::arith(emitter &e, bool half, bool chain) {
+	e.setcc(cc_c, off(&core.sreg.c));
+	e.setcc(cc_o, off(&core.sreg.v));
+	e.setcc(cc_s, off(&core.sreg.n));
+	if (chain) {
+		e.setcc_r(cc_z, dl);
+	}
+	else {
+		e.setcc(cc_z, off(&core.sreg.z));
+	}
+
+	if (half) {
+		e.half_cl();
+		e.store8(off(&core.sreg.h), cl);
+	}
+	if (chain) {
+		e.and8(off(&core.sreg.z), dl);
+	}
+
+	sign(e);
+}
+
+void avr_jit::logic(emitter &e) {
+	e.setcc(cc_s, off(&core.sreg.n));
+	e.setcc(cc_s, off(&core.sreg.s));
+	e.setcc(cc_z, off(&core.sreg.z));
+	e.store8i(off(&core.sreg.v), 0);
+}
+
+void avr_jit::sign(emitter &e) {
+	e.load8(cl, off(&core.sreg.n));
+	e.alu8(x_xor, cl, off(&core.sreg.v));
+	e.store8(off(&core.sreg.s), cl);
+}
+
+bool avr_jit::translate(emitter &e, const avr::insn &i, unsigned &cycles) {
+	int32_t rd = off(&core.regs[i.a]);
+	int32_t rr = off(&core.regs[i.b]);
+	int32_t c = off(&core.sreg.c);
+
+	switch (i.id) {
+		case avr::op_nop:
+			break;
+
+		case avr::op_ldi:
+			e.store8i(rd, i.k);
+			break;
+
+		case avr::op_mov:
+			e.load8(al, rr);
+			e.store8(rd, al);
+			break;
+
+		case avr::op_movw:
+			e.load16(rr);
+			e.store16(rd);
+			break;
+
+		case avr::op_add:
+		case avr::op_sub:
+			e.load8(al, rd);
+			e.alu8(i.id == avr::op_add ? x_add : x_sub, al, rr);
+			e.store8(rd, al);
+			arith(e, true, false);
+			break;
+
+		case avr::op_adc:
+			e.load8(cl, c);
+			e.carry_cl();
+			e.load8(al, rd);
+			e.alu8(x_adc, al, rr);
+			e.store8(rd, al);
+			arith(e, true, false);
+			break;
+
+		case avr::op_sbc:
+		case avr::op_cpc:
+			e.load8(cl, c);
+			e.carry_cl();
+			e.load8(al, rd);
+			e.alu8(x_sbb, al, rr);
+			if (i.id == avr::op_sbc) {
+				e.store8(rd, al);
+			}
+			arith(e, true, true);
+			break;
+
+		case avr::op_cp:
+			e.load8(al, rd);
+			e.alu8(x_cmp, al, rr);
+			arith(e, true, false);
+			break;
+
+		case avr::op_cpi:
+			e.load8(al, rd);
+			e.alu8i(x_cmpi, i.k);
+			arith(e, true, false);
+			break;
+
+		case avr::op_subi:
+			e.load8(al, rd);
+			e.alu8i(x_subi, i.k);
+			e.store8(rd, al);
+			arith(e, true, false);
+			break;
+
+		case avr::op_sbci:
+			e.load8(cl, c);
+			e.carry_cl();
+			e.load8(al, rd);
+			e.alu8i(x_sbbi, i.k);
+			e.store8(rd, al);
+			arith(e, true, true);
+			break;
+
+		case avr::op_and:
+		case avr::op_or:
+		case avr::op_eor:
+			e.load8(al, rd);
+			e.alu8(i.id == avr::op_and ? x_and :
+			       i.id == avr::op_or ? x_or : x_xor, al, rr);
+			e.store8(rd, al);
+			logic(e);
+			break;
+
+		case avr::op_andi:
+		case avr::op_ori:
+			e.load8(al, rd);
+			e.alu8i(i.id == avr::op_andi ? x_andi : x_ori, i.k);
+			e.store8(rd, al);
+			logic(e);
+			break;
+
+		case avr::op_inc:
+		case avr::op_dec:
+			e.load8(al, rd);
+			if (i.id == avr::op_inc) {
+				e.inc8();
+			}
+			else {
+				e.dec8();
+			}
+			e.store8(rd, al);
+			e.setcc(cc_o, off(&core.sreg.v));
+			e.setcc(cc_s, off(&core.sreg.n));
+			e.setcc(cc_z, off(&core.sreg.z));
+			sign(e);
+			break;
+
+		// register pairs are little-endian in the data space, so adiw and
+		// sbiw are single 16-bit host operations
+		case avr::op_adiw:
+		case avr::op_sbiw:
+			if (i.id == avr::op_adiw) {
+				e.add16i(rd, i.k);
+			}
+			else {
+				e.sub16i(rd, i.k);
+			}
+			arith(e, false, false);
+			cycles += 2;
+			return true;
+
+		default:
+			return false;
+	}
+
+	cycles++;
+	return true;
+}
+
+bool avr_jit::branch(emitter &e, const avr::insn &i, uint16_t addr,
+                     unsigned cycles) {
+	uint16_t target = addr + i.k + 1;
+	const bool *flag;
+	bool set;
+
+	switch (i.id) {
+		case avr::op_rjmp:
+			exit(e, target, cycles + 2);
+			return true;
+
+		case avr::op_brcs: flag = &core.sreg.c; set = true;  break;
+		case avr::op_brcc: flag = &core.sreg.c; set = false; break;
+		case avr::op_breq: flag = &core.sreg.z; set = true;  break;
+		case avr::op_brne: flag = &core.sreg.z; set = false; break;
+		case avr::op_brmi: flag = &core.sreg.n; set = true;  break;
+		case avr::op_brpl: flag = &core.sreg.n; set = false; break;
+		case avr::op_brvs: flag = &core.sreg.v; set = true;  break;
+		case avr::op_brvc: flag = &core.sreg.v; set = false; break;
+		case avr::op_brlt: flag = &core.sreg.s; set = true;  break;
+		case avr::op_brge: flag = &core.sreg.s; set = false; break;
+		case avr::op_brhs: flag = &core.sreg.h; set = true;  break;
+		case avr::op_brhc: flag = &core.sreg.h; set = false; break;
+		case avr::op_brts: flag = &core.sreg.t; set = true;  break;
+		case avr::op_brtc: flag = &core.sreg.t; set = false; break;
+		case avr::op_brie: flag = &core.sreg.i; set = true;  break;
+		case avr::op_brid: flag = &core.sreg.i; set = false; break;
+
+		default:
+			return false;
+	}
+
+	e.cmp8i(off(flag), 0);
+	uint8_t *taken = e.jcc(set ? cc_nz : cc_z);
+	exit(e, addr + 1, cycles + 1);
+	e.patch(taken);
+	exit(e, target, cycles + 2);
+
+	return true;
+}
+
+}
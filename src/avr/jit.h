@@ -0,0 +1,47 @@
+#ifndef AVR_JIT_H
+#define AVR_JIT_H
+
+#include "avr.h"
+
+#include <vector>
+
+namespace coresim {
+
+// Translates straight-line runs of predecoded AVR instructions to x86-64.
+// The data space base is pinned in rbx for the whole block, so registers
+// and SREG are plain [rbx + disp32] operands. Blocks stop in front of
+// anything touching IO, SRAM, the stack or the interrupt flag, which is
+// left to the interpreter.
+class avr_jit {
+public:
+	avr_jit(avr &c);
+	~avr_jit();
+
+	void step();
+	void run(uint64_t n);
+	void flush();
+
+private:
+	typedef void (*block)(uint8_t *data);
+	struct emitter;
+
+	avr &core;
+	std::vector<block> blocks;
+
+	uint8_t *buffer;
+	size_t used;
+
+	block compile(uint16_t addr);
+	bool translate(emitter &e, const avr::insn &i, unsigned &cycles);
+	bool branch(emitter &e, const avr::insn &i, uint16_t addr, unsigned cycles);
+	void exit(emitter &e, uint16_t addr, unsigned cycles);
+	void arith(emitter &e, bool half, bool chain);
+	void logic(emitter &e);
+	void sign(emitter &e);
+
+	int32_t off(const void *field);
+};
+
+}
+
+#endif
@@ -0,0 +1,252 @@
+#ifndef AVR_LANES_H
+#define AVR_LANES_H
+
+#include "batch.h"
+
+namespace coresim {
+
+struct avr_batch::group {
+	uint8_t r[32][width];
+	uint8_t f[8][width];
+
+	uint16_t pc[width];
+	uint64_t cycles[width];
+	uint64_t end[width];
+	uint64_t deadline[width];
+
+	bool live[width];
+	bool parked[width];
+};
+
+// The register-only part of the batch engine, written once over a 64 byte
+// vector and built for each instruction set in a file of its own with that
+// file's target flags; avr_batch picks the widest one the CPU runs. A vec
+// has static load() and splat(), everything else is found next to it.
+namespace lanes {
+
+typedef avr_batch::group group;
+
+// Comparisons return 0x00/0xff masks, the same encoding used for the SREG
+// flags.
+template <typename vec> inline vec operator~(vec a) { return a ^ vec::splat(0xff); }
+template <typename vec> inline vec blend(vec m, vec a, vec b) { return andnot(m, a) | (m & b); }
+template <typename vec> inline vec bit(vec a, uint8_t k) { return eq(a & vec::splat(k), vec::splat(k)); }
+template <typename vec> inline vec zero(vec a) { return eq(a, vec::splat(0)); }
+
+// SREG flags, in avr::sreg order
+enum { C, Z, N, V, S, H, T, I };
+
+template <typename vec>
+inline void assign(uint8_t *p, vec m, vec v) {
+	store(p, blend(m, vec::load(p), v));
+}
+
+template <typename vec>
+void flags(group &g, vec m, vec r, vec v) {
+	vec n = msb(r);
+
+	assign(g.f[N], m, n);
+	assign(g.f[V], m, v);
+	assign(g.f[S], m, n ^ v);
+	assign(g.f[Z], m, zero(r));
+}
+
+template <typename vec>
+void add(group &g, vec m, int d, vec b, bool carry) {
+	vec a = vec::load(g.r[d]);
+	vec c = carry ? vec::load(g.f[C]) & vec::splat(1) : vec::splat(0);
+	vec r = a + b + c;
+
+	vec cy = (a & b) | andnot(r, a) | andnot(r, b);
+	vec v = andnot(r, a & b) | andnot(a | b, r);
+
+	flags(g, m, r, msb(v));
+	assign(g.f[H], m, bit(cy, 0x08));
+	assign(g.f[C], m, msb(cy));
+	assign(g.r[d], m, r);
+}
+
+template <typename vec>
+void sub(group &g, vec m, int d, vec b, bool carry, bool write) {
+	vec a = vec::load(g.r[d]);
+	vec c = carry ? vec::load(g.f[C]) & vec::splat(1) : vec::splat(0);
+	vec r = a - b - c;
+	vec z = vec::load(g.f[Z]);
+
+	vec bw = andnot(a, b) | (b & r) | andnot(a, r);
+	vec v = andnot(b | r, a) | andnot(a, b & r);
+
+	flags(g, m, r, msb(v));
+	if (carry) {
+		assign(g.f[Z], m, zero(r) & z);
+	}
+	assign(g.f[H], m, bit(bw, 0x08));
+	assign(g.f[C], m, msb(bw));
+	if (write) {
+		assign(g.r[d], m, r);
+	}
+}
+
+template <typename vec>
+void logic(group &g, vec m, int d, vec r) {
+	flags(g, m, r, vec::splat(0));
+	assign(g.r[d], m, r);
+}
+
+// lsr, asr and ror: C from bit 0, V = N ^ C
+template <typename vec>
+void shift(group &g, vec m, int d, vec r) {
+	vec a = vec::load(g.r[d]);
+	vec c = bit(a, 0x01);
+
+	flags(g, m, r, msb(r) ^ c);
+	assign(g.f[C], m, c);
+	assign(g.r[d], m, r);
+}
+
+}
+
+// Everything handled here is a single word without memory access.
+template <typename vec>
+bool avr_batch::step(group &g, const avr::insn &i, const uint8_t *mask) {
+	using namespace lanes;
+
+	vec m = vec::load(mask);
+	int d = i.a;
+	uint8_t k = i.k;
+
+	switch (i.id) {
+		case avr::op_nop:
+			break;
+
+		case avr::op_ldi:  assign(g.r[d], m, vec::splat(k)); break;
+		case avr::op_mov:  assign(g.r[d], m, vec::load(g.r[i.b])); break;
+		case avr::op_movw:
+			assign(g.r[d], m, vec::load(g.r[i.b]));
+			assign(g.r[d+1], m, vec::load(g.r[i.b+1]));
+			break;
+
+		case avr::op_add:  add(g, m, d, vec::load(g.r[i.b]), false); break;
+		case avr::op_adc:  add(g, m, d, vec::load(g.r[i.b]), true); break;
+		case avr::op_sub:  sub(g, m, d, vec::load(g.r[i.b]), false, true); break;
+		case avr::op_sbc:  sub(g, m, d, vec::load(g.r[i.b]), true, true); break;
+		case avr::op_cp:   sub(g, m, d, vec::load(g.r[i.b]), false, false); break;
+		case avr::op_cpc:  sub(g, m, d, vec::load(g.r[i.b]), true, false); break;
+		case avr::op_subi: sub(g, m, d, vec::splat(k), false, true); break;
+		case avr::op_sbci: sub(g, m, d, vec::splat(k), true, true); break;
+		case avr::op_cpi:  sub(g, m, d, vec::splat(k), false, false); break;
+
+		case avr::op_and:  logic(g, m, d, vec::load(g.r[d]) & vec::load(g.r[i.b])); break;
+		case avr::op_or:   logic(g, m, d, vec::load(g.r[d]) | vec::load(g.r[i.b])); break;
+		case avr::op_eor:  logic(g, m, d, vec::load(g.r[d]) ^ vec::load(g.r[i.b])); break;
+		case avr::op_andi: logic(g, m, d, vec::load(g.r[d]) & vec::splat(k)); break;
+		case avr::op_ori:  logic(g, m, d, vec::load(g.r[d]) | vec::splat(k)); break;
+
+		case avr::op_com:
+			logic(g, m, d, ~vec::load(g.r[d]));
+			assign(g.f[C], m, vec::splat(0xff));
+			break;
+
+		case avr::op_neg: {
+			vec a = vec::load(g.r[d]);
+			vec r = vec::splat(0) - a;
+
+			flags(g, m, r, eq(r, vec::splat(0x80)));
+			assign(g.f[H], m, bit(r | a, 0x08));
+			assign(g.f[C], m, ~zero(r));
+			assign(g.r[d], m, r);
+			break;
+		}
+
+		case avr::op_inc: {
+			vec r = vec::load(g.r[d]) + vec::splat(1);
+			flags(g, m, r, eq(r, vec::splat(0x80)));
+			assign(g.r[d], m, r);
+			break;
+		}
+
+		case avr::op_dec: {
+			vec a = vec::load(g.r[d]);
+			vec r = a - vec::splat(1);
+			flags(g, m, r, eq(a, vec::splat(0x80)));
+			assign(g.r[d], m, r);
+			break;
+		}
+
+		case avr::op_swap: {
+			vec a = vec::load(g.r[d]);
+			assign(g.r[d], m, shl(a, 4) | shr(a, 4));
+			break;
+		}
+
+		case avr::op_lsr: {
+			shift(g, m, d, shr(vec::load(g.r[d]), 1));
+			break;
+		}
+
+		case avr::op_asr: {
+			vec a = vec::load(g.r[d]);
+			shift(g, m, d, shr(a, 1) | (a & vec::splat(0x80)));
+			break;
+		}
+
+		case avr::op_ror: {
+			vec a = vec::load(g.r[d]);
+			shift(g, m, d, shr(a, 1) | (vec::load(g.f[C]) & vec::splat(0x80)));
+			break;
+		}
+
+		// sei pokes the scheduler, leave it to the scalar core
+		case avr::op_sec: case avr::op_sez: case avr::op_sen: case avr::op_sev:
+		case avr::op_ses: case avr::op_seh: case avr::op_set:
+			assign(g.f[i.id - avr::op_sec], m, vec::splat(0xff));
+			break;
+
+		case avr::op_clc: case avr::op_clz: case avr::op_cln: case avr::op_clv:
+		case avr::op_cls: case avr::op_clh: case avr::op_clt: case avr::op_cli:
+			assign(g.f[i.id - avr::op_clc], m, vec::splat(0));
+			break;
+
+		case avr::op_rjmp:
+			for (int l = 0; l < width; l++) {
+				if (mask[l]) {
+					g.pc[l] += i.k + 1;
+					g.cycles[l] += 2;
+				}
+			}
+			return true;
+
+		case avr::op_brcs: case avr::op_breq: case avr::op_brmi: case avr::op_brvs:
+		case avr::op_brlt: case avr::op_brhs: case avr::op_brts: case avr::op_brie:
+		case avr::op_brcc: case avr::op_brne: case avr::op_brpl: case avr::op_brvc:
+		case avr::op_brge: case avr::op_brhc: case avr::op_brtc: case avr::op_brid: {
+			const uint8_t *f = g.f[(i.id - avr::op_brcs) & 7];
+			uint8_t sense = (i.id >= avr::op_brcc) ? 0xff : 0;
+
+			for (int l = 0; l < width; l++) {
+				if (mask[l]) {
+					bool taken = f[l] ^ sense;
+					g.pc[l] += taken ? i.k + 1 : 1;
+					g.cycles[l] += taken ? 2 : 1;
+				}
+			}
+			return true;
+		}
+
+		default:
+			return false;
+	}
+
+	for (int l = 0; l < width; l++) {
+		if (mask[l]) {
+			g.pc[l]++;
+			g.cycles[l]++;
+		}
+	}
+
+	return true;
+}
+
+}
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef AVR_PERIPHERAL_H
+#define AVR_PERIPHERAL_H
+
+#include <cstdint>
+
+namespace coresim {
+
+// An on-chip device mapped into the AVR IO space. Reads and writes arrive
+// through the core's IO map; timed behavior goes through the scheduler and
+// should be caught up lazily when the firmware looks at a register.
+class peripheral {
+public:
+	virtual ~peripheral() {}
+
+	virtual uint8_t read(uint8_t port) = 0;
+	virtual void write(uint8_t port, uint8_t value) = 0;
+	virtual void event(int id) {}
+	virtual void acknowledge(int vector) {}
+	virtual void reset() {}
+
+	// false for registers whose value drifts between scheduled events
+	virtual bool stable(uint8_t port) { return true; }
+};
+
+}
+
+#endif
@@ -0,0 +1,103 @@
+#include "profile.h"
+
+#include <algorithm>
+#include <numeric>
+#include <cstdio>
+#include <stdexcept>
+
+namespace coresim {
+
+namespace {
+
+// firmware that never returns (longjmp, task switches) must not grow the
+// shadow stack forever
+const size_t max_depth = 256;
+
+}
+
+profiler::profiler(size_t words) : hits(words), spent(words) {
+	reset();
+}
+
+void profiler::reset() {
+	std::fill(hits.begin(), hits.end(), 0);
+	std::fill(spent.begin(), spent.end(), 0);
+
+	stack.assign(1, 0);
+	stacks.clear();
+	mark = 0;
+}
+
+void profiler::charge(uint64_t now) {
+	stacks[stack] += now - mark;
+	mark = now;
+}
+
+void profiler::call(uint32_t target, uint64_t now) {
+	charge(now);
+
+	if (stack.size() < max_depth) {
+		stack.push_back(target);
+	}
+}
+
+void profiler::ret(uint64_t now) {
+	charge(now);
+
+	if (stack.size() > 1) {
+		stack.pop_back();
+	}
+}
+
+void profiler::report(size_t top) {
+	std::vector<uint32_t> order;
+	uint64_t total = std::accumulate(spent.begin(), spent.end(), 0ull);
+
+	for (uint32_t pc = 0; pc < hits.size(); pc++) {
+		if (hits[pc]) {
+			order.push_back(pc);
+		}
+	}
+
+	top = std::min(top, order.size());
+	std::partial_sort(order.begin(), order.begin() + top, order.end(),
+	                  [this](uint32_t a, uint32_t b) { return spent[a] > spent[b]; });
+
+	std::printf("-> Profile: %llu cycles over %zu addresses\n",
+	            (unsigned long long)total, order.size());
+	std::printf("   %-8s %12s %14s %7s\n", "pc", "count", "cycles", "%");
+
+	for (size_t n = 0; n < top; n++) {
+		uint32_t pc = order[n];
+		std::printf("   0x%04x   %12llu %14llu %6.2f%%\n", pc << 1,
+		            (unsigned long long)hits[pc], (unsigned long long)spent[pc],
+		            total ? 100.0 * spent[pc] / total : 0.0);
+	}
+}
+
+// one line per distinct stack, frames are function entry byte addresses
+// from the outermost one: "0x0000;0x01a4;0x0230 1234"
+void profiler::folded(const std::string &filename, uint64_t now) {
+	charge(now);
+
+	FILE *f = std::fopen(filename.c_str(), "w");
+
+	if (!f) {
+		throw std::runtime_error("Can't open " + filename);
+	}
+
+	for (auto &s : stacks) {
+		if (!s.second) {
+			continue;
+		}
+
+		for (size_t n = 0; n < s.first.size(); n++) {
+			std::fprintf(f, "%s0x%04x", n ? ";" : "", s.first[n] << 1);
+		}
+		std::fprintf(f, " %llu\n", (unsigned long long)s.second);
+	}
+
+	std::fclose(f);
+}
+
+}
@@ -0,0 +1,44 @@
+#ifndef AVR_PROFILE_H
+#define AVR_PROFILE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+
+namespace coresim {
+
+// Execution counts and cycles per flash word in flat arrays, plus cycles
+// per call stack for flamegraphs. The stack is a shadow of call/ret and
+// interrupt entry/reti, and cycles are charged to it only when it changes,
+// so the per-instruction cost is two array increments.
+class profiler {
+public:
+	profiler(size_t words);
+
+	void count(uint32_t pc, uint64_t cycles) {
+		hits[pc]++;
+		spent[pc] += cycles;
+	}
+
+	void call(uint32_t target, uint64_t now);
+	void ret(uint64_t now);
+	void reset();
+
+	void report(size_t top);
+	void folded(const std::string &filename, uint64_t now);
+
+private:
+	std::vector<uint64_t> hits;
+	std::vector<uint64_t> spent;
+
+	std::vector<uint32_t> stack;
+	std::map<std::vector<uint32_t>, uint64_t> stacks;
+	uint64_t mark;
+
+	void charge(uint64_t now);
+};
+
+}
+
+#endif
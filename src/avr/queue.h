@@ -0,0 +1,84 @@
+#ifndef AVR_QUEUE_H
+#define AVR_QUEUE_H
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+
+namespace coresim {
+
+// Bounded single-producer single-consumer queue. Head and tail are padded
+// to their own cache lines and each side keeps a cached copy of the other's
+// index, so the shared lines are only touched when the cache runs out.
+template <typename T>
+class spsc_queue {
+public:
+	// rounded up to a power of two
+	explicit spsc_queue(size_t capacity)
+		: slots(round(capacity)), head(0), tail(0), tail_cache(0), head_cache(0) {
+	}
+
+	bool push(const T &v) {
+		size_t h = head.load(std::memory_order_relaxed);
+
+		if (h - tail_cache == slots.size()) {
+			tail_cache = tail.load(std::memory_order_acquire);
+			if (h - tail_cache == slots.size()) {
+				return false;
+			}
+		}
+
+		slots[h & (slots.size() - 1)] = v;
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+
+	// oldest entry without removing it, nullptr when empty
+	const T *front() {
+		size_t t = tail.load(std::memory_order_relaxed);
+
+		if (t == head_cache) {
+			head_cache = head.load(std::memory_order_acquire);
+			if (t == head_cache) {
+				return nullptr;
+			}
+		}
+
+		return &slots[t & (slots.size() - 1)];
+	}
+
+	void pop() {
+		tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+private:
+	static size_t round(size_t n) {
+		size_t p = 1;
+		while (p < n) {
+			p <<= 1;
+		}
+		return p;
+	}
+
+	enum {
+		line = 64,
+	};
+
+	std::vector<T> slots;
+
+	char pad0[line];
+	std::atomic<size_t> head;
+	char pad1[line - sizeof(size_t)];
+	std::atomic<size_t> tail;
+	char pad2[line - sizeof(size_t)];
+
+	// producer side
+	size_t tail_cache;
+	char pad3[line - sizeof(size_t)];
+	// consumer side
+	size_t head_cache;
+};
+
+}
+
+#endif
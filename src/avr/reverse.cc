@@ -0,0 +1,181 @@
+#include "reverse.h"
+
+#include <cstring>
+#include <algorithm>
+
+namespace coresim {
+
+avr_reverse::checkpoint::checkpoint(avr &c)
+	: pc(c.pc), sp(c.sp), sreg(c.sreg), cycles(c.cycles), smcr(c.smcr),
+	  sleeping(c.sleeping), held(c.held), loop(c.loop),
+	  sched(c.sched), irq(c.irq), timer0(c.timer0), wdt(c.wdt), usart0(c.usart0) {
+}
+
+avr_reverse::avr_reverse(avr &c, uint64_t checkpoint_every)
+	: core(c), every(checkpoint_every), now(0), frontier(0) {
+	core.journal = &journal;
+	save();
+}
+
+avr_reverse::~avr_reverse() {
+	core.journal = nullptr;
+}
+
+// Same order as avr::run(): pending events first, then the instruction.
+void avr_reverse::advance() {
+	journal.replaying = now < frontier;
+
+	if (core.cycles >= core.sched.deadline()) {
+		core.dispatch();
+	}
+	core.step();
+	now++;
+
+	if (now > frontier) {
+		frontier = now;
+	}
+	if (now % every == 0 && now / every == checkpoints.size()) {
+		save();
+	}
+}
+
+// Pages not stored to since the last checkpoint or restore are shared with
+// the previous checkpoint. Page 0 holds the registers, which are written
+// without going through store(), so it is always copied. The core keeps a
+// page bitmap for this of its own, snapshots keep theirs.
+void avr_reverse::save() {
+	const checkpoint *prev = checkpoints.empty() ? nullptr : checkpoints.back().get();
+	std::unique_ptr<checkpoint> k(new checkpoint(core));
+
+	k->io = journal.cursor;
+
+	for (int p = 0; p < pages; p++) {
+		bool written = (core.written[p >> 6] >> (p & 63)) & 1;
+
+		if (prev && p && !written) {
+			k->data[p] = prev->data[p];
+		}
+		else {
+			std::shared_ptr<page> copy = std::make_shared<page>();
+			std::memcpy(copy->data(), core.data + p * page_size, page_size);
+			k->data[p] = copy;
+		}
+	}
+
+	std::memset(core.written, 0, sizeof(core.written));
+
+	checkpoints.push_back(std::move(k));
+}
+
+// Only pages that differ are copied, and marked dirty for the core's own
+// snapshot so that restoring one afterwards still takes its fast path.
+void avr_reverse::restore(const checkpoint &k) {
+	for (int p = 0; p < pages; p++) {
+		uint8_t *at = core.data + p * page_size;
+
+		if (std::memcmp(at, k.data[p]->data(), page_size)) {
+			std::memcpy(at, k.data[p]->data(), page_size);
+			core.dirty[p >> 6] |= 1ull << (p & 63);
+		}
+	}
+
+	core.pc = k.pc;
+	core.sp = k.sp;
+	core.sreg = k.sreg;
+	core.cycles = k.cycles;
+	core.smcr = k.smcr;
+	core.sleeping = k.sleeping;
+	core.held = k.held;
+	core.loop = k.loop;
+
+	core.sched = k.sched;
+	core.irq = k.irq;
+	core.timer0 = k.timer0;
+	core.wdt = k.wdt;
+	core.usart0 = k.usart0;
+
+	std::memset(core.written, 0, sizeof(core.written));
+	core.prev = 0;
+
+	journal.cursor = k.io;
+}
+
+bool avr_reverse::stop() const {
+	return breakpoints.count((uint32_t)core.pc << 1);
+}
+
+void avr_reverse::step() {
+	advance();
+}
+
+bool avr_reverse::run(uint64_t n) {
+	while (n--) {
+		advance();
+
+		if (stop()) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void avr_reverse::reverse_step() {
+	if (now) {
+		seek(now - 1);
+	}
+}
+
+// Replays one checkpoint interval at a time, latest first, and keeps the
+// last breakpoint hit of the first interval that has one.
+bool avr_reverse::reverse_continue() {
+	uint64_t end = now;
+
+	while (end) {
+		uint64_t from = (end - 1) / every * every;
+		uint64_t hit = end;
+
+		restore(*checkpoints[from / every]);
+		now = from;
+
+		while (now < end) {
+			if (stop()) {
+				hit = now;
+			}
+			advance();
+		}
+
+		if (hit != end) {
+			seek(hit);
+			return true;
+		}
+
+		end = from;
+	}
+
+	seek(0);
+	return false;
+}
+
+void avr_reverse::seek(uint64_t n) {
+	uint64_t k = std::min<uint64_t>(n / every, checkpoints.size() - 1);
+
+	// a checkpoint beats replaying from here when going back, or when it
+	// is further ahead
+	if (n < now || k * every > now) {
+		restore(*checkpoints[k]);
+		now = k * every;
+	}
+
+	while (now < n) {
+		advance();
+	}
+}
+
+void avr_reverse::diverge() {
+	checkpoints.resize(now / every + 1);
+	journal.values.resize(journal.cursor);
+	frontier = now;
+}
+
+}
@@ -0,0 +1,123 @@
+#ifndef AVR_REVERSE_H
+#define AVR_REVERSE_H
+
+#include "avr.h"
+
+#include <vector>
+#include <set>
+#include <array>
+#include <memory>
+
+namespace coresim {
+
+// Values read from devices behind vio, in the order the core read them.
+// While replaying inside the recorded history, reads come back from the
+// log and writes are dropped, so devices only ever see the live run.
+class io_log {
+public:
+	io_log() : cursor(0), replaying(false) {}
+
+	uint8_t read(vio &io, uint8_t port) {
+		if (cursor < values.size()) {
+			return values[cursor++];
+		}
+
+		uint8_t v = io.get(port);
+		values.push_back(v);
+		cursor++;
+		return v;
+	}
+
+	void write(vio &io, uint8_t port, uint8_t value) {
+		if (!replaying) {
+			io.set(port, value);
+		}
+	}
+
+private:
+	friend class avr_reverse;
+
+	std::vector<uint8_t> values;
+	size_t cursor;
+	bool replaying;
+};
+
+// Reverse execution for one core. Instructions are counted from the point
+// the engine was attached; every so many of them a checkpoint is taken,
+// sharing the SRAM pages left untouched since the previous one. Going back
+// restores the closest checkpoint at or before the target and replays
+// forward from there, with vio reads served from the log, so any step
+// back costs at most one checkpoint interval.
+//
+// Breakpoints are flash byte addresses, as printed by debug().
+class avr_reverse {
+public:
+	avr_reverse(avr &c, uint64_t checkpoint_every = 10000);
+	~avr_reverse();
+
+	uint64_t position() const { return now; }
+
+	// forward; run() stops in front of a breakpoint and says so
+	void step();
+	bool run(uint64_t n);
+
+	void reverse_step();
+	bool reverse_continue();
+
+	// go to the state in front of instruction n, forward or back
+	void seek(uint64_t n);
+
+	// the core was changed from outside: drop the history after now
+	void diverge();
+
+	std::set<uint32_t> breakpoints;
+
+private:
+	enum {
+		page_size = 1 << avr::page_bits,
+		pages = avr::data_size / page_size,
+	};
+
+	typedef std::array<uint8_t, page_size> page;
+
+	struct checkpoint {
+		checkpoint(avr &c);
+
+		size_t io;
+
+		uint16_t pc;
+		uint16_t sp;
+		decltype(avr::sreg) sreg;
+		uint64_t cycles;
+		uint8_t smcr;
+		bool sleeping;
+		bool held;
+		decltype(avr::loop) loop;
+
+		scheduler sched;
+		interrupts irq;
+		timer8 timer0;
+		watchdog wdt;
+		usart usart0;
+
+		std::shared_ptr<const page> data[pages];
+	};
+
+	avr &core;
+	io_log journal;
+
+	uint64_t every;
+	uint64_t now;
+	uint64_t frontier;
+
+	std::vector<std::unique_ptr<checkpoint>> checkpoints;
+
+	void advance();
+	void save();
+	void restore(const checkpoint &k);
+	bool stop() const;
+};
+
+}
+
+#endif
@@ -0,0 +1,84 @@
+#include "scheduler.h"
+
+#include <algorithm>
+
+namespace coresim {
+
+const uint64_t scheduler::never;
+
+scheduler::scheduler(const uint64_t &c) : clock(c), next(never), poked(false) {
+}
+
+// copies the pending events, the clock stays bound to its own core
+scheduler &scheduler::operator=(const scheduler &s) {
+	next = s.next;
+	poked = s.poked;
+	heap = s.heap;
+	return *this;
+}
+
+// A poke outlives whatever else the caller reschedules before the run loop
+// next looks.
+void scheduler::update() {
+	if (poked) {
+		next = 0;
+		return;
+	}
+	next = heap.empty() ? never : heap.front().when;
+}
+
+void scheduler::at(uint64_t when, peripheral *p, int id) {
+	event e = { when, p, id };
+
+	heap.push_back(e);
+	std::push_heap(heap.begin(), heap.end());
+
+	update();
+}
+
+void scheduler::cancel(peripheral *p) {
+	heap.erase(std::remove_if(heap.begin(), heap.end(),
+	                          [p](const event &e) { return e.p == p; }),
+	           heap.end());
+	std::make_heap(heap.begin(), heap.end());
+
+	update();
+}
+
+void scheduler::cancel(peripheral *p, int id) {
+	heap.erase(std::remove_if(heap.begin(), heap.end(),
+	                          [p, id](const event &e) { return e.p == p && e.id == id; }),
+	           heap.end());
+	std::make_heap(heap.begin(), heap.end());
+
+	update();
+}
+
+// force the run loop through run() on its next check, used when something
+// other than an event (sei, an IO write) may have made an interrupt ready
+void scheduler::poke() {
+	poked = true;
+	next = 0;
+}
+
+void scheduler::run() {
+	poked = false;
+
+	while (!heap.empty() && heap.front().when <= clock) {
+		event e = heap.front();
+		std::pop_heap(heap.begin(), heap.end());
+		heap.pop_back();
+
+		e.p->event(e.id);
+	}
+
+	update();
+}
+
+void scheduler::clear() {
+	heap.clear();
+	poked = false;
+	update();
+}
+
+}
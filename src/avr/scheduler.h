@@ -0,0 +1,50 @@
+#ifndef AVR_SCHEDULER_H
+#define AVR_SCHEDULER_H
+
+#include "peripheral.h"
+
+#include <vector>
+
+namespace coresim {
+
+// Min-heap of peripheral events keyed on the core cycle counter. The run
+// loop only compares the cycle counter with deadline(); everything else
+// happens in run() once it has been reached.
+class scheduler {
+public:
+	static const uint64_t never = UINT64_MAX;
+
+	scheduler(const uint64_t &clock);
+	scheduler &operator=(const scheduler &s);
+
+	uint64_t now() const { return clock; }
+	uint64_t deadline() const { return next; }
+
+	void at(uint64_t when, peripheral *p, int id);
+	void cancel(peripheral *p);
+	void cancel(peripheral *p, int id);
+	void poke();
+	void run();
+	void clear();
+
+private:
+	struct event {
+		uint64_t when;
+		peripheral *p;
+		int id;
+
+		bool operator<(const event &e) const { return when > e.when; }
+	};
+
+	const uint64_t &clock;
+	uint64_t next;
+	// set by poke(), kept through rescheduling until run() has been through
+	bool poked;
+	std::vector<event> heap;
+
+	void update();
+};
+
+}
+
+#endif
@@ -0,0 +1,192 @@
+#include "system.h"
+
+#include <thread>
+#include <atomic>
+#include <exception>
+#include <stdexcept>
+#include <algorithm>
+
+namespace coresim {
+
+namespace {
+
+// Sense-reversing spin barrier. Quanta are short enough that sleeping in
+// the kernel would cost more than the wait itself. Each thread votes on
+// the way in and all of them get the same answer out, decided by the last
+// one to arrive, so they all stop after the same round.
+class barrier {
+public:
+	explicit barrier(unsigned n) : count(n), waiting(0), generation(0), stopping(false), decided(false) {}
+
+	// whether any thread voted to stop this round
+	bool wait(bool stop) {
+		unsigned g = generation.load(std::memory_order_acquire);
+
+		if (stop) {
+			stopping.store(true, std::memory_order_relaxed);
+		}
+
+		if (waiting.fetch_add(1, std::memory_order_acq_rel) + 1 == count) {
+			decided = stopping.load(std::memory_order_relaxed);
+			stopping.store(false, std::memory_order_relaxed);
+			waiting.store(0, std::memory_order_relaxed);
+			generation.store(g + 1, std::memory_order_release);
+			return decided;
+		}
+
+		for (int spins = 0; generation.load(std::memory_order_acquire) == g; spins++) {
+			if (spins > 1000) {
+				std::this_thread::yield();
+			}
+		}
+
+		// only rewritten once every thread, this one included, is back
+		return decided;
+	}
+
+private:
+	unsigned count;
+	std::atomic<unsigned> waiting;
+	std::atomic<unsigned> generation;
+	std::atomic<bool> stopping;
+	bool decided;
+};
+
+}
+
+avr_system::node::node(vmem &m, vio &i, uint64_t q)
+	: core(m, i), serial(core.serial()), quantum(q), round(0) {
+	serial.connect(this);
+}
+
+// A quantum is at most quantum + a few cycles long and only two of them
+// are ever in flight, so a full line means something is badly wrong.
+void avr_system::node::send(uint64_t when, uint8_t byte) {
+	message m = { when, round, byte };
+
+	for (line *l : out) {
+		if (!l->push(m)) {
+			throw std::runtime_error("Serial line overrun");
+		}
+	}
+}
+
+// Only bytes from earlier quanta: the sender may already be adding to the
+// same queue for this one.
+void avr_system::node::receive() {
+	for (line *l : in) {
+		const message *m;
+
+		while ((m = l->front()) && m->round < round) {
+			serial.deliver(m->when + quantum, m->byte);
+			l->pop();
+		}
+	}
+}
+
+avr_system::avr_system(uint64_t q) : quantum(q), now(0), rounds(0) {
+	if (!quantum) {
+		throw std::runtime_error("Quantum must be at least one cycle");
+	}
+}
+
+avr_system::~avr_system() {
+}
+
+size_t avr_system::add(vmem &m, vio &i) {
+	nodes.emplace_back(new node(m, i, quantum));
+	return nodes.size() - 1;
+}
+
+avr &avr_system::device(size_t n) {
+	return nodes.at(n)->core;
+}
+
+void avr_system::connect(size_t a, size_t b) {
+	node &x = *nodes.at(a);
+	node &y = *nodes.at(b);
+
+	// what a sender can put out in the two quanta a line holds at most
+	size_t frames = 2 * (quantum / usart::min_frame_cycles + 1) + 16;
+
+	for (int k = 0; k < 2; k++) {
+		lines.emplace_back(new line(frames));
+	}
+
+	x.out.push_back(lines[lines.size() - 2].get());
+	y.in.push_back(lines[lines.size() - 2].get());
+	y.out.push_back(lines[lines.size() - 1].get());
+	x.in.push_back(lines[lines.size() - 1].get());
+}
+
+// Every device thread goes through the same quanta and barriers. A device
+// that faults stops its own core but keeps meeting the barrier, so the
+// others see the failure right after it and all stop at the same point.
+// Rounds keep counting across calls: a call whose length isn't a multiple
+// of the quantum ends on a short one, so they can't come from the time.
+// Time only moves over the rounds that finished, the numbers also over a
+// failed one, whose bytes may already be on the lines.
+void avr_system::run(uint64_t n) {
+	uint64_t start = now;
+	uint64_t end = now + n;
+	uint64_t first = rounds;
+
+	barrier sync(nodes.size());
+	std::vector<std::exception_ptr> errors(nodes.size());
+	std::vector<std::thread> threads;
+	uint64_t finished = 0;
+	uint64_t ran = 0;
+
+	for (size_t k = 0; k < nodes.size(); k++) {
+		threads.emplace_back([&, k]() {
+			node &d = *nodes[k];
+
+			uint64_t r = first;
+			uint64_t t = start;
+
+			for (; t < end; t += quantum, r++) {
+				uint64_t stop = std::min(t + quantum, end);
+				bool fault = false;
+
+				try {
+					d.round = r;
+					d.receive();
+
+					if (d.core.cycles < stop) {
+						d.core.run(stop - d.core.cycles);
+					}
+				}
+				catch (...) {
+					errors[k] = std::current_exception();
+					fault = true;
+				}
+
+				if (sync.wait(fault)) {
+					r++;
+					break;
+				}
+			}
+
+			// every thread comes out of the same round
+			if (k == 0) {
+				finished = std::min(t, end) - start;
+				ran = r - first;
+			}
+		});
+	}
+
+	for (auto &t : threads) {
+		t.join();
+	}
+
+	now += finished;
+	rounds += ran;
+
+	for (auto &e : errors) {
+		if (e) {
+			std::rethrow_exception(e);
+		}
+	}
+}
+
+}
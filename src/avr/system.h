@@ -0,0 +1,72 @@
+#ifndef AVR_SYSTEM_H
+#define AVR_SYSTEM_H
+
+#include "avr.h"
+#include "usart.h"
+#include "queue.h"
+
+#include <vector>
+#include <memory>
+
+namespace coresim {
+
+// Several AVR devices on one board, each running on its own host thread.
+// Devices run a quantum of cycles, then wait for each other, so no two are
+// ever more than a quantum apart. Serial lines between their USARTs are
+// lock-free queues; a byte sent during one quantum is picked up by the
+// receiver at the start of the next and arrives exactly one quantum after
+// it was sent, whatever the thread timing was, so runs are reproducible.
+class avr_system {
+public:
+	explicit avr_system(uint64_t quantum);
+	~avr_system();
+
+	// memories and IO stay owned by the caller
+	size_t add(vmem &m, vio &i);
+
+	size_t size() const { return nodes.size(); }
+	avr &device(size_t n);
+
+	// full-duplex line between the USARTs of two devices; a device wired
+	// to several others sends to all of them
+	void connect(size_t a, size_t b);
+
+	void run(uint64_t n);
+
+private:
+	struct message {
+		uint64_t when;
+		uint64_t round;
+		uint8_t byte;
+	};
+
+	typedef spsc_queue<message> line;
+
+	struct node : usart::sink {
+		node(vmem &m, vio &i, uint64_t quantum);
+
+		avr core;
+		usart &serial;
+
+		uint64_t quantum;
+		uint64_t round;
+
+		std::vector<line *> out;
+		std::vector<line *> in;
+
+		void send(uint64_t when, uint8_t byte);
+		void receive();
+	};
+
+	uint64_t quantum;
+	uint64_t now;
+	// quanta run so far, over all run() calls; numbers the messages' rounds
+	uint64_t rounds;
+
+	std::vector<std::unique_ptr<node>> nodes;
+	std::vector<std::unique_ptr<line>> lines;
+};
+
+}
+
+#endif
@@ -0,0 +1,360 @@
+#include "timer.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace coresim {
+
+namespace {
+
+enum {
+	wgm01 = 0x02,
+};
+
+enum {
+	wdp  = 0x07,
+	wde  = 0x08,
+	wdce = 0x10,
+	wdp3 = 0x20,
+	wdie = 0x40,
+	wdif = 0x80,
+};
+
+// 128 kHz watchdog oscillator against a 16 MHz core clock
+const uint64_t wdt_osc_cycles = 125;
+
+const uint64_t never = scheduler::never;
+
+}
+
+// timer/counter
+
+timer8::timer8(scheduler &s, interrupts &i, const layout &l)
+	: sched(s), irq(i), wiring(l) {
+	reset();
+}
+
+// register state only, the scheduler and interrupt lines are copied by
+// their owner
+timer8 &timer8::operator=(const timer8 &t) {
+	std::memcpy(control, t.control, sizeof(control));
+	std::memcpy(compare, t.compare, sizeof(compare));
+	flags = t.flags;
+	mask = t.mask;
+	count = t.count;
+	since = t.since;
+	return *this;
+}
+
+void timer8::reset() {
+	control[0] = control[1] = 0;
+	compare[0] = compare[1] = 0;
+	flags = 0;
+	mask = 0;
+	count = 0;
+	since = sched.now();
+
+	sched.cancel(this);
+}
+
+unsigned timer8::prescale() const {
+	static const unsigned div[8] = { 0, 1, 8, 64, 256, 1024, 0, 0 };
+	return div[control[1] & 0x7];
+}
+
+unsigned timer8::top() const {
+	return (control[0] & wgm01) ? compare[0] : 0xff;
+}
+
+// ticks until the counter next holds value
+uint64_t timer8::until(unsigned value) const {
+	unsigned t = top();
+	unsigned c = count;
+
+	if (c > t) {
+		if (value > c) {
+			return value - c;
+		}
+		if (value > t) {
+			return never;
+		}
+		return 256 - c + value;
+	}
+
+	if (value > t) {
+		return never;
+	}
+	if (value > c) {
+		return value - c;
+	}
+	return t + 1 - c + value;
+}
+
+// ticks until TOV is set, when the counter wraps from MAX
+uint64_t timer8::overflow() const {
+	if (top() == 0xff || count > top()) {
+		return 256 - count;
+	}
+	return never;
+}
+
+// ticks until OCFn is set, one timer clock after the counter matches
+uint64_t timer8::match(int n) const {
+	if (count == compare[n]) {
+		return 1;
+	}
+
+	uint64_t k = until(compare[n]);
+	return (k == never) ? never : k + 1;
+}
+
+// catch up with the cycle counter
+void timer8::sync() {
+	unsigned ps = prescale();
+
+	if (!ps) {
+		since = sched.now();
+		return;
+	}
+
+	uint64_t ticks = (sched.now() - since) / ps;
+	if (!ticks) {
+		return;
+	}
+
+	if (ticks >= overflow()) {
+		flags |= wiring.tov;
+	}
+	if (ticks >= match(0)) {
+		flags |= wiring.ocfa;
+	}
+	if (ticks >= match(1)) {
+		flags |= wiring.ocfb;
+	}
+
+	uint64_t k = ticks;
+	unsigned t = top();
+
+	if (count > t && k < 256u - count) {
+		count += k;
+	}
+	else {
+		if (count > t) {
+			k -= 256 - count;
+			count = 0;
+		}
+		count = (count + k) % (t + 1);
+	}
+
+	since += ticks * ps;
+}
+
+// schedule the next flag that can still change
+void timer8::plan() {
+	unsigned ps = prescale();
+	uint64_t k = never;
+
+	sched.cancel(this);
+
+	if (!ps) {
+		return;
+	}
+
+	if (!(flags & wiring.tov)) {
+		k = std::min(k, overflow());
+	}
+	if (!(flags & wiring.ocfa)) {
+		k = std::min(k, match(0));
+	}
+	if (!(flags & wiring.ocfb)) {
+		k = std::min(k, match(1));
+	}
+
+	if (k != never) {
+		sched.at(since + k * ps, this, 0);
+	}
+}
+
+void timer8::update() {
+	const struct {
+		uint8_t flag;
+		int vector;
+	} lines[] = {
+		{ wiring.tov,  wiring.ovf_vect   },
+		{ wiring.ocfa, wiring.compa_vect },
+		{ wiring.ocfb, wiring.compb_vect },
+	};
+
+	for (auto &l : lines) {
+		if (flags & l.flag) {
+			irq.raise(l.vector, this);
+		}
+		else {
+			irq.clear(l.vector);
+		}
+		irq.enable(l.vector, mask & l.flag);
+	}
+}
+
+uint8_t timer8::read(uint8_t port) {
+	if (port == wiring.tcnt) {
+		sync();
+		return count;
+	}
+	if (port == wiring.tifr) {
+		sync();
+		update();
+		return flags;
+	}
+	if (port == wiring.tccra) {
+		return control[0];
+	}
+	if (port == wiring.tccrb) {
+		return control[1];
+	}
+	if (port == wiring.ocra) {
+		return compare[0];
+	}
+	if (port == wiring.ocrb) {
+		return compare[1];
+	}
+	if (port == wiring.timsk) {
+		return mask;
+	}
+
+	return 0;
+}
+
+void timer8::write(uint8_t port, uint8_t value) {
+	sync();
+
+	if (port == wiring.tccra) {
+		control[0] = value;
+	}
+	else if (port == wiring.tccrb) {
+		control[1] = value;
+		since = sched.now();
+	}
+	else if (port == wiring.tcnt) {
+		count = value;
+		since = sched.now();
+	}
+	else if (port == wiring.ocra) {
+		compare[0] = value;
+	}
+	else if (port == wiring.ocrb) {
+		compare[1] = value;
+	}
+	else if (port == wiring.tifr) {
+		flags &= ~value;
+	}
+	else if (port == wiring.timsk) {
+		mask = value;
+	}
+
+	update();
+	plan();
+}
+
+// the counter moves on every timer clock, the flags only in event()
+bool timer8::stable(uint8_t port) {
+	return port != wiring.tcnt || !prescale();
+}
+
+void timer8::event(int id) {
+	sync();
+	update();
+	plan();
+}
+
+void timer8::acknowledge(int vector) {
+	sync();
+
+	if (vector == wiring.ovf_vect) {
+		flags &= ~wiring.tov;
+	}
+	else if (vector == wiring.compa_vect) {
+		flags &= ~wiring.ocfa;
+	}
+	else if (vector == wiring.compb_vect) {
+		flags &= ~wiring.ocfb;
+	}
+
+	update();
+	plan();
+}
+
+// watchdog
+
+watchdog::watchdog(scheduler &s, interrupts &i, const layout &l)
+	: sched(s), irq(i), wiring(l) {
+	reset();
+}
+
+watchdog &watchdog::operator=(const watchdog &w) {
+	csr = w.csr;
+	expired = w.expired;
+	return *this;
+}
+
+void watchdog::reset() {
+	csr = 0;
+	expired = false;
+
+	sched.cancel(this);
+}
+
+uint64_t watchdog::timeout() const {
+	int prescale = (csr & wdp) | ((csr & wdp3) >> 2);
+	return (2048ull << prescale) * wdt_osc_cycles;
+}
+
+void watchdog::restart() {
+	sched.cancel(this);
+
+	if (csr & (wde | wdie)) {
+		sched.at(sched.now() + timeout(), this, 0);
+	}
+}
+
+uint8_t watchdog::read(uint8_t port) {
+	return csr;
+}
+
+void watchdog::write(uint8_t port, uint8_t value) {
+	uint8_t flag = csr & wdif & ~value;
+
+	csr = (value & ~(wdif | wdce)) | flag;
+
+	if (!(csr & wdif)) {
+		irq.clear(wiring.vect);
+	}
+	irq.enable(wiring.vect, csr & wdie);
+
+	restart();
+}
+
+// interrupt mode raises the vector, reset mode requests a system reset;
+// with both set the first timeout interrupts and the next one resets
+void watchdog::event(int id) {
+	if (csr & wdie) {
+		csr |= wdif;
+		irq.raise(wiring.vect, this);
+	}
+	else if (csr & wde) {
+		expired = true;
+	}
+
+	restart();
+}
+
+void watchdog::acknowledge(int vector) {
+	csr &= ~wdif;
+
+	if (csr & wde) {
+		csr &= ~wdie;
+		irq.enable(wiring.vect, false);
+	}
+}
+
+}
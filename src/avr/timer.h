@@ -0,0 +1,89 @@
+#ifndef AVR_TIMER_H
+#define AVR_TIMER_H
+
+#include "interrupts.h"
+
+namespace coresim {
+
+// 8-bit timer/counter 0, normal and CTC modes; each part supplies its own
+// register layout. The counter is never ticked: TCNT and the flags are
+// derived from the cycle counter when read, and events are only scheduled
+// for flags that are still clear, so a free-running timer costs nothing
+// until someone looks.
+class timer8 : public peripheral {
+public:
+	// where a part maps the timer, its flag bits and its vectors
+	struct layout {
+		uint8_t tifr, tccra, tccrb, tcnt, ocra, ocrb, timsk;
+		uint8_t tov, ocfa, ocfb;
+		int ovf_vect, compa_vect, compb_vect;
+	};
+
+	timer8(scheduler &s, interrupts &i, const layout &l);
+	timer8 &operator=(const timer8 &t);
+
+	uint8_t read(uint8_t port);
+	void write(uint8_t port, uint8_t value);
+	void event(int id);
+	void acknowledge(int vector);
+	void reset();
+	bool stable(uint8_t port);
+
+private:
+	scheduler &sched;
+	interrupts &irq;
+	layout wiring;
+
+	uint8_t control[2];
+	uint8_t compare[2];
+	uint8_t flags;
+	uint8_t mask;
+
+	uint8_t count;
+	uint64_t since;
+
+	unsigned prescale() const;
+	unsigned top() const;
+	uint64_t until(unsigned value) const;
+	uint64_t overflow() const;
+	uint64_t match(int n) const;
+
+	void sync();
+	void plan();
+	void update();
+};
+
+// Watchdog timer. Timeouts are a single scheduled event, pushed back by wdr.
+class watchdog : public peripheral {
+public:
+	struct layout {
+		uint8_t wdtcsr;
+		int vect;
+	};
+
+	watchdog(scheduler &s, interrupts &i, const layout &l);
+	watchdog &operator=(const watchdog &w);
+
+	uint8_t read(uint8_t port);
+	void write(uint8_t port, uint8_t value);
+	void event(int id);
+	void acknowledge(int vector);
+	void reset();
+
+	void restart();
+
+	bool expired;
+
+private:
+	scheduler &sched;
+	interrupts &irq;
+	layout wiring;
+
+	uint8_t csr;
+
+	uint64_t timeout() const;
+};
+
+}
+
+#endif
@@ -0,0 +1,425 @@
+#include "trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+namespace coresim {
+
+namespace {
+
+const char magic[8] = { 'A', 'V', 'R', 'T', 'R', 'A', 'C', 'E' };
+const char footer[8] = { 'A', 'V', 'R', 'T', 'I', 'D', 'X', 0 };
+const uint32_t version = 2;
+
+enum {
+	chunk_data     = 0,
+	chunk_keyframe = 1,
+};
+
+struct chunk_header {
+	uint8_t type;
+	uint8_t pad[3];
+	uint32_t bytes;
+	uint64_t first;
+};
+
+// 8M ring words, 64MB: room for a few keyframes while the writer catches up
+const size_t ring_words = 1 << 23;
+
+// producer is told about progress every this many words
+const size_t release_every = 4096;
+
+const size_t chunk_bytes = 64 << 10;
+
+// keyframe layout: pc, sp, sreg, cycles, then the data space
+const size_t frame_header = 2 + 2 + 1 + 8;
+
+inline uint64_t zigzag(int64_t v) {
+	return (uint64_t)(v << 1) ^ (uint64_t)(v >> 63);
+}
+
+inline int64_t unzigzag(uint64_t v) {
+	return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+}
+
+// writer
+
+tracer::tracer(const std::string &filename, int detail, uint64_t keyframe_every)
+	: what(detail), every(keyframe_every), count(0), last(0), stores(0),
+	  ring(ring_words), head(0), tail(0), stopping(false),
+	  written(0), seen(0), chunk_first(0), expect(0), frame_left(0), entering(false) {
+	file = std::fopen(filename.c_str(), "wb");
+
+	if (!file) {
+		throw std::runtime_error("Can't open " + filename);
+	}
+
+	std::memset(shadow, 0, sizeof(shadow));
+
+	uint32_t d = detail;
+	std::fwrite(magic, 1, sizeof(magic), file);
+	std::fwrite(&version, 4, 1, file);
+	std::fwrite(&d, 4, 1, file);
+	written = sizeof(magic) + 8;
+
+	writer = std::thread(&tracer::drain, this);
+}
+
+tracer::~tracer() {
+	stopping.store(true, std::memory_order_release);
+	writer.join();
+
+	flush();
+
+	uint64_t n = index.size();
+
+	for (auto &e : index) {
+		std::fwrite(&e.first, 8, 1, file);
+		std::fwrite(&e.second, 8, 1, file);
+	}
+	std::fwrite(&n, 8, 1, file);
+	std::fwrite(&count, 8, 1, file);
+	std::fwrite(footer, 1, sizeof(footer), file);
+
+	std::fclose(file);
+}
+
+void tracer::diff(const uint8_t *r, uint8_t sreg, uint16_t sp) {
+	uint8_t now[shadow_size];
+
+	std::memcpy(now, r, 32);
+	now[32] = sreg;
+	now[33] = sp & 0xff;
+	now[34] = sp >> 8;
+
+	if (!std::memcmp(now, shadow, shadow_size)) {
+		return;
+	}
+
+	for (int k = 0; k < shadow_size; k++) {
+		if (now[k] != shadow[k]) {
+			push(tag_reg | (uint64_t)k << 8 | now[k]);
+			shadow[k] = now[k];
+		}
+	}
+}
+
+// Keyframes reset the register shadow, so the deltas that follow are
+// relative to the frame.
+void tracer::keyframe(uint16_t pc, uint16_t sp, uint8_t sreg, uint64_t cycles,
+                      const uint8_t *data, size_t size) {
+	uint8_t hdr[frame_header];
+	size_t bytes = frame_header + size;
+
+	std::memcpy(hdr, &pc, 2);
+	std::memcpy(hdr + 2, &sp, 2);
+	hdr[4] = sreg;
+	std::memcpy(hdr + 5, &cycles, 8);
+
+	push(tag_keyframe | bytes);
+	last = cycles;
+
+	for (size_t off = 0; off < bytes; off += 8) {
+		uint8_t w[8] = { 0 };
+
+		for (size_t k = 0; k < 8 && off + k < bytes; k++) {
+			size_t at = off + k;
+			w[k] = at < frame_header ? hdr[at] : data[at - frame_header];
+		}
+
+		uint64_t v;
+		std::memcpy(&v, w, 8);
+		push(v);
+	}
+
+	std::memcpy(shadow, data, 32);
+	shadow[32] = sreg;
+	shadow[33] = sp & 0xff;
+	shadow[34] = sp >> 8;
+}
+
+void tracer::drain() {
+	const size_t mask = ring.size() - 1;
+
+	for (;;) {
+		size_t t = tail.load(std::memory_order_relaxed);
+		size_t h = head.load(std::memory_order_acquire);
+
+		if (t == h) {
+			if (stopping.load(std::memory_order_acquire) &&
+			    head.load(std::memory_order_acquire) == t) {
+				return;
+			}
+			std::this_thread::sleep_for(std::chrono::microseconds(50));
+			continue;
+		}
+
+		while (t != h) {
+			consume(ring[t & mask]);
+			t++;
+
+			if ((t & (release_every - 1)) == 0) {
+				tail.store(t, std::memory_order_release);
+			}
+		}
+
+		tail.store(t, std::memory_order_release);
+	}
+}
+
+void tracer::varint(uint64_t v) {
+	while (v >= 0x80) {
+		chunk.push_back(v | 0x80);
+		v >>= 7;
+	}
+	chunk.push_back(v);
+}
+
+// Data chunk payload: varint start pc, then
+//   instruction: varint(zigzag(pc - expected) << 3 | c << 1 | 0), with c
+//                cycles - 1 or 3 followed by varint(cycles)
+//   delta:       varint(target << 1 | 1) then the value byte, where target
+//                is reg << 1 or addr << 1 | 1
+//   interrupt:   varint(entry << 2 | 1) then varint(cycles), followed by
+//                the deltas of the entry
+// Every chunk starts from scratch so it decodes on its own.
+void tracer::consume(uint64_t w) {
+	if (entering) {
+		varint(w);
+		entering = false;
+		return;
+	}
+
+	if (frame_left) {
+		for (int k = 0; k < 8 && frame_left; k++, frame_left--) {
+			frame.push_back(w >> (8 * k));
+		}
+
+		if (!frame_left) {
+			flush();
+			std::memcpy(&expect, frame.data(), 2);
+			index.push_back(std::make_pair(seen, written));
+			emit(chunk_keyframe, seen, frame);
+		}
+		return;
+	}
+
+	switch (w & (3ull << 62)) {
+		case tag_insn: {
+			uint16_t pc = w >> 46;
+			uint64_t cycles = w & cycles_mask;
+			uint64_t c = (cycles >= 1 && cycles <= 3) ? cycles - 1 : 3;
+
+			if (chunk.size() >= chunk_bytes) {
+				flush();
+			}
+			begin();
+
+			varint(zigzag((int16_t)(pc - expect)) << 3 | c << 1);
+			if (c == 3) {
+				varint(cycles);
+			}
+
+			expect = pc + 1;
+			seen++;
+			break;
+		}
+
+		case tag_reg:
+		case tag_mem: {
+			uint64_t target = (w >> 8) & 0xffff;
+			bool mem = (w & (3ull << 62)) == tag_mem;
+
+			begin();
+
+			varint((target << 1 | mem) << 1 | 1);
+
+			// the cycles come in the next word
+			if (!mem && target == entry) {
+				entering = true;
+				break;
+			}
+			chunk.push_back(w & 0xff);
+			break;
+		}
+
+		case tag_keyframe:
+			frame.clear();
+			frame_left = w & cycles_mask;
+			break;
+	}
+}
+
+void tracer::begin() {
+	if (chunk.empty()) {
+		chunk_first = seen;
+		varint(expect);
+	}
+}
+
+void tracer::flush() {
+	if (chunk.empty()) {
+		return;
+	}
+
+	emit(chunk_data, chunk_first, chunk);
+	chunk.clear();
+}
+
+void tracer::emit(uint8_t type, uint64_t first, const std::vector<uint8_t> &payload) {
+	chunk_header h;
+
+	std::memset(&h, 0, sizeof(h));
+	h.type = type;
+	h.bytes = payload.size();
+	h.first = first;
+
+	std::fwrite(&h, sizeof(h), 1, file);
+	std::fwrite(payload.data(), 1, payload.size(), file);
+	written += sizeof(h) + payload.size();
+}
+
+// reader
+
+trace_reader::trace_reader(const std::string &filename) : total(0) {
+	file = std::fopen(filename.c_str(), "rb");
+
+	if (!file) {
+		throw std::runtime_error("Can't open " + filename);
+	}
+
+	char tag[8];
+	uint64_t n;
+
+	if (std::fseek(file, -24, SEEK_END) ||
+	    std::fread(&n, 8, 1, file) != 1 ||
+	    std::fread(&total, 8, 1, file) != 1 ||
+	    std::fread(tag, 1, 8, file) != 8 ||
+	    std::memcmp(tag, footer, 8)) {
+		throw std::runtime_error("Not a trace, or an unfinished one: " + filename);
+	}
+
+	index.resize(n);
+	std::fseek(file, -24 - (long)(16 * n), SEEK_END);
+
+	for (auto &e : index) {
+		if (std::fread(&e.first, 8, 1, file) != 1 ||
+		    std::fread(&e.second, 8, 1, file) != 1) {
+			throw std::runtime_error("Truncated trace index");
+		}
+	}
+}
+
+trace_reader::~trace_reader() {
+	std::fclose(file);
+}
+
+trace_reader::state trace_reader::seek(uint64_t n) {
+	auto k = std::upper_bound(index.begin(), index.end(), n,
+		[](uint64_t v, const std::pair<uint64_t, uint64_t> &e) { return v < e.first; });
+
+	if (k == index.begin()) {
+		throw std::runtime_error("No keyframe before instruction");
+	}
+	--k;
+
+	state s;
+	chunk_header h;
+	std::vector<uint8_t> payload;
+	uint64_t at = k->first;
+
+	std::fseek(file, k->second, SEEK_SET);
+
+	while (std::fread(&h, sizeof(h), 1, file) == 1) {
+		payload.resize(h.bytes);
+		if (std::fread(payload.data(), 1, h.bytes, file) != h.bytes) {
+			break;
+		}
+
+		if (h.type == chunk_keyframe) {
+			if (h.first > n) {
+				break;
+			}
+
+			std::memcpy(&s.pc, &payload[0], 2);
+			std::memcpy(&s.sp, &payload[2], 2);
+			s.sreg = payload[4];
+			std::memcpy(&s.cycles, &payload[5], 8);
+			s.data.assign(payload.begin() + frame_header, payload.end());
+			at = h.first;
+			continue;
+		}
+
+		size_t p = 0;
+		auto next = [&]() {
+			uint64_t v = 0;
+			for (int sh = 0; ; sh += 7) {
+				uint8_t b = payload[p++];
+				v |= (uint64_t)(b & 0x7f) << sh;
+				if (!(b & 0x80)) {
+					return v;
+				}
+			}
+		};
+
+		uint16_t expect = next();
+
+		while (p < payload.size()) {
+			uint64_t v = next();
+
+			if (v & 1) {
+				uint64_t target = v >> 2;
+
+				if (!(v & 2) && target == tracer::entry) {
+					s.cycles += next();
+					continue;
+				}
+
+				uint8_t value = payload[p++];
+
+				if (v & 2) {
+					s.data[target] = value;
+				}
+				else if (target < 32) {
+					s.data[target] = value;
+				}
+				else if (target == 32) {
+					s.sreg = value;
+				}
+				else if (target == 33) {
+					s.sp = (s.sp & 0xff00) | value;
+				}
+				else {
+					s.sp = (s.sp & 0x00ff) | value << 8;
+				}
+				continue;
+			}
+
+			uint64_t c = (v >> 1) & 3;
+			uint16_t pc = expect + unzigzag(v >> 3);
+
+			// the deltas of instruction n - 1 follow its record, so stop
+			// at the record of instruction n
+			if (at == n) {
+				s.pc = pc;
+				return s;
+			}
+
+			s.cycles += (c == 3) ? next() : c + 1;
+			expect = pc + 1;
+			at++;
+		}
+	}
+
+	if (at != n) {
+		throw std::runtime_error("Instruction past the end of the trace");
+	}
+
+	return s;
+}
+
+}
@@ -0,0 +1,178 @@
+#ifndef AVR_TRACE_H
+#define AVR_TRACE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <cstdio>
+
+namespace coresim {
+
+// Binary execution trace. The core pushes fixed-size raw records into a
+// single-producer ring; a writer thread packs them (PC deltas, varints)
+// into chunks and streams them to disk. Interrupt entries get records of
+// their own between those of two instructions. Full-state keyframes go out
+// every so many instructions and are listed in an index at the end of the
+// file, so a reader can seek to any instruction from the nearest keyframe.
+//
+// File layout:
+//   "AVRTRACE" u32 version u32 detail
+//   chunks: u8 type, u8[3], u32 bytes, u64 first instruction, payload
+//   index:  { u64 instruction, u64 offset } per keyframe
+//   u64 keyframes, u64 instructions, "AVRTIDX\0"
+class tracer {
+public:
+	enum {
+		regs   = 0x1,   // register, SREG and SP deltas
+		memory = 0x2,   // data space stores
+	};
+
+	// register deltas cover r0-r31, then SREG, SPL and SPH; the target
+	// after them marks an interrupt entry
+	enum {
+		shadow_size = 35,
+		entry = shadow_size,
+	};
+
+	tracer(const std::string &filename, int detail, uint64_t keyframe_every);
+	~tracer();
+
+	int detail() const { return what; }
+
+	// one executed instruction, with the register file after it; the
+	// cycles it is charged include any sleep before it
+	void step(uint16_t pc, uint64_t now, const uint8_t *r, uint8_t sreg, uint16_t sp) {
+		push(tag_insn | (uint64_t)pc << 46 | ((now - last) & cycles_mask));
+		last = now;
+		deltas(r, sreg, sp);
+
+		count++;
+	}
+
+	// an interrupt entry, with the register file after it: its cycles,
+	// those of a sleep it ended included, and the return address pushed
+	// belong to neither instruction around it
+	void enter(uint64_t now, const uint8_t *r, uint8_t sreg, uint16_t sp) {
+		push(tag_reg | (uint64_t)entry << 8);
+		push(now - last);
+		last = now;
+		deltas(r, sreg, sp);
+	}
+
+	void store(uint16_t addr, uint8_t value) {
+		uint64_t w = tag_mem | (uint64_t)addr << 8 | value;
+
+		if (stores < max_pending) {
+			pending[stores++] = w;
+		}
+		else {
+			push(w);
+		}
+	}
+
+	bool due() const { return count % every == 0; }
+
+	void keyframe(uint16_t pc, uint16_t sp, uint8_t sreg, uint64_t cycles,
+	              const uint8_t *data, size_t size);
+
+private:
+	enum : uint64_t {
+		tag_insn     = 0ull << 62,
+		tag_reg      = 1ull << 62,
+		tag_mem      = 2ull << 62,
+		tag_keyframe = 3ull << 62,
+		cycles_mask  = (1ull << 46) - 1,
+	};
+
+	enum {
+		max_pending = 16,
+	};
+
+	int what;
+	uint64_t every;
+	uint64_t count;
+	uint64_t last;
+
+	uint8_t shadow[shadow_size];
+	uint64_t pending[max_pending];
+	unsigned stores;
+
+	std::vector<uint64_t> ring;
+	std::atomic<size_t> head;
+	std::atomic<size_t> tail;
+	std::atomic<bool> stopping;
+	std::thread writer;
+
+	void push(uint64_t w) {
+		size_t h = head.load(std::memory_order_relaxed);
+
+		while (h - tail.load(std::memory_order_acquire) == ring.size()) {
+			std::this_thread::yield();
+		}
+
+		ring[h & (ring.size() - 1)] = w;
+		head.store(h + 1, std::memory_order_release);
+	}
+
+	void deltas(const uint8_t *r, uint8_t sreg, uint16_t sp) {
+		if (what & regs) {
+			diff(r, sreg, sp);
+		}
+		for (unsigned n = 0; n < stores; n++) {
+			push(pending[n]);
+		}
+		stores = 0;
+	}
+
+	void diff(const uint8_t *r, uint8_t sreg, uint16_t sp);
+
+	// writer thread side
+	FILE *file;
+	uint64_t written;
+	std::vector<uint8_t> chunk;
+	uint64_t seen;
+	uint64_t chunk_first;
+	uint16_t expect;
+	std::vector<uint8_t> frame;
+	size_t frame_left;
+	bool entering;
+	std::vector<std::pair<uint64_t, uint64_t>> index;
+
+	void drain();
+	void consume(uint64_t w);
+	void begin();
+	void flush();
+	void emit(uint8_t type, uint64_t first, const std::vector<uint8_t> &payload);
+	void varint(uint64_t v);
+};
+
+// Reads a trace back. With both detail bits set, seek() rebuilds the exact
+// machine state in front of any instruction: it loads the closest keyframe
+// from the index and replays the deltas of at most one keyframe interval.
+class trace_reader {
+public:
+	struct state {
+		uint16_t pc;
+		uint16_t sp;
+		uint8_t sreg;
+		uint64_t cycles;
+		std::vector<uint8_t> data;
+	};
+
+	trace_reader(const std::string &filename);
+	~trace_reader();
+
+	uint64_t size() const { return total; }
+	state seek(uint64_t n);
+
+private:
+	FILE *file;
+	uint64_t total;
+	std::vector<std::pair<uint64_t, uint64_t>> index;
+};
+
+}
+
+#endif
@@ -0,0 +1,304 @@
+#include "usart.h"
+
+#include <algorithm>
+
+namespace coresim {
+
+namespace {
+
+// UCSR0A
+enum {
+	mpcm = 0x01,
+	u2x  = 0x02,
+	dor  = 0x08,
+	fe   = 0x10,
+	udre = 0x20,
+	txc  = 0x40,
+	rxc  = 0x80,
+};
+
+// UCSR0B
+enum {
+	ucsz2 = 0x04,
+	txen  = 0x08,
+	rxen  = 0x10,
+	udrie = 0x20,
+	txcie = 0x40,
+	rxcie = 0x80,
+};
+
+// UCSR0C
+enum {
+	usbs = 0x08,
+	upm  = 0x30,
+};
+
+// event ids
+enum {
+	arrival,
+	transmitted,
+	host,
+};
+
+}
+
+usart::usart(scheduler &s, interrupts &i, const layout &l)
+	: sched(s), irq(i), wiring(l), out(nullptr), in(nullptr) {
+	reset();
+}
+
+// register state and bytes in flight; the sink and source stay
+usart &usart::operator=(const usart &u) {
+	status = u.status;
+	control = u.control;
+	frame = u.frame;
+	baud[0] = u.baud[0];
+	baud[1] = u.baud[1];
+	fifo[0] = u.fifo[0];
+	fifo[1] = u.fifo[1];
+	received = u.received;
+	shifting = u.shifting;
+	shift = u.shift;
+	buffer = u.buffer;
+	listening = u.listening;
+	arriving = u.arriving;
+	return *this;
+}
+
+void usart::reset() {
+	status = udre;
+	control = 0;
+	frame = 0x06;
+	baud[0] = baud[1] = 0;
+	received = 0;
+	shifting = false;
+	listening = false;
+	arriving.clear();
+
+	sched.cancel(this);
+	for (int vector : { wiring.rx_vect, wiring.udre_vect, wiring.tx_vect }) {
+		irq.clear(vector);
+		irq.enable(vector, false);
+	}
+}
+
+void usart::connect(source *s) {
+	in = s;
+	listen();
+}
+
+// start bit, data, parity and stop bits at 16 or 8 clocks per bit
+uint64_t usart::frame_cycles() const {
+	unsigned bits = 5 + ((frame >> 1) & 3);
+
+	if (bits == 8 && (control & ucsz2)) {
+		bits = 9;
+	}
+	bits += 1 + ((frame & upm) != 0) + ((frame & usbs) ? 2 : 1);
+
+	uint64_t rate = (uint64_t)(baud[1] << 8 | baud[0]) + 1;
+
+	return bits * rate * ((status & u2x) ? 8 : 16);
+}
+
+// the host source is only polled while the receiver is on
+void usart::listen() {
+	bool want = in && (control & rxen);
+
+	if (want && !listening) {
+		sched.at(sched.now() + frame_cycles(), this, host);
+	}
+	else if (!want && listening) {
+		sched.cancel(this, host);
+	}
+
+	listening = want;
+}
+
+// All three interrupts are level triggered: they stay pending for as long
+// as their flag is set.
+void usart::update() {
+	const struct {
+		uint8_t flag;
+		uint8_t enable;
+		int vector;
+	} lines[] = {
+		{ rxc,  rxcie, wiring.rx_vect   },
+		{ udre, udrie, wiring.udre_vect },
+		{ txc,  txcie, wiring.tx_vect   },
+	};
+
+	for (auto &l : lines) {
+		if (status & l.flag) {
+			irq.raise(l.vector, this);
+		}
+		else {
+			irq.clear(l.vector);
+		}
+		irq.enable(l.vector, control & l.enable);
+	}
+}
+
+// Arrivals from several senders can come out of order, keep them sorted
+// and the next one scheduled.
+void usart::deliver(uint64_t when, uint8_t byte) {
+	auto at = std::upper_bound(arriving.begin(), arriving.end(), std::make_pair(when, byte),
+		[](const std::pair<uint64_t, uint8_t> &a, const std::pair<uint64_t, uint8_t> &b) {
+			return a.first < b.first;
+		});
+
+	bool first = at == arriving.begin();
+
+	arriving.insert(at, std::make_pair(when, byte));
+
+	if (first) {
+		sched.cancel(this, arrival);
+		sched.at(std::max(when, sched.now()), this, arrival);
+	}
+}
+
+void usart::take(uint8_t byte) {
+	if (control & rxen) {
+		if (received < 2) {
+			fifo[received++] = byte;
+		}
+		else {
+			status |= dor;
+		}
+		status |= rxc;
+		update();
+	}
+}
+
+void usart::event(int id) {
+	switch (id) {
+		case arrival: {
+			uint8_t byte = arriving.front().second;
+
+			arriving.pop_front();
+			take(byte);
+
+			if (!arriving.empty()) {
+				sched.at(std::max(arriving.front().first, sched.now()), this, arrival);
+			}
+			break;
+		}
+
+		// the buffered byte, if any, follows straight away
+		case transmitted:
+			if (out) {
+				out->send(sched.now(), shift);
+			}
+
+			if (!(status & udre)) {
+				shift = buffer;
+				status |= udre;
+				sched.at(sched.now() + frame_cycles(), this, transmitted);
+			}
+			else {
+				shifting = false;
+				status |= txc;
+			}
+			update();
+			break;
+
+		// A host has no notion of overrun, so it holds its next byte back
+		// while the FIFO is full, as flow control would.
+		case host:
+			if (received < 2) {
+				int byte = in->receive();
+
+				if (byte == source::closed) {
+					listening = false;
+					return;
+				}
+				if (byte >= 0) {
+					take(byte);
+				}
+			}
+			sched.at(sched.now() + frame_cycles(), this, host);
+			break;
+	}
+}
+
+void usart::acknowledge(int vector) {
+	if (vector == wiring.tx_vect) {
+		status &= ~txc;
+	}
+
+	update();
+}
+
+uint8_t usart::read(uint8_t port) {
+	if (port == wiring.ucsra) {
+		return status;
+	}
+	if (port == wiring.ucsrb) {
+		return control;
+	}
+	if (port == wiring.ucsrc) {
+		return frame;
+	}
+	if (port == wiring.ubrrl) {
+		return baud[0];
+	}
+	if (port == wiring.ubrrh) {
+		return baud[1];
+	}
+	if (port == wiring.udr) {
+		uint8_t byte = fifo[0];
+
+		if (received) {
+			fifo[0] = fifo[1];
+			received--;
+		}
+		if (!received) {
+			status &= ~(rxc | dor | fe);
+		}
+
+		update();
+		return byte;
+	}
+
+	return 0;
+}
+
+void usart::write(uint8_t port, uint8_t value) {
+	if (port == wiring.ucsra) {
+		// TXC is cleared by writing a one to it
+		status = (status & ~(u2x | mpcm)) | (value & (u2x | mpcm));
+		status &= ~(value & txc);
+	}
+	else if (port == wiring.ucsrb) {
+		control = value;
+		listen();
+	}
+	else if (port == wiring.ucsrc) {
+		frame = value;
+	}
+	else if (port == wiring.ubrrl) {
+		baud[0] = value;
+	}
+	else if (port == wiring.ubrrh) {
+		baud[1] = value & 0x0f;
+	}
+	else if (port == wiring.udr) {
+		if (!(control & txen)) {
+			return;
+		}
+		if (!shifting) {
+			shift = value;
+			shifting = true;
+			sched.at(sched.now() + frame_cycles(), this, transmitted);
+		}
+		else if (status & udre) {
+			buffer = value;
+			status &= ~udre;
+		}
+		// with both full the byte is lost, as on hardware
+	}
+
+	update();
+}
+
+}
@@ -0,0 +1,97 @@
+#ifndef AVR_USART_H
+#define AVR_USART_H
+
+#include "interrupts.h"
+
+#include <deque>
+#include <utility>
+
+namespace coresim {
+
+// USART0 as seen by firmware; each part supplies its own register layout.
+// Line timing is kept per frame, not per bit:
+// a byte written to UDR moves to the shift register and leaves through the
+// sink one frame time later, with the data register as a one byte buffer
+// behind it. Received bytes are queued with the cycle they arrive at and
+// land in the two-level receive FIFO then; a host source is read at most
+// once per frame time, like a sender running at the configured baud rate.
+class usart : public peripheral {
+public:
+	// where a part maps the USART and its vectors
+	struct layout {
+		uint8_t ucsra, ucsrb, ucsrc, ubrrl, ubrrh, udr;
+		int rx_vect, udre_vect, tx_vect;
+	};
+
+	// the shortest frame on the line: start, five data and one stop bit
+	// at UBRR 0 with double speed
+	enum {
+		min_frame_cycles = 7 * 8,
+	};
+
+	// where transmitted bytes go, stamped with the cycle they left at
+	class sink {
+	public:
+		virtual ~sink() {}
+		virtual void send(uint64_t when, uint8_t byte) = 0;
+	};
+
+	// where received bytes come from when not delivered by another device
+	class source {
+	public:
+		enum {
+			none   = -1,   // nothing waiting yet
+			closed = -2,   // nothing ever again
+		};
+
+		virtual ~source() {}
+		virtual int receive() = 0;
+	};
+
+	usart(scheduler &s, interrupts &i, const layout &l);
+	usart &operator=(const usart &u);
+
+	void connect(sink *s) { out = s; }
+	void connect(source *s);
+
+	// a byte showing up at cycle when, or right away if that has passed
+	void deliver(uint64_t when, uint8_t byte);
+
+	uint8_t read(uint8_t port);
+	void write(uint8_t port, uint8_t value);
+	void event(int id);
+	void acknowledge(int vector);
+	void reset();
+
+private:
+	scheduler &sched;
+	interrupts &irq;
+	layout wiring;
+	sink *out;
+	source *in;
+
+	uint8_t status;
+	uint8_t control;
+	uint8_t frame;
+	uint8_t baud[2];
+
+	uint8_t fifo[2];
+	int received;
+
+	bool shifting;
+	uint8_t shift;
+	uint8_t buffer;
+
+	bool listening;
+
+	std::deque<std::pair<uint64_t, uint8_t>> arriving;
+
+	uint64_t frame_cycles() const;
+	void take(uint8_t byte);
+	void listen();
+	void update();
+};
+
+}
+
+#endif
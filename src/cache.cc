@@ -0,0 +1,276 @@
+/**
+ * Copyright (c) 2014, Floris Chabert. All rights reserved.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "cache.h"
+#include "memory.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+namespace insn {
+
+namespace {
+
+const char magic[8] = { 'i', 'n', 's', 'n', 'c', 'a', 'c', 'h' };
+
+// bumped whenever a table's layout or what goes in it changes
+const uint32_t version = 1;
+
+struct cache_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t tables;
+	uint64_t hash;
+	uint64_t size;
+	uint64_t page_size;
+};
+
+struct cache_table {
+	uint32_t kind;
+	uint32_t reserved;
+	uint64_t offset;
+	uint64_t size;
+};
+
+const uint64_t P1 = 0x9e3779b185ebca87ull;
+const uint64_t P2 = 0xc2b2ae3d27d4eb4full;
+const uint64_t P3 = 0x165667b19e3779f9ull;
+const uint64_t P4 = 0x85ebca77c2b2ae63ull;
+const uint64_t P5 = 0x27d4eb2f165667c5ull;
+
+inline uint64_t rotl(uint64_t x, int r) {
+	return (x << r) | (x >> (64 - r));
+}
+
+inline uint64_t read64(const uint8_t *p) {
+	uint64_t v;
+	std::memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+inline uint64_t lane(uint64_t acc, uint64_t input) {
+	return rotl(acc + input * P2, 31) * P1;
+}
+
+inline uint64_t merge(uint64_t acc, uint64_t v) {
+	return (acc ^ lane(0, v)) * P1 + P4;
+}
+
+// Creates every missing directory on the way to path's parent.
+void make_parents(const std::string &path) {
+	for (size_t slash = path.find('/', 1); slash != std::string::npos; slash = path.find('/', slash + 1)) {
+		if (mkdir(path.substr(0, slash).c_str(), 0755) < 0 && errno != EEXIST) {
+			return;
+		}
+	}
+}
+
+}
+
+// Four lanes over 32-byte stripes, the tail eight, four and one byte at
+// a time.
+uint64_t content_hash(const void *data, size_t size, uint64_t seed) {
+	const uint8_t *p = (const uint8_t *)data;
+	const uint8_t *end = p + size;
+	uint64_t h;
+
+	if (size >= 32) {
+		uint64_t v1 = seed + P1 + P2;
+		uint64_t v2 = seed + P2;
+		uint64_t v3 = seed;
+		uint64_t v4 = seed - P1;
+
+		for (; end - p >= 32; p += 32) {
+			v1 = lane(v1, read64(p));
+			v2 = lane(v2, read64(p + 8));
+			v3 = lane(v3, read64(p + 16));
+			v4 = lane(v4, read64(p + 24));
+		}
+
+		h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+		h = merge(h, v1);
+		h = merge(h, v2);
+		h = merge(h, v3);
+		h = merge(h, v4);
+	}
+	else {
+		h = seed + P5;
+	}
+
+	h += size;
+
+	for (; end - p >= 8; p += 8) {
+		h = rotl(h ^ lane(0, read64(p)), 27) * P1 + P4;
+	}
+	if (end - p >= 4) {
+		uint32_t w;
+		std::memcpy(&w, p, sizeof(w));
+		h = rotl(h ^ (w * P1), 23) * P2 + P3;
+		p += 4;
+	}
+	for (; p < end; p++) {
+		h = rotl(h ^ (*p * P5), 11) * P1;
+	}
+
+	h ^= h >> 33;
+	h *= P2;
+	h ^= h >> 29;
+	h *= P3;
+	h ^= h >> 32;
+	return h;
+}
+
+std::string cache_path(const std::string &dir, uint64_t hash) {
+	char name[32];
+	std::snprintf(name, sizeof(name), "%016llx.cache", (unsigned long long)hash);
+	return dir + "/" + name;
+}
+
+cache_file::cache_file(std::shared_ptr<mapped_file> image_) : image(std::move(image_)) {
+}
+
+// Anything unexpected makes it a miss rather than an error: the cache is
+// only ever a shortcut.
+std::shared_ptr<cache_file> cache_file::open(const std::string &path, uint64_t hash, uint64_t size) {
+	std::shared_ptr<mapped_file> image;
+
+	if (access(path.c_str(), R_OK) < 0) {
+		return nullptr;
+	}
+	try {
+		image = std::make_shared<mapped_file>(path);
+	}
+	catch (std::exception &) {
+		return nullptr;
+	}
+
+	if (image->size < sizeof(cache_header)) {
+		return nullptr;
+	}
+
+	const cache_header *header = (const cache_header *)image->data;
+
+	if (std::memcmp(header->magic, magic, sizeof(magic)) || header->version != version ||
+	    header->hash != hash || header->size != size || header->page_size != memory::page_size()) {
+		return nullptr;
+	}
+	if (header->tables > (image->size - sizeof(cache_header)) / sizeof(cache_table)) {
+		return nullptr;
+	}
+
+	const cache_table *t = (const cache_table *)(header + 1);
+
+	for (uint32_t i = 0; i < header->tables; i++) {
+		if (t[i].offset > image->size || t[i].size > image->size - t[i].offset || (t[i].offset & 7)) {
+			return nullptr;
+		}
+	}
+
+	return std::shared_ptr<cache_file>(new cache_file(std::move(image)));
+}
+
+const uint8_t *cache_file::find(kind k, uint64_t &size) const {
+	const cache_header *header = (const cache_header *)image->data;
+	const cache_table *t = (const cache_table *)(header + 1);
+
+	for (uint32_t i = 0; i < header->tables; i++) {
+		if (t[i].kind == (uint32_t)k) {
+			size = t[i].size;
+			return image->data + t[i].offset;
+		}
+	}
+	return nullptr;
+}
+
+uint64_t cache_file::offset(kind k) const {
+	uint64_t size;
+	return find(k, size) - image->data;
+}
+
+void cache_writer::add(cache_file::kind k, const void *data, size_t size, size_t align) {
+	entry e = { k, std::max<size_t>(align, 8), std::vector<uint8_t>((const uint8_t *)data, (const uint8_t *)data + size) };
+	entries.push_back(std::move(e));
+}
+
+void cache_writer::write(const std::string &path, uint64_t hash, uint64_t size) {
+	cache_header header;
+	std::vector<cache_table> tables;
+	uint64_t at = sizeof(header) + entries.size() * sizeof(cache_table);
+
+	std::memcpy(header.magic, magic, sizeof(magic));
+	header.version = version;
+	header.tables = entries.size();
+	header.hash = hash;
+	header.size = size;
+	header.page_size = memory::page_size();
+
+	for (auto &e : entries) {
+		at = (at + e.align - 1) & ~(uint64_t)(e.align - 1);
+		tables.push_back({ (uint32_t)e.k, 0, at, e.bytes.size() });
+		at += e.bytes.size();
+	}
+
+	std::vector<uint8_t> out(at);
+	std::memcpy(out.data(), &header, sizeof(header));
+	std::memcpy(out.data() + sizeof(header), tables.data(), tables.size() * sizeof(cache_table));
+	for (size_t i = 0; i < entries.size(); i++) {
+		std::memcpy(out.data() + tables[i].offset, entries[i].bytes.data(), entries[i].bytes.size());
+	}
+
+	make_parents(path);
+
+	std::string temp = path + "." + std::to_string(getpid()) + ".tmp";
+	int fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+	if (fd < 0) {
+		throw std::runtime_error("Can't create '" + temp + "'.");
+	}
+
+	size_t done = 0;
+	while (done < out.size()) {
+		ssize_t n = ::write(fd, out.data() + done, out.size() - done);
+
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			close(fd);
+			unlink(temp.c_str());
+			throw std::runtime_error("Can't write '" + temp + "'.");
+		}
+		done += n;
+	}
+
+	close(fd);
+
+	if (rename(temp.c_str(), path.c_str()) < 0) {
+		unlink(temp.c_str());
+		throw std::runtime_error("Can't write '" + path + "'.");
+	}
+}
+
+}
@@ -0,0 +1,118 @@
+/**
+ * Copyright (c) 2014, Floris Chabert. All rights reserved.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef CACHE_H__
+#define CACHE_H__
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "loader.h"
+
+namespace insn {
+
+// XXH64 of size bytes at data.
+uint64_t content_hash(const void *data, size_t size, uint64_t seed = 0);
+
+// Where the cache for contents with this hash lives under dir.
+std::string cache_path(const std::string &dir, uint64_t hash);
+
+// A load cache file: a header naming the contents it was made from, then
+// flat tables of plain structs used straight from the mapping. Each table
+// is aligned for its type, page data to the page so that it can be mapped
+// into guest memory from the file.
+class cache_file {
+public:
+	enum kind {
+		state,
+		strings,
+		sections,
+		symbols,
+		symbol_tree,
+		symbol_rank,
+		symbol_buckets,
+		functions,
+		loadables,
+		fixups,
+		page_index,
+		pages,
+	};
+
+	// nullptr unless path holds a well formed cache for contents with this
+	// hash and size, made with this build and page size
+	static std::shared_ptr<cache_file> open(const std::string &path, uint64_t hash, uint64_t size);
+
+	// count Ts in the table, nullptr if there is no such table or it isn't
+	// a whole number of them
+	template <typename T>
+	const T *table(kind k, uint64_t &count) const {
+		const uint8_t *p = find(k, count);
+
+		if (!p || count % sizeof(T)) {
+			return nullptr;
+		}
+		count /= sizeof(T);
+		return (const T *)p;
+	}
+
+	// where a table starts in the file
+	uint64_t offset(kind k) const;
+
+	int fd() const { return image->fd; }
+
+private:
+	explicit cache_file(std::shared_ptr<mapped_file> image);
+
+	std::shared_ptr<mapped_file> image;
+
+	const uint8_t *find(kind k, uint64_t &size) const;
+};
+
+// Builds a cache file table by table and puts it in place in one rename,
+// so that concurrent runs never see half of one.
+class cache_writer {
+public:
+	template <typename T>
+	void table(cache_file::kind k, const T *data, size_t count, size_t align = alignof(T)) {
+		add(k, data, count * sizeof(T), align);
+	}
+
+	void write(const std::string &path, uint64_t hash, uint64_t size);
+
+private:
+	struct entry {
+		cache_file::kind k;
+		size_t align;
+		std::vector<uint8_t> bytes;
+	};
+
+	std::vector<entry> entries;
+
+	void add(cache_file::kind k, const void *data, size_t size, size_t align);
+};
+
+}
+
+#endif
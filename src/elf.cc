@@ -21,9 +21,12 @@
  */
 
 #include "elf.h"
+#include "memory.h"
+#include "relocations.h"
+
+#include <cstring>
+#include <algorithm>
 
-#include <stdexcept>
- 
 namespace insn {
 
 namespace {
@@ -64,31 +67,169 @@ struct program_header {
 	uint32_t align;
 };
 
-}
+#pragma mark ELF64
+
+struct elf64_header {
+	struct {
+		uint8_t magic[4];
+		uint8_t fclass;
+		uint8_t data;
+		uint8_t version;
+		uint8_t pad[9];
+	} ident;
+	uint16_t type;
+	uint16_t machine;
+	uint32_t version;
+	uint64_t entry;
+	uint64_t phoff;
+	uint64_t shoff;
+	uint32_t flags;
+	uint16_t ehsize;
+	uint16_t phentsize;
+	uint16_t phnum;
+	uint16_t shentsize;
+	uint16_t shnum;
+	uint16_t shstrndx;
+};
+
+struct program_header64 {
+	uint32_t type;
+	uint32_t flags;
+	uint64_t offset;
+	uint64_t vaddr;
+	uint64_t paddr;
+	uint64_t filesz;
+	uint64_t memsz;
+	uint64_t align;
+};
 
-elf::elf(std::string filename_) : loader(filename) {
-	filename = filename_;
+struct section_header64 {
+	uint32_t name;
+	uint32_t type;
+	uint64_t flags;
+	uint64_t addr;
+	uint64_t offset;
+	uint64_t size;
+	uint32_t link;
+	uint32_t info;
+	uint64_t addralign;
+	uint64_t entsize;
+};
+
+const uint8_t ELFMAG[4] = {0x7f, 'E', 'L', 'F'};
+const uint8_t ELFCLASS32 = 1;
+const uint8_t ELFCLASS64 = 2;
+const uint8_t ELFDATA2LSB = 1;
+const uint8_t EVCURRENT = 1;
+
+const uint16_t ETEXEC = 2;
+const uint16_t ETDYN = 3;
+
+const uint16_t EMAVR = 0x53;
+const uint16_t EMX8664 = 62;
+const uint16_t EMAARCH64 = 183;
+
+const uint32_t PTLOAD = 1;
+const uint32_t PTDYNAMIC = 2;
+enum { PF_X = 1, PF_W = 2, PF_R = 4 };
+
+struct symbol64 {
+	uint32_t name;
+	uint8_t info;
+	uint8_t other;
+	uint16_t shndx;
+	uint64_t value;
+	uint64_t size;
+};
+
+const uint32_t SHTSYMTAB = 2;
+const uint32_t SHTNOBITS = 8;
+const uint32_t SHTDYNSYM = 11;
+
+enum { STT_NOTYPE = 0, STT_OBJECT = 1, STT_FUNC = 2 };
+
+const uint64_t SHFWRITE = 1;
+
+struct dynamic64 {
+	int64_t tag;
+	uint64_t val;
+};
+
+enum {
+	DTNULL = 0,
+	DTPLTRELSZ = 2,
+	DTSYMTAB = 6,
+	DTRELA = 7,
+	DTRELASZ = 8,
+	DTRELAENT = 9,
+	DTPLTREL = 20,
+	DTJMPREL = 23,
+	DTRELRSZ = 35,
+	DTRELR = 36,
+	DTRELRENT = 37,
+};
+
+struct rela64 {
+	uint64_t offset;
+	uint64_t info;
+	int64_t addend;
+};
 
-	throw std::runtime_error("ELF support not implemented. Yet.");
+const uint32_t R_X86_64_64 = 1;
+const uint32_t R_X86_64_GLOB_DAT = 6;
+const uint32_t R_X86_64_JUMP_SLOT = 7;
+const uint32_t R_X86_64_RELATIVE = 8;
+
+const uint32_t R_AARCH64_ABS64 = 257;
+const uint32_t R_AARCH64_GLOB_DAT = 1025;
+const uint32_t R_AARCH64_JUMP_SLOT = 1026;
+const uint32_t R_AARCH64_RELATIVE = 1027;
+
+}
+
+elf::elf(std::string filename, std::shared_ptr<mapped_file> image)
+	: loader(filename, std::move(image)), entry(0), wide(false) {
+	parse();
 }
 
+// the magic bytes read as a little endian word
 bool elf::check_magic(uint32_t magic) {
-	const uint32_t EH_7ELF = 0x7f454c46;
+	const uint32_t EH_7ELF = 0x464c457f;
 	return magic == EH_7ELF;
 }
 
+// Points at the entry in the segment that holds it, in the mapping.
 void elf::load_code() {
+	if (wide) {
+		const elf64_header *eh = at<elf64_header>(0);
+		const program_header64 *ph = at<program_header64>(eh->phoff, eh->phnum);
+
+		index_sections();
+
+		for (int i = 0; i < eh->phnum; i++, ph++) {
+			if (ph->type == PTLOAD && entry >= ph->vaddr && entry - ph->vaddr < ph->filesz) {
+				code = (uintptr_t)at<uint8_t>(ph->offset, ph->filesz) + (entry - ph->vaddr);
+				return;
+			}
+		}
+
+		throw error("Entry point outside of the loadable segments");
+	}
 
+	const elf_header *eh = at<elf_header>(0);
+	const program_header *ph = at<program_header>(eh->phoff, eh->phnum);
+
+	for (int i = 0; i < eh->phnum; i++, ph++) {
+		if (entry >= ph->paddr && entry - ph->paddr < ph->filesz) {
+			code = (uintptr_t)at<uint8_t>(ph->offset, ph->filesz) + (entry - ph->paddr);
+			return;
+		}
+	}
+
+	throw error("Entry point outside of the loadable segments");
 }
 
 void elf::parse() {
-	const uint8_t ELFMAG[4] = {0x7f, 'E', 'L', 'F'};
-	const uint8_t ELFCLASS32 = 1;
-	const uint8_t ELFDATA2LSB = 1;
-	const uint8_t EVCURRENT = 1;
-	const uint8_t ETEXEC = 2;
-	const uint8_t EMAVR = 0x53;
-
 	elf_header *eh = (elf_header *)mapping;
 
 	if (fsize < sizeof(elf_header)) {
@@ -99,6 +240,11 @@ void elf::parse() {
 		throw error("Not an ELF image");
 	}
 
+	if (eh->ident.fclass == ELFCLASS64) {
+		parse64();
+		return;
+	}
+
 	if (eh->ehsize != sizeof(elf_header)) {
 		throw error("Bad ELF header");
 	}
@@ -127,6 +273,7 @@ void elf::parse() {
 		throw error("Bad ELF version");
 	}
 
+	arch = "avr";
 	entry = eh->entry;
 
 	if (eh->phoff == 0) {
@@ -142,16 +289,374 @@ void elf::parse() {
 	if (phend > fsize) {
 		throw error("Program headers larger than file");
 	}
+
+	const program_header *ph = at<program_header>(eh->phoff, eh->phnum);
+
+	for (int i = 0; i < eh->phnum; i++, ph++) {
+		if (ph->filesz > ph->memsz) {
+			throw error("Bad segment size");
+		}
+		at<uint8_t>(ph->offset, ph->filesz);
+	}
+}
+
+void elf::parse64() {
+	const elf64_header *eh = at<elf64_header>(0);
+
+	if (eh->ehsize != sizeof(elf64_header)) {
+		throw error("Bad ELF header");
+	}
+
+	if (eh->ident.data != ELFDATA2LSB) {
+		throw error("Bad indianness");
+	}
+
+	if (eh->ident.version != EVCURRENT || eh->version != EVCURRENT) {
+		throw error("Bad ELF version");
+	}
+
+	if (eh->type != ETEXEC && eh->type != ETDYN) {
+		throw error("Not an executable");
+	}
+
+	switch (eh->machine) {
+		case EMAARCH64: arch = "arm64"; break;
+		case EMX8664: arch = "x64"; break;
+		default:
+			throw error("Bad architecture");
+	}
+
+	wide = true;
+	entry = eh->entry;
+
+	if (eh->phoff == 0) {
+		throw error("No program header");
+	}
+
+	if (eh->phentsize != sizeof(program_header64)) {
+		throw error("Bad program header");
+	}
+
+	const program_header64 *ph = at<program_header64>(eh->phoff, eh->phnum);
+
+	for (int i = 0; i < eh->phnum; i++, ph++) {
+		if (ph->type != PTLOAD) {
+			continue;
+		}
+		if (ph->filesz > ph->memsz) {
+			throw error("Bad segment size");
+		}
+		at<uint8_t>(ph->offset, ph->filesz);
+	}
+}
+
+// Section headers are optional in executables, a stripped one just has
+// an empty index.
+void elf::index_sections() {
+	const elf64_header *eh = at<elf64_header>(0);
+
+	sections.clear();
+
+	if (eh->shoff == 0 || eh->shnum == 0) {
+		return;
+	}
+
+	if (eh->shentsize != sizeof(section_header64) || eh->shstrndx >= eh->shnum) {
+		throw error("Bad section header");
+	}
+
+	const section_header64 *sh = at<section_header64>(eh->shoff, eh->shnum);
+	const section_header64 &names = sh[eh->shstrndx];
+	const char *strtab = at<char>(names.offset, names.size);
+
+	for (int i = 1; i < eh->shnum; i++) {
+		section s;
+
+		if (sh[i].name >= names.size) {
+			throw error("Bad section name");
+		}
+
+		s.name = std::string(strtab + sh[i].name, strnlen(strtab + sh[i].name, names.size - sh[i].name));
+		s.addr = sh[i].addr;
+		s.size = sh[i].size;
+		s.writable = sh[i].flags & SHFWRITE;
+		s.zerofill = sh[i].type == SHTNOBITS;
+		s.offset = s.zerofill ? 0 : sh[i].offset;
+
+		if (!s.zerofill) {
+			at<uint8_t>(s.offset, s.size);
+		}
+
+		sections.push_back(s);
+	}
+}
+
+void elf::read_symbols(std::vector<symbol> &out) {
+	read_symtab(&out, nullptr);
+}
+
+void elf::read_functions(std::vector<uint64_t> &out) {
+	read_symtab(nullptr, &out);
+}
+
+// Functions and objects from .symtab, or from .dynsym in a stripped
+// binary, with the STT_FUNC ones as function starts. ELF32 images carry
+// no section index, so have neither here.
+void elf::read_symtab(std::vector<symbol> *symbols, std::vector<uint64_t> *functions) {
+	if (!wide) {
+		return;
+	}
+
+	const elf64_header *eh = at<elf64_header>(0);
+
+	if (eh->shoff == 0 || eh->shnum == 0 || eh->shentsize != sizeof(section_header64)) {
+		return;
+	}
+
+	const section_header64 *sh = at<section_header64>(eh->shoff, eh->shnum);
+	const section_header64 *table = nullptr;
+
+	for (int i = 0; i < eh->shnum; i++) {
+		if (sh[i].type == SHTSYMTAB || (sh[i].type == SHTDYNSYM && !table)) {
+			table = &sh[i];
+		}
+	}
+
+	if (!table || table->link >= eh->shnum || table->entsize != sizeof(symbol64)) {
+		return;
+	}
+
+	const section_header64 &names = sh[table->link];
+	const char *strtab = at<char>(names.offset, names.size);
+	uint64_t count = table->size / sizeof(symbol64);
+	const symbol64 *sym = at<symbol64>(table->offset, count);
+
+	for (uint64_t k = 0; k < count; k++, sym++) {
+		int type = sym->info & 0xf;
+
+		if (type != STT_NOTYPE && type != STT_OBJECT && type != STT_FUNC) {
+			continue;
+		}
+		if (sym->shndx == 0) {
+			continue;
+		}
+
+		if (functions && type == STT_FUNC) {
+			functions->push_back(sym->value);
+		}
+
+		if (symbols && sym->name && sym->name < names.size) {
+			const char *name = strtab + sym->name;
+			symbol s = { sym->value, sym->size, name, (uint32_t)strnlen(name, names.size - sym->name) };
+			symbols->push_back(s);
+		}
+	}
+}
+
+void elf::read_loadables(std::vector<loadable> &out, uint64_t slide) {
+	if (!wide) {
+		throw error("Only ELF64 images map into guest memory");
+	}
+
+	const elf64_header *eh = at<elf64_header>(0);
+	const program_header64 *ph = at<program_header64>(eh->phoff, eh->phnum);
+
+	if (slide && eh->type != ETDYN) {
+		throw error("Only position independent images can be moved");
+	}
+
+	for (int i = 0; i < eh->phnum; i++, ph++) {
+		if (ph->type != PTLOAD || ph->memsz == 0) {
+			continue;
+		}
+
+		int prot = ((ph->flags & PF_R) ? memory::read : 0) |
+		           ((ph->flags & PF_W) ? memory::write : 0) |
+		           ((ph->flags & PF_X) ? memory::exec : 0);
+
+		out.push_back({ ph->offset, ph->vaddr + slide, ph->filesz, ph->memsz, prot });
+	}
+}
+
+// Where vaddr's size bytes are in the file, or ~0 if they aren't all there.
+uint64_t elf::file_offset(uint64_t vaddr, uint64_t size) const {
+	const elf64_header *eh = at<elf64_header>(0);
+	const program_header64 *ph = at<program_header64>(eh->phoff, eh->phnum);
+
+	for (int i = 0; i < eh->phnum; i++, ph++) {
+		if (ph->type == PTLOAD && vaddr >= ph->vaddr && vaddr - ph->vaddr < ph->filesz &&
+		    size <= ph->filesz - (vaddr - ph->vaddr)) {
+			return ph->offset + (vaddr - ph->vaddr);
+		}
+	}
+
+	return ~0ull;
+}
+
+// With no dynamic linker, and no shared objects, only the image itself
+// can be bound to: a symbol it defines resolves to its slid address, an
+// import to zero. IRELATIVE needs its resolver run in the guest and TLS
+// relocations a thread block, so those and anything else are left alone.
+void elf::read_relocations(relocations &out, uint64_t slide) {
+	const elf64_header *eh = at<elf64_header>(0);
+	const program_header64 *ph = at<program_header64>(eh->phoff, eh->phnum);
+	const dynamic64 *dyn = nullptr;
+	uint64_t ndyn = 0;
+
+	for (int i = 0; i < eh->phnum; i++) {
+		if (ph[i].type == PTDYNAMIC) {
+			ndyn = ph[i].filesz / sizeof(dynamic64);
+			dyn = at<dynamic64>(ph[i].offset, ndyn);
+		}
+	}
+
+	if (!dyn) {
+		return;
+	}
+
+	uint64_t tags[DTRELRENT + 1] = {};
+
+	for (uint64_t k = 0; k < ndyn && dyn[k].tag != DTNULL; k++) {
+		if (dyn[k].tag > 0 && dyn[k].tag <= DTRELRENT) {
+			tags[dyn[k].tag] = dyn[k].val;
+		}
+	}
+
+	if ((tags[DTRELAENT] && tags[DTRELAENT] != sizeof(rela64)) ||
+	    (tags[DTRELRENT] && tags[DTRELRENT] != sizeof(uint64_t))) {
+		throw error("Bad relocation entry size");
+	}
+
+	uint32_t relative, glob_dat, jump_slot, abs64;
+
+	if (eh->machine == EMAARCH64) {
+		relative = R_AARCH64_RELATIVE;
+		glob_dat = R_AARCH64_GLOB_DAT;
+		jump_slot = R_AARCH64_JUMP_SLOT;
+		abs64 = R_AARCH64_ABS64;
+	}
+	else {
+		relative = R_X86_64_RELATIVE;
+		glob_dat = R_X86_64_GLOB_DAT;
+		jump_slot = R_X86_64_JUMP_SLOT;
+		abs64 = R_X86_64_64;
+	}
+
+	// bounds of the dynamic symbols, checked here as the batches can't throw
+	const symbol64 *syms = nullptr;
+	uint64_t nsyms = 0;
+
+	if (tags[DTSYMTAB]) {
+		uint64_t off = file_offset(tags[DTSYMTAB], sizeof(symbol64));
+
+		if (off != ~0ull) {
+			nsyms = (fsize - off) / sizeof(symbol64);
+			syms = at<symbol64>(off, nsyms);
+		}
+	}
+
+	struct table {
+		uint64_t addr;
+		uint64_t size;
+	} tables[] = {
+		{ tags[DTRELA], tags[DTRELASZ] },
+		{ tags[DTJMPREL], tags[DTPLTREL] == DTRELA ? tags[DTPLTRELSZ] : 0 },
+	};
+
+	for (auto &t : tables) {
+		if (!t.addr || !t.size) {
+			continue;
+		}
+
+		uint64_t off = file_offset(t.addr, t.size);
+
+		if (off == ~0ull) {
+			throw error("Relocations outside of the file");
+		}
+
+		const rela64 *r = at<rela64>(off, t.size / sizeof(rela64));
+
+		out.resolve(t.size / sizeof(rela64), [&](size_t k, relocations::fixup &f) {
+			uint32_t type = r[k].info & 0xffffffff;
+			uint64_t sym = r[k].info >> 32;
+
+			f.addr = r[k].offset + slide;
+
+			if (type == relative) {
+				f.value = slide + r[k].addend;
+				return true;
+			}
+			if (type != glob_dat && type != jump_slot && type != abs64) {
+				return false;
+			}
+			if (sym >= nsyms) {
+				return false;
+			}
+
+			f.value = syms[sym].shndx ? slide + syms[sym].value + r[k].addend : 0;
+			return true;
+		});
+	}
+
+	// RELR: an address, then bitmaps of which of the next 63 words need
+	// the slide added to what the file holds there
+	if (tags[DTRELR] && tags[DTRELRSZ]) {
+		uint64_t off = file_offset(tags[DTRELR], tags[DTRELRSZ]);
+
+		if (off == ~0ull) {
+			throw error("Relocations outside of the file");
+		}
+
+		const uint64_t count = tags[DTRELRSZ] / sizeof(uint64_t);
+		const uint64_t *e = at<uint64_t>(off, count);
+		std::vector<relocations::fixup> fixups;
+		uint64_t where = 0;
+		size_t total = 0;
+
+		for (uint64_t k = 0; k < count; k++) {
+			total += (e[k] & 1) ? __builtin_popcountll(e[k] >> 1) : 1;
+		}
+		fixups.reserve(total);
+
+		auto relative_at = [&](uint64_t addr) {
+			uint64_t in_file = file_offset(addr, sizeof(uint64_t));
+
+			if (in_file != ~0ull) {
+				uint64_t addend;
+				std::memcpy(&addend, mapping + in_file, sizeof(addend));
+				fixups.push_back({ addr + slide, addend + slide });
+			}
+		};
+
+		for (uint64_t k = 0; k < count; k++) {
+			if ((e[k] & 1) == 0) {
+				relative_at(e[k]);
+				where = e[k] + sizeof(uint64_t);
+				continue;
+			}
+
+			uint64_t bits = e[k] >> 1;
+			for (uint64_t addr = where; bits; bits >>= 1, addr += sizeof(uint64_t)) {
+				if (bits & 1) {
+					relative_at(addr);
+				}
+			}
+			where += 63 * sizeof(uint64_t);
+		}
+
+		out.add(std::move(fixups));
+	}
 }
 
 void elf::init_segments(void *address, size_t size) {
+	if (wide) {
+		throw error("ELF64 images map into guest memory");
+	}
+
 	elf_header *eh = (elf_header *)mapping;
 	program_header *ph = (program_header *)((uintptr_t)mapping + eh->phoff);
 
 	for (int i = 0; i < eh->phnum; i++, ph++) {
-		const uint8_t PTLOAD = 1;
-		enum { PF_X = 1, PF_W = 2, PF_R = 4 };
-
 		if (ph->type != PTLOAD) {
 			throw error("Only loadable segments supported");
 		}
@@ -27,13 +27,32 @@
 
 namespace insn {
 
+// ELF32 AVR images and ELF64 arm64 and x86-64 executables.
 class elf : public loader {
 public:
-	elf(std::string filename);
+	elf(std::string filename, std::shared_ptr<mapped_file> image = nullptr);
 	static bool check_magic(uint32_t magic);
 
+	// ELF32: copies the loadable segments into a flat memory image
+	void init_segments(void *address, size_t size);
+
+	// ELF64: the dynamic relocations
+	void read_relocations(relocations &out, uint64_t slide);
+
+	uint64_t entry;
+
 private:
+	bool wide;
+
 	void load_code();
+	void read_loadables(std::vector<loadable> &out, uint64_t slide);
+	void read_symbols(std::vector<symbol> &out);
+	void read_functions(std::vector<uint64_t> &out);
+	void read_symtab(std::vector<symbol> *symbols, std::vector<uint64_t> *functions);
+	void parse();
+	void parse64();
+	void index_sections();
+	uint64_t file_offset(uint64_t vaddr, uint64_t size) const;
 };
 
 }
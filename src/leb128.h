@@ -0,0 +1,109 @@
+/**
+ * Copyright (c) 2014, Floris Chabert. All rights reserved.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef LEB128_H__
+#define LEB128_H__
+
+#include <cstdint>
+#include <cstring>
+
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
+
+namespace insn {
+
+// the 7-bit groups of the low bytes of w, packed
+inline uint64_t uleb128_gather(uint64_t w, unsigned bytes) {
+#ifdef __BMI2__
+	return _pext_u64(w, 0x7f7f7f7f7f7f7f7full >> (64 - 8 * bytes));
+#else
+	// close the gaps pairwise: bytes into 14-bit, then 28-bit, then 56-bit
+	w &= ~0ull >> (64 - 8 * bytes);
+	w = (w & 0x007f007f007f007full) | ((w & 0x7f007f007f007f00ull) >> 1);
+	w = (w & 0x00003fff00003fffull) | ((w & 0x3fff00003fff0000ull) >> 2);
+	w = (w & 0x000000000fffffffull) | ((w & 0x0fffffff00000000ull) >> 4);
+	return w;
+#endif
+}
+
+// Decodes consecutive ULEB128 values, handing each to emit() until it
+// returns false or the data runs out, and returns where it stopped. Eight
+// bytes are loaded at a time and every value ending inside them is taken
+// out of the register, so a stream of short values costs a load per word
+// rather than a branch per byte. The tail, and values longer than eight
+// bytes, go one byte at a time.
+template <typename F>
+const uint8_t *uleb128_stream(const uint8_t *p, const uint8_t *end, F emit) {
+	for (;;) {
+		while (end - p >= 8) {
+			uint64_t w;
+			std::memcpy(&w, p, 8);
+
+			uint64_t stops = ~w & 0x8080808080808080ull;
+			unsigned used = 0;
+
+			if (!stops) {
+				break;
+			}
+
+			do {
+				unsigned bytes = (__builtin_ctzll(stops) >> 3) + 1;
+
+				if (!emit(uleb128_gather(w >> (8 * used), bytes - used))) {
+					return p + bytes;
+				}
+				used = bytes;
+				stops &= stops - 1;
+			} while (stops);
+
+			p += used;
+		}
+
+		if (p == end) {
+			return p;
+		}
+
+		uint64_t v = 0;
+		unsigned shift = 0;
+		uint8_t b;
+
+		do {
+			if (p == end) {
+				return p;
+			}
+			b = *p++;
+			if (shift < 64) {
+				v |= (uint64_t)(b & 0x7f) << shift;
+			}
+			shift += 7;
+		} while (b & 0x80);
+
+		if (!emit(v)) {
+			return p;
+		}
+	}
+}
+
+}
+
+#endif
@@ -24,40 +24,551 @@
 
 #include "macho.h"
 #include "elf.h"
+#include "memory.h"
+#include "relocations.h"
+#include "cache.h"
 
-#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 namespace insn {
 
-std::unique_ptr<loader> loader::for_file(std::string filename) {
-	uint32_t magic;
+namespace {
+
+struct cached_state {
+	uint64_t code;
+	// the segments, fixups and pages tables hold the image at slide 0
+	uint64_t segments;
+};
+
+// names are offsets into the strings table
+struct cached_section {
+	uint64_t segment;
+	uint32_t segment_length;
+	uint32_t name_length;
+	uint64_t name;
+	uint64_t addr;
+	uint64_t size;
+	uint64_t offset;
+	uint8_t writable;
+	uint8_t zerofill;
+	uint8_t reserved[6];
+};
+
+struct cached_symbol {
+	uint64_t addr;
+	uint64_t size;
+	uint64_t name;
+	uint32_t length;
+	uint32_t reserved;
+};
+
+struct cached_page {
+	uint64_t addr;
+	uint64_t prot;
+};
 
-	std::ifstream file(filename, std::ifstream::binary);
-	if (!file.is_open()) {
+}
+
+mapped_file::mapped_file(std::string filename) : data(nullptr), size(0) {
+	fd = open(filename.c_str(), O_RDONLY);
+	if (fd < 0) {
 		throw std::runtime_error(std::string("Can't open '") + filename + "'.");
 	}
-	file.read((char*)&magic, sizeof(magic));
-	file.close();
+
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		throw std::runtime_error(std::string("Can't stat '") + filename + "'.");
+	}
+	size = st.st_size;
+
+	if (size) {
+		void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+		               MAP_PRIVATE | MAP_NORESERVE, fd, 0);
+		if (p == MAP_FAILED) {
+			close(fd);
+			throw std::runtime_error(std::string("Can't map '") + filename + "'.");
+		}
+		data = (const uint8_t *)p;
+	}
+}
+
+mapped_file::~mapped_file() {
+	if (data) {
+		munmap((void *)data, size);
+	}
+	close(fd);
+}
+
+// The file is mapped here and the mapping handed to the loader, so it is
+// opened exactly once.
+std::unique_ptr<loader> loader::for_file(std::string filename) {
+	std::unique_ptr<mapped_file> image(new mapped_file(filename));
+	uint32_t magic = 0;
+
+	if (image->size >= sizeof(magic)) {
+		magic = *(const uint32_t *)image->data;
+	}
 
 	if (macho::check_magic(magic)) {
-		return std::unique_ptr<loader>(new macho(filename));
+		return std::unique_ptr<loader>(new macho(filename, std::move(image)));
 	}
 	if (elf::check_magic(magic)) {
-		return std::unique_ptr<loader>(new elf(filename));
+		return std::unique_ptr<loader>(new elf(filename, std::move(image)));
 	}
 
 	throw std::runtime_error("File type not supported.");
 }
 
-loader::loader(std::string filename_) {
-	filename = filename_;
-	file = std::ifstream(filename, std::ifstream::binary);
-	if (!file.is_open()) {
-		throw std::runtime_error(std::string("Can't open '") + filename + "'.");
+loader::loader(std::string filename_, std::shared_ptr<mapped_file> image_)
+	: filename(filename_), code(0), image(std::move(image_)) {
+	if (!image) {
+		image.reset(new mapped_file(filename));
 	}
+	mapping = image->data;
+	fsize = image->size;
 }
 
 void loader::load() {
+	load_code();
+}
+
+void loader::load(const std::string &cache_dir) {
+	uint64_t hash = content_hash(mapping, fsize, cache_seed());
+	std::string path = cache_path(cache_dir, hash);
+
+	if (restore(path, hash)) {
+		return;
+	}
+
+	load();
+
+	try {
+		save(path, hash);
+	}
+	catch (std::exception &) {
+	}
+}
+
+// Everything is checked against its table before it is used, a cache
+// that doesn't add up is a miss.
+bool loader::restore(const std::string &path, uint64_t hash) {
+	std::shared_ptr<cache_file> c = cache_file::open(path, hash, fsize);
+
+	if (!c) {
+		return false;
+	}
+
+	uint64_t n_state, n_strings, n_sections, n_symbols, n_tree, n_rank, n_buckets;
+	uint64_t n_functions, n_segments, n_index, n_pages;
+
+	const cached_state *st = c->table<cached_state>(cache_file::state, n_state);
+	const char *strings = c->table<char>(cache_file::strings, n_strings);
+	const cached_section *sects = c->table<cached_section>(cache_file::sections, n_sections);
+	const cached_symbol *syms = c->table<cached_symbol>(cache_file::symbols, n_symbols);
+	const uint64_t *tree = c->table<uint64_t>(cache_file::symbol_tree, n_tree);
+	const uint32_t *rank = c->table<uint32_t>(cache_file::symbol_rank, n_rank);
+	const uint32_t *buckets = c->table<uint32_t>(cache_file::symbol_buckets, n_buckets);
+	const uint64_t *funcs = c->table<uint64_t>(cache_file::functions, n_functions);
+	const loadable *segs = c->table<loadable>(cache_file::loadables, n_segments);
+	const cached_page *index = c->table<cached_page>(cache_file::page_index, n_index);
+	const uint8_t *pages = c->table<uint8_t>(cache_file::pages, n_pages);
+
+	if (!st || !strings || !sects || !syms || !tree || !rank || !buckets || !funcs ||
+	    !segs || !index || !pages) {
+		return false;
+	}
+	if (n_state != 1 || st->code > fsize || n_pages != n_index * memory::page_size()) {
+		return false;
+	}
+	if (n_tree != n_symbols + 1 || n_rank != n_symbols + 1 || !n_buckets || (n_buckets & (n_buckets - 1))) {
+		return false;
+	}
+
+	for (uint64_t k = 0; k < n_sections; k++) {
+		if (sects[k].segment + sects[k].segment_length > n_strings ||
+		    sects[k].name + sects[k].name_length > n_strings) {
+			return false;
+		}
+	}
+	for (uint64_t k = 0; k < n_symbols; k++) {
+		if (syms[k].name > n_strings || syms[k].length > n_strings - syms[k].name) {
+			return false;
+		}
+	}
+	for (uint64_t k = 0; k < n_rank; k++) {
+		if (rank[k] > n_symbols) {
+			return false;
+		}
+	}
+	for (uint64_t k = 0; k < n_buckets; k++) {
+		if (buckets[k] != UINT32_MAX && buckets[k] >= n_symbols) {
+			return false;
+		}
+	}
+
+	sections.clear();
+	sections.reserve(n_sections);
+
+	for (uint64_t k = 0; k < n_sections; k++) {
+		section s;
+
+		s.segment = std::string(strings + sects[k].segment, sects[k].segment_length);
+		s.name = std::string(strings + sects[k].name, sects[k].name_length);
+		s.addr = sects[k].addr;
+		s.size = sects[k].size;
+		s.offset = sects[k].offset;
+		s.writable = sects[k].writable;
+		s.zerofill = sects[k].zerofill;
+		sections.push_back(s);
+	}
+
+	std::vector<symbol> sorted;
+	sorted.reserve(n_symbols);
+
+	for (uint64_t k = 0; k < n_symbols; k++) {
+		symbol s = { syms[k].addr, syms[k].size, strings + syms[k].name, syms[k].length };
+		sorted.push_back(s);
+	}
+
+	symtab.reset(new symbol_table(std::move(sorted), std::vector<uint64_t>(tree, tree + n_tree),
+	                              std::vector<uint32_t>(rank, rank + n_rank),
+	                              std::vector<uint32_t>(buckets, buckets + n_buckets)));
+	starts.reset(new std::vector<uint64_t>(funcs, funcs + n_functions));
+
+	code = (uintptr_t)mapping + st->code;
+	cached_segments.clear();
+	if (st->segments) {
+		cached_segments.assign(segs, segs + n_segments);
+	}
+	cache = c;
+	return true;
+}
+
+// The pages written to by relocations are kept relocated; an image whose
+// relocations land outside its writable segments keeps none, and maps the
+// long way so that it fails the same way.
+void loader::save(const std::string &path, uint64_t hash) {
+	const uint64_t page = memory::page_size();
+	std::vector<char> strings;
+
+	auto intern = [&strings](const char *s, size_t n) {
+		uint64_t at = strings.size();
+		strings.insert(strings.end(), s, s + n);
+		return at;
+	};
+
+	std::vector<cached_section> sects;
+
+	for (auto &s : sections) {
+		cached_section c = {};
+
+		c.segment = intern(s.segment.data(), s.segment.size());
+		c.segment_length = s.segment.size();
+		c.name = intern(s.name.data(), s.name.size());
+		c.name_length = s.name.size();
+		c.addr = s.addr;
+		c.size = s.size;
+		c.offset = s.offset;
+		c.writable = s.writable;
+		c.zerofill = s.zerofill;
+		sects.push_back(c);
+	}
+
+	const symbol_table &table = symbols();
+	std::vector<cached_symbol> syms;
+
+	for (auto &s : table.sorted) {
+		cached_symbol c = { s.addr, s.size, intern(s.name, s.length), s.length, 0 };
+		syms.push_back(c);
+	}
+
+	const std::vector<uint64_t> &funcs = functions();
+
+	cached_state st = { code - (uintptr_t)mapping, 0 };
+	std::vector<loadable> segments;
+	relocations relocs;
+	std::vector<cached_page> index;
+	std::vector<uint8_t> pages;
+
+	try {
+		read_loadables(segments, 0);
+		read_relocations(relocs, 0);
+		st.segments = 1;
+	}
+	catch (error &) {
+		segments.clear();
+	}
+
+	if (st.segments) {
+		std::vector<uint64_t> touched;
+
+		for (auto &f : relocs.all()) {
+			touched.push_back(f.addr & ~(page - 1));
+			touched.push_back((f.addr + sizeof(f.value) - 1) & ~(page - 1));
+		}
+		touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+		std::sort(touched.begin(), touched.end());
+		touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+
+		pages.resize(touched.size() * page);
+
+		for (size_t i = 0; i < touched.size() && st.segments; i++) {
+			const loadable *in = nullptr;
+
+			for (auto &l : segments) {
+				if (touched[i] - (l.addr & ~(page - 1)) < ((l.addr + l.memsz + page - 1) & ~(page - 1)) - (l.addr & ~(page - 1))) {
+					in = &l;
+				}
+			}
+			if (!in || !(in->prot & memory::write)) {
+				st.segments = 0;
+				break;
+			}
+
+			build_page(*image, *in, touched[i], &pages[i * page]);
+			relocs.patch(touched[i], &pages[i * page], page);
+			index.push_back({ touched[i], (uint64_t)in->prot });
+		}
+
+		if (!st.segments) {
+			segments.clear();
+			index.clear();
+			pages.clear();
+		}
+	}
+
+	cache_writer w;
+
+	w.table(cache_file::state, &st, 1);
+	w.table(cache_file::strings, strings.data(), strings.size());
+	w.table(cache_file::sections, sects.data(), sects.size());
+	w.table(cache_file::symbols, syms.data(), syms.size());
+	w.table(cache_file::symbol_tree, table.tree.data(), table.tree.size());
+	w.table(cache_file::symbol_rank, table.rank.data(), table.rank.size());
+	w.table(cache_file::symbol_buckets, table.buckets.data(), table.buckets.size());
+	w.table(cache_file::functions, funcs.data(), funcs.size());
+	w.table(cache_file::loadables, segments.data(), segments.size());
+	w.table(cache_file::fixups, relocs.all().data(), st.segments ? relocs.size() : 0);
+	w.table(cache_file::page_index, index.data(), index.size());
+	w.table(cache_file::pages, pages.data(), pages.size(), page);
+	w.write(path, hash, fsize);
+}
+
+// one mapping per run of neighbouring pages
+void loader::map_cached_pages(memory &guest) const {
+	const uint64_t page = memory::page_size();
+	uint64_t count;
+	const cached_page *index = cache->table<cached_page>(cache_file::page_index, count);
+	uint64_t offset = cache->offset(cache_file::pages);
+
+	for (uint64_t i = 0; i < count;) {
+		uint64_t j = i + 1;
+
+		while (j < count && index[j].addr == index[j - 1].addr + page && index[j].prot == index[i].prot) {
+			j++;
+		}
+
+		guest.map(cache->fd(), offset + i * page, index[i].addr, (j - i) * page, index[i].prot);
+		i = j;
+	}
+}
+
+loader::section *loader::find_section(const std::string &segment, const std::string &name) {
+	for (auto &s : sections) {
+		if (s.segment == segment && s.name == name) {
+			return &s;
+		}
+	}
+	return nullptr;
+}
+
+const uint8_t *loader::contents(section &s) {
+	if (!s.zerofill) {
+		return at<uint8_t>(s.offset, s.size);
+	}
+
+	if (!s.fill && s.size) {
+		void *p = mmap(nullptr, s.size, PROT_READ | PROT_WRITE,
+		               MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (p == MAP_FAILED) {
+			throw std::runtime_error("Can't allocate " + s.segment + "," + s.name + ".");
+		}
+
+		size_t size = s.size;
+		s.fill = std::shared_ptr<uint8_t>((uint8_t *)p, [size](uint8_t *q) { munmap(q, size); });
+	}
+	return s.fill.get();
+}
+
+const symbol_table &loader::symbols() {
+	if (!symtab) {
+		std::vector<symbol> found;
+
+		read_symbols(found);
+		symtab.reset(new symbol_table(std::move(found)));
+	}
+	return *symtab;
+}
+
+const std::vector<uint64_t> &loader::functions() {
+	if (!starts) {
+		std::unique_ptr<std::vector<uint64_t>> found(new std::vector<uint64_t>);
+
+		read_functions(*found);
+		std::sort(found->begin(), found->end());
+		found->erase(std::unique(found->begin(), found->end()), found->end());
+		starts = std::move(found);
+	}
+	return *starts;
+}
+
+// The mapping is private, the first store to a page copies it.
+uint8_t *loader::writable(section &s) {
+	if (!s.writable) {
+		throw error(s.segment + "," + s.name + " is read-only.");
+	}
+	return (uint8_t *)contents(s);
+}
+
+void loader::read_loadables(std::vector<loadable> &out, uint64_t slide) {
+	throw error("Image doesn't map into guest memory.");
+}
+
+// Relocations go in last, or into each page as it is filled when on demand.
+// Loaded from a cache, an image at its own addresses has them ready: the
+// relocated pages are mapped over the file ones straight from the cache.
+void loader::map_segments(memory &guest, bool on_demand, uint64_t slide) {
+	std::vector<loadable> segments;
+	std::shared_ptr<relocations> relocs = std::make_shared<relocations>();
+	bool cached = cache && !cached_segments.empty() && slide == 0;
+
+	if (slide & (memory::page_size() - 1)) {
+		throw error("Slide not page aligned.");
+	}
+
+	if (cached) {
+		segments = cached_segments;
+
+		uint64_t count;
+		const relocations::fixup *f = cache->table<relocations::fixup>(cache_file::fixups, count);
+
+		if (on_demand && f) {
+			relocs->add(std::vector<relocations::fixup>(f, f + count));
+		}
+	}
+	else {
+		read_loadables(segments, slide);
+		read_relocations(*relocs, slide);
+	}
+
+	for (auto &l : segments) {
+		map_segment(guest, l, on_demand, relocs);
+	}
+
+	if (on_demand) {
+		return;
+	}
+	if (cached) {
+		map_cached_pages(guest);
+	}
+	else if (relocs->size()) {
+		relocs->apply(guest);
+	}
+}
+
+// Found through the segment that holds code in the file.
+uint64_t loader::guest_code(uint64_t slide) {
+	std::vector<loadable> segments;
+	uint64_t offset = code - (uintptr_t)mapping;
+
+	if (cache && !cached_segments.empty() && slide == 0) {
+		segments = cached_segments;
+	}
+	else {
+		read_loadables(segments, slide);
+	}
+
+	for (auto &l : segments) {
+		if (offset - l.offset < l.filesz) {
+			return l.addr + (offset - l.offset);
+		}
+	}
+
+	throw error("Code outside of the loadable segments.");
+}
+
+// Whole file pages, with only a writable segment's zero-fill tail cleared,
+// as the mapping in map_segment leaves them. out starts zeroed.
+void loader::build_page(const mapped_file &file, const loadable &l, uint64_t addr, uint8_t *out) {
+	const uint64_t page = memory::page_size();
+	uint64_t start = l.addr & ~(page - 1);
+	uint64_t first = l.offset - (l.addr - start);
+	uint64_t file_end = l.addr + l.filesz;
+	uint64_t mem_end = l.addr + l.memsz;
+	uint64_t copy_end = l.filesz ? std::min((file_end + page - 1) & ~(page - 1), start + (file.size - first)) : start;
+	uint64_t clear_end = (l.prot & memory::write) && mem_end > file_end ? mem_end : file_end;
+
+	if (addr < copy_end) {
+		std::memcpy(out, file.data + first + (addr - start), std::min(page, copy_end - addr));
+	}
+	if (addr < clear_end && addr + page > file_end) {
+		uint64_t from = std::max(addr, file_end);
+		std::memset(out + (from - addr), 0, std::min(addr + page, clear_end) - from);
+	}
+}
+
+// File pages are mapped private at their addresses. Only the zero-fill
+// tail is cleared: the rest of the last file page by hand when the segment
+// is writable, as the kernel does, and anonymous pages after it.
+void loader::map_segment(memory &guest, const loadable &l, bool on_demand,
+                         const std::shared_ptr<relocations> &relocs) {
+	const uint64_t page = memory::page_size();
+
+	if ((l.addr - l.offset) & (page - 1)) {
+		throw error("Segment not page aligned.");
+	}
+	if (l.filesz > l.memsz) {
+		throw error("Bad segment size.");
+	}
+	at<uint8_t>(l.offset, l.filesz);
+
+	uint64_t start = l.addr & ~(page - 1);
+	uint64_t file_end = l.addr + l.filesz;
+	uint64_t mem_end = l.addr + l.memsz;
+	uint64_t mapped_end = start;
+
+	if (on_demand) {
+		// the filler holds on to the image for as long as guest memory needs it
+		std::shared_ptr<mapped_file> file = image;
+
+		guest.demand(start, ((mem_end + page - 1) & ~(page - 1)) - start, l.prot,
+		             [file, relocs, l, page](uint64_t addr, uint8_t *out) {
+			build_page(*file, l, addr, out);
+			relocs->patch(addr, out, page);
+		});
+		return;
+	}
+
+	if (l.filesz) {
+		mapped_end = (file_end + page - 1) & ~(page - 1);
+		guest.map(image->fd, l.offset - (l.addr - start), start, mapped_end - start, l.prot);
+	}
+
+	if (mem_end > file_end && mapped_end > file_end && (l.prot & memory::write)) {
+		std::memset(guest.host(file_end), 0, std::min(mapped_end, mem_end) - file_end);
+	}
+
+	uint64_t zero_end = (mem_end + page - 1) & ~(page - 1);
+
+	if (zero_end > mapped_end) {
+		guest.zero(mapped_end, zero_end - mapped_end, l.prot);
+	}
 }
 
 }
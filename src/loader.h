@@ -24,23 +24,145 @@
 #define LOADER_H__
 
 #include <string>
-#include <fstream>
+#include <vector>
+#include <memory>
+#include <stdexcept>
+#include <cstdint>
+#include <cstddef>
+
+#include "symbols.h"
 
 namespace insn {
 
+class memory;
+class relocations;
+class cache_file;
+
+// Malformed or unsupported executable.
+struct error : public std::runtime_error {
+	explicit error(const std::string &what) : std::runtime_error(what) {}
+};
+
+// A whole file mapped private. Headers are parsed in place and sections
+// are handed out as pointers into the mapping, so nothing is read until it
+// is touched, and a page is only copied if something writes to it.
+class mapped_file {
+public:
+	mapped_file(std::string filename);
+	~mapped_file();
+
+	mapped_file(const mapped_file &) = delete;
+	mapped_file &operator=(const mapped_file &) = delete;
+
+	const uint8_t *data;
+	size_t size;
+
+	// kept open for mapping parts of the file elsewhere
+	int fd;
+};
+
 class loader {
 public:
 	static std::unique_ptr<loader> for_file(std::string filename);
-	loader(std::string filename);
+	loader(std::string filename, std::shared_ptr<mapped_file> image = nullptr);
+	virtual ~loader() {}
 	void load();
 
+	// As load(), but sections, symbols, function starts, segments and
+	// relocated pages come from a cache file under dir when one was made
+	// from the same contents, and go into one otherwise. A cache that
+	// can't be read or written is just passed by.
+	void load(const std::string &cache_dir);
+
+	// Sections as laid out in the file. Their contents are materialized on
+	// demand: file-backed ones point into the mapping, zero-fill ones get
+	// anonymous memory the first time they are asked for.
+	struct section {
+		std::string segment;
+		std::string name;
+		uint64_t addr;
+		uint64_t size;
+		uint64_t offset;
+		bool writable;
+		bool zerofill;
+
+		std::shared_ptr<uint8_t> fill;
+	};
+
+	section *find_section(const std::string &segment, const std::string &name);
+	const uint8_t *contents(section &s);
+	uint8_t *writable(section &s);
+
+	// read from the file the first time it is asked for
+	const symbol_table &symbols();
+
+	// sorted function start addresses, where the file records them
+	const std::vector<uint64_t> &functions();
+
+	// Maps the loadable segments into guest memory at their addresses
+	// plus slide, from the file, and applies the relocations. On demand,
+	// each page is instead copied out of the file and relocated the first
+	// time the guest touches it. Only a position independent image can
+	// slide.
+	void map_segments(memory &guest, bool on_demand = false, uint64_t slide = 0);
+
+	// the guest address of code once mapped with slide
+	uint64_t guest_code(uint64_t slide = 0);
+
+	// what the relocations resolve to with the image moved by slide
+	virtual void read_relocations(relocations &out, uint64_t slide) {}
+
 	std::string filename;
 	std::string arch;
 	uintptr_t code;
+	std::vector<section> sections;
 
 protected:
+	// a segment as it goes into guest memory, addr already slid
+	struct loadable {
+		uint64_t offset;
+		uint64_t addr;
+		uint64_t filesz;
+		uint64_t memsz;
+		int prot;
+	};
+
 	virtual void load_code() = 0;
-	std::ifstream file;
+	virtual void read_loadables(std::vector<loadable> &out, uint64_t slide);
+	virtual void read_symbols(std::vector<symbol> &out) {}
+	virtual void read_functions(std::vector<uint64_t> &out) {}
+	// mixed into the cache key, for what else than the file's contents
+	// decides what gets loaded
+	virtual uint64_t cache_seed() const { return 0; }
+
+	std::shared_ptr<mapped_file> image;
+	const uint8_t *mapping;
+	size_t fsize;
+
+	// count Ts at offset, checked against the end of the file
+	template <typename T>
+	const T *at(uint64_t offset, uint64_t count = 1) const {
+		if (offset > fsize || count > (fsize - offset) / sizeof(T)) {
+			throw error("Truncated file.");
+		}
+		return (const T *)(mapping + offset);
+	}
+
+private:
+	void map_segment(memory &guest, const loadable &l, bool on_demand,
+	                 const std::shared_ptr<relocations> &relocs);
+	static void build_page(const mapped_file &file, const loadable &l, uint64_t addr, uint8_t *out);
+
+	bool restore(const std::string &path, uint64_t hash);
+	void save(const std::string &path, uint64_t hash);
+	void map_cached_pages(memory &guest) const;
+
+	std::unique_ptr<symbol_table> symtab;
+	std::unique_ptr<std::vector<uint64_t>> starts;
+
+	// the cache loaded from, and its segments at slide 0 if it has them
+	std::shared_ptr<cache_file> cache;
+	std::vector<loadable> cached_segments;
 };
 
 }
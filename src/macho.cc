@@ -21,6 +21,14 @@
  */
 
 #include "macho.h"
+#include "cache.h"
+#include "leb128.h"
+#include "memory.h"
+#include "relocations.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstring>
 
 namespace insn {
 
@@ -49,6 +57,7 @@ struct mach_header_64 {
 	uint32_t ncmds;
 	uint32_t sizeofcmds;
 	uint32_t flags;
+	uint32_t reserved;
 };
 
 const uint32_t MH_MACHO_64 = 0xfeedfacf;
@@ -59,11 +68,120 @@ const uint32_t CPU_TYPE_ARM    = 12;
 const uint32_t CPU_TYPE_X86_64 = CPU_TYPE_I386 | 0x1000000;
 const uint32_t CPU_TYPE_ARM64  = CPU_TYPE_ARM  | 0x1000000;
 
+std::string arch_name(uint32_t cputype) {
+	switch (cputype) {
+		case CPU_TYPE_I386: return "i386";
+		case CPU_TYPE_ARM: return "arm";
+		case CPU_TYPE_X86_64: return "x64";
+		case CPU_TYPE_ARM64: return "arm64";
+	}
+	return "cpu " + std::to_string(cputype);
+}
+
+const uint32_t LC_SYMTAB     = 0x2;
+const uint32_t LC_SEGMENT_64 = 0x19;
+const uint32_t LC_FUNCTION_STARTS = 0x26;
+const uint32_t LC_DYLD_INFO = 0x22;
+const uint32_t LC_DYLD_INFO_ONLY = 0x80000022;
+const uint32_t LC_DYLD_CHAINED_FIXUPS = 0x80000034;
+
+const uint32_t MH_PIE = 0x200000;
+
+const uint32_t VM_PROT_READ    = 0x1;
+const uint32_t VM_PROT_WRITE   = 0x2;
+const uint32_t VM_PROT_EXECUTE = 0x4;
+
+const uint32_t SECTION_TYPE              = 0x000000ff;
+const uint32_t S_ZEROFILL                = 0x1;
+const uint32_t S_GB_ZEROFILL             = 0xc;
+const uint32_t S_THREAD_LOCAL_ZEROFILL   = 0x12;
+
 struct load_command {
 	uint32_t cmd;
 	uint32_t cmdsize;
 };
 
+struct symtab_command {
+	uint32_t cmd;
+	uint32_t cmdsize;
+	uint32_t symoff;
+	uint32_t nsyms;
+	uint32_t stroff;
+	uint32_t strsize;
+};
+
+struct linkedit_data_command {
+	uint32_t cmd;
+	uint32_t cmdsize;
+	uint32_t dataoff;
+	uint32_t datasize;
+};
+
+struct dyld_info_command {
+	uint32_t cmd;
+	uint32_t cmdsize;
+	uint32_t rebase_off;
+	uint32_t rebase_size;
+	uint32_t bind_off;
+	uint32_t bind_size;
+	uint32_t weak_bind_off;
+	uint32_t weak_bind_size;
+	uint32_t lazy_bind_off;
+	uint32_t lazy_bind_size;
+	uint32_t export_off;
+	uint32_t export_size;
+};
+
+enum {
+	REBASE_TYPE_POINTER                              = 1,
+	REBASE_IMMEDIATE_MASK                            = 0x0f,
+	REBASE_OPCODE_MASK                               = 0xf0,
+	REBASE_OPCODE_DONE                               = 0x00,
+	REBASE_OPCODE_SET_TYPE_IMM                       = 0x10,
+	REBASE_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB        = 0x20,
+	REBASE_OPCODE_ADD_ADDR_ULEB                      = 0x30,
+	REBASE_OPCODE_ADD_ADDR_IMM_SCALED                = 0x40,
+	REBASE_OPCODE_DO_REBASE_IMM_TIMES                = 0x50,
+	REBASE_OPCODE_DO_REBASE_ULEB_TIMES               = 0x60,
+	REBASE_OPCODE_DO_REBASE_ADD_ADDR_ULEB            = 0x70,
+	REBASE_OPCODE_DO_REBASE_ULEB_TIMES_SKIPPING_ULEB = 0x80,
+};
+
+struct dyld_chained_fixups_header {
+	uint32_t fixups_version;
+	uint32_t starts_offset;
+	uint32_t imports_offset;
+	uint32_t symbols_offset;
+	uint32_t imports_count;
+	uint32_t imports_format;
+	uint32_t symbols_format;
+};
+
+// followed by page_count uint16_t page starts, unaligned
+struct dyld_chained_starts_in_segment {
+	uint32_t size;
+	uint16_t page_size;
+	uint16_t pointer_format;
+	uint64_t segment_offset;
+	uint32_t max_valid_pointer;
+	uint16_t page_count;
+};
+
+const uint16_t DYLD_CHAINED_PTR_START_NONE  = 0xffff;
+const uint16_t DYLD_CHAINED_PTR_START_MULTI = 0x8000;
+
+enum {
+	DYLD_CHAINED_PTR_ARM64E            = 1,
+	DYLD_CHAINED_PTR_64                = 2,
+	DYLD_CHAINED_PTR_64_OFFSET         = 6,
+	DYLD_CHAINED_PTR_ARM64E_USERLAND   = 9,
+	DYLD_CHAINED_PTR_ARM64E_USERLAND24 = 12,
+};
+
+const uint8_t N_STAB = 0xe0;
+const uint8_t N_TYPE = 0x0e;
+const uint8_t N_SECT = 0x0e;
+
 struct segment_command_64 {
 	uint32_t cmd;
 	uint32_t cmdsize;
@@ -72,8 +190,8 @@ struct segment_command_64 {
 	uint64_t vmsize;
 	uint64_t fileoff;
 	uint64_t filesize;
-	uintptr_t maxprot;
-	uintptr_t initprot;
+	uint32_t maxprot;
+	uint32_t initprot;
 	uint32_t nsects;
 	uint32_t flags;
 };
@@ -90,8 +208,20 @@ struct section_64 {
 	uint32_t flags;
 	uint32_t reserved1;
 	uint32_t reserved2;
+	uint32_t reserved3;
 };
 
+// one value off the front of p
+uint64_t read_uleb(const uint8_t *&p, const uint8_t *end) {
+	uint64_t v = 0;
+
+	p = uleb128_stream(p, end, [&](uint64_t value) {
+		v = value;
+		return false;
+	});
+	return v;
+}
+
 struct nlist_64 {
 	union {
 	   uint32_t n_strx;
@@ -104,66 +234,588 @@ struct nlist_64 {
 
 }
 
-macho::macho(std::string filename) : loader(filename) {
-	uint32_t magic;
-	mach_header_64 header;
-
-	file.seekg(0);
-	file.read((char*)&magic, sizeof(magic));
-	file.seekg(0);
-	
-	switch (magic) {
-		case MH_FAT:
-			seek_to_header();
+macho::macho(std::string filename, std::shared_ptr<mapped_file> image)
+	: loader(filename, std::move(image)), base(0), slice_size(fsize) {
+	const mach_header_64 *header;
+
+	switch (*at<uint32_t>(0)) {
+		case MH_FAT: {
+			const slice *pick = nullptr;
+
+			read_fat();
+			for (auto &s : fat) {
+				if (s.cputype == CPU_TYPE_X86_64 || s.cputype == CPU_TYPE_ARM64) {
+					pick = &s;
+					break;
+				}
+			}
+			if (!pick) {
+				throw error("No slice for supported architectures.");
+			}
+			base = pick->offset;
+			slice_size = pick->size;
+			break;
+		}
 		case MH_MACHO_64:
-			file.read((char*)&header, sizeof(header));
+			header = at<mach_header_64>(0);
+			fat.push_back({ arch_name(header->cputype), header->cputype, 0, fsize });
+			break;
+		default:
+			throw error("Unrecognized file format.");
+	}
+
+	check_header();
+}
+
+macho::macho(std::string filename, std::shared_ptr<mapped_file> image, const slice &s)
+	: loader(filename, std::move(image)), base(s.offset), slice_size(s.size) {
+	at<uint8_t>(base, slice_size);
+	fat.push_back(s);
+	check_header();
+}
+
+void macho::check_header() {
+	const mach_header_64 *header = at<mach_header_64>(base);
+
+	if (header->magic != MH_MACHO_64) {
+		throw error("Bad file format.");
+	}
+
+	switch (header->cputype) {
+		case CPU_TYPE_X86_64:
+		case CPU_TYPE_ARM64:
+			arch = arch_name(header->cputype);
 			break;
 		default:
-			throw std::runtime_error("Unrecognized file format.");
+			throw error("Unsupported architecture.");
 	}
+}
+
+// Fat headers are big endian.
+void macho::read_fat() {
+	const fat_header *header = at<fat_header>(0);
+	uint32_t nfat_arch = __builtin_bswap32(header->nfat_arch);
+	const fat_arch *farch = at<fat_arch>(sizeof(fat_header), nfat_arch);
+
+	for (uint32_t i = 0; i < nfat_arch; i++, farch++) {
+		slice s;
 
-	if (header.magic != MH_MACHO_64) {
-		throw std::runtime_error("Bad file format.");
+		s.cputype = __builtin_bswap32(farch->cputype);
+		s.arch = arch_name(s.cputype);
+		s.offset = __builtin_bswap32(farch->offset);
+		s.size = __builtin_bswap32(farch->size);
+
+		at<uint8_t>(s.offset, s.size);
+		fat.push_back(s);
 	}
 }
 
-void macho::seek_to_header() {
-	fat_header fat;
-	fat_arch farch;
+bool macho::check_magic(uint32_t magic) {
+	return (magic == MH_MACHO_64) || (magic == MH_FAT);
+}
 
-	file.read((char*)&fat, sizeof(fat));
+// Only the load commands are read; section contents stay in the mapping
+// until someone asks for them.
+void macho::index_sections() {
+	const mach_header_64 *header = at<mach_header_64>(base);
+	uint64_t end = base + sizeof(mach_header_64) + header->sizeofcmds;
+	uint64_t offset = base + sizeof(mach_header_64);
 
-	int nfat_arch = __builtin_bswap32(fat.nfat_arch);
-	for (int i = 0; i < nfat_arch; i++) {
-		file.read((char*)&farch, sizeof(farch));
+	sections.clear();
 
-		uint32_t cputype = __builtin_bswap32(farch.cputype);
+	for (uint32_t i = 0; i < header->ncmds; i++) {
+		const load_command *lc = at<load_command>(offset);
 
-		if (cputype == CPU_TYPE_X86_64) {
-			arch = "x64";
-			break;
+		if (lc->cmdsize < sizeof(load_command) || offset + lc->cmdsize > end) {
+			throw error("Bad load command.");
 		}
-		
-		if (cputype == CPU_TYPE_ARM64) {
-			arch = "arm64";
-			break;
+
+		if (lc->cmd == LC_SEGMENT_64) {
+			const segment_command_64 *seg = at<segment_command_64>(offset);
+			const section_64 *sect = at<section_64>(offset + sizeof(segment_command_64), seg->nsects);
+
+			for (uint32_t k = 0; k < seg->nsects; k++, sect++) {
+				section s;
+				uint32_t type = sect->flags & SECTION_TYPE;
+
+				s.segment = std::string(sect->segname, strnlen(sect->segname, 16));
+				s.name = std::string(sect->sectname, strnlen(sect->sectname, 16));
+				s.addr = sect->addr;
+				s.size = sect->size;
+				s.writable = seg->initprot & VM_PROT_WRITE;
+				s.zerofill = type == S_ZEROFILL || type == S_GB_ZEROFILL ||
+				             type == S_THREAD_LOCAL_ZEROFILL;
+				s.offset = s.zerofill ? 0 : base + sect->offset;
+
+				if (!s.zerofill && sect->offset + sect->size > slice_size) {
+					throw error("Section outside of its slice.");
+				}
+
+				sections.push_back(s);
+			}
 		}
+
+		offset += lc->cmdsize;
 	}
+}
+
+// Defined symbols only, debug entries and undefined imports are skipped.
+void macho::read_symbols(std::vector<symbol> &out) {
+	const mach_header_64 *header = at<mach_header_64>(base);
+	uint64_t end = base + sizeof(mach_header_64) + header->sizeofcmds;
+	uint64_t offset = base + sizeof(mach_header_64);
+
+	for (uint32_t i = 0; i < header->ncmds; i++) {
+		const load_command *lc = at<load_command>(offset);
 
-	if (arch.empty()) {
-		throw std::runtime_error(
-			"No slice for supported architectures.");
+		if (lc->cmdsize < sizeof(load_command) || offset + lc->cmdsize > end) {
+			throw error("Bad load command.");
+		}
+
+		if (lc->cmd == LC_SYMTAB) {
+			const symtab_command *st = at<symtab_command>(offset);
+			const nlist_64 *n = at<nlist_64>(base + st->symoff, st->nsyms);
+			const char *strtab = at<char>(base + st->stroff, st->strsize);
+
+			out.reserve(out.size() + st->nsyms);
+
+			for (uint32_t k = 0; k < st->nsyms; k++, n++) {
+				if ((n->n_type & N_STAB) || (n->n_type & N_TYPE) != N_SECT) {
+					continue;
+				}
+				if (n->n_un.n_strx == 0 || n->n_un.n_strx >= st->strsize) {
+					continue;
+				}
+
+				const char *name = strtab + n->n_un.n_strx;
+				symbol s = { n->n_value, 0, name, (uint32_t)strnlen(name, st->strsize - n->n_un.n_strx) };
+				out.push_back(s);
+			}
+		}
+
+		offset += lc->cmdsize;
 	}
+}
 
-	file.seekg(__builtin_bswap32(farch.offset));
+// The slices of a fat binary share its contents, which one was loaded
+// has to be part of the cache key.
+uint64_t macho::cache_seed() const {
+	uint64_t where[2] = { base, slice_size };
+	return content_hash(where, sizeof(where));
 }
 
-bool macho::check_magic(uint32_t magic) {
-	return (magic == MH_MACHO_64) || (magic == MH_FAT);
+// LC_FUNCTION_STARTS is a zero terminated list of ULEB128 deltas, the
+// first one from the start of __TEXT. Binaries without it fall back to
+// the symbols inside __text.
+void macho::read_functions(std::vector<uint64_t> &out) {
+	const mach_header_64 *header = at<mach_header_64>(base);
+	uint64_t end = base + sizeof(mach_header_64) + header->sizeofcmds;
+	uint64_t offset = base + sizeof(mach_header_64);
+	const linkedit_data_command *starts = nullptr;
+	uint64_t text = 0;
+
+	for (uint32_t i = 0; i < header->ncmds; i++) {
+		const load_command *lc = at<load_command>(offset);
+
+		if (lc->cmdsize < sizeof(load_command) || offset + lc->cmdsize > end) {
+			throw error("Bad load command.");
+		}
+
+		if (lc->cmd == LC_FUNCTION_STARTS) {
+			starts = at<linkedit_data_command>(offset);
+		}
+		if (lc->cmd == LC_SEGMENT_64) {
+			const segment_command_64 *seg = at<segment_command_64>(offset);
+
+			if (std::strncmp(seg->segname, "__TEXT", 16) == 0) {
+				text = seg->vmaddr;
+			}
+		}
+
+		offset += lc->cmdsize;
+	}
+
+	if (starts) {
+		const uint8_t *data = at<uint8_t>(base + starts->dataoff, starts->datasize);
+		uint64_t addr = text;
+
+		out.reserve(out.size() + starts->datasize / 2);
+
+		uleb128_stream(data, data + starts->datasize, [&](uint64_t delta) {
+			if (delta == 0) {
+				return false;
+			}
+			addr += delta;
+			out.push_back(addr);
+			return true;
+		});
+		return;
+	}
+
+	if (sections.empty()) {
+		index_sections();
+	}
+
+	const section *sect = find_section("__TEXT", "__text");
+
+	if (sect) {
+		for (auto &s : symbols().all()) {
+			if (s.addr - sect->addr < sect->size) {
+				out.push_back(s.addr);
+			}
+		}
+	}
 }
 
 void macho::load_code() {
+	index_sections();
+
+	section *text = find_section("__TEXT", "__text");
+
+	if (!text) {
+		throw error("No __text section.");
+	}
+	code = (uintptr_t)contents(*text);
+}
+
+// The first load command of type cmd, 0 if there is none.
+uint64_t macho::find_command(uint32_t cmd) const {
+	const mach_header_64 *header = at<mach_header_64>(base);
+	uint64_t end = base + sizeof(mach_header_64) + header->sizeofcmds;
+	uint64_t offset = base + sizeof(mach_header_64);
+
+	for (uint32_t i = 0; i < header->ncmds; i++) {
+		const load_command *lc = at<load_command>(offset);
+
+		if (lc->cmdsize < sizeof(load_command) || offset + lc->cmdsize > end) {
+			throw error("Bad load command.");
+		}
+		if (lc->cmd == cmd) {
+			return offset;
+		}
+
+		offset += lc->cmdsize;
+	}
+
+	return 0;
+}
+
+void macho::read_segments(std::vector<vm_segment> &out) const {
+	const mach_header_64 *header = at<mach_header_64>(base);
+	uint64_t end = base + sizeof(mach_header_64) + header->sizeofcmds;
+	uint64_t offset = base + sizeof(mach_header_64);
+
+	for (uint32_t i = 0; i < header->ncmds; i++) {
+		const load_command *lc = at<load_command>(offset);
+
+		if (lc->cmdsize < sizeof(load_command) || offset + lc->cmdsize > end) {
+			throw error("Bad load command.");
+		}
+
+		if (lc->cmd == LC_SEGMENT_64) {
+			const segment_command_64 *seg = at<segment_command_64>(offset);
+
+			if (seg->filesize && (seg->fileoff > slice_size || seg->filesize > slice_size - seg->fileoff)) {
+				throw error("Segment outside of its slice.");
+			}
+			out.push_back({ seg->vmaddr, seg->vmsize, base + seg->fileoff, seg->filesize, seg->initprot });
+		}
+
+		offset += lc->cmdsize;
+	}
+}
+
+// __PAGEZERO and anything else with no access stays unmapped.
+void macho::read_loadables(std::vector<loadable> &out, uint64_t slide) {
+	const mach_header_64 *header = at<mach_header_64>(base);
+	std::vector<vm_segment> segments;
+
+	if (slide && !(header->flags & MH_PIE)) {
+		throw error("Only position independent images can be moved.");
+	}
+
+	read_segments(segments);
+
+	for (auto &seg : segments) {
+		if (seg.vmsize == 0 || seg.initprot == 0) {
+			continue;
+		}
+
+		int prot = ((seg.initprot & VM_PROT_READ) ? memory::read : 0) |
+		           ((seg.initprot & VM_PROT_WRITE) ? memory::write : 0) |
+		           ((seg.initprot & VM_PROT_EXECUTE) ? memory::exec : 0);
+
+		out.push_back({ seg.fileoff, seg.vmaddr + slide, std::min(seg.filesize, seg.vmsize), seg.vmsize, prot });
+	}
+}
+
+void macho::read_relocations(relocations &out, uint64_t slide) {
+	uint64_t command = find_command(LC_DYLD_CHAINED_FIXUPS);
+
+	if (command) {
+		read_chained_fixups(out, slide, command);
+		return;
+	}
+
+	// rebases only ever add the slide
+	if (!slide) {
+		return;
+	}
+
+	command = find_command(LC_DYLD_INFO_ONLY);
+	if (!command) {
+		command = find_command(LC_DYLD_INFO);
+	}
+	if (command) {
+		read_rebases(out, slide, command);
+	}
+}
+
+// Every page with fixups starts a chain of its own, linked through the
+// pointers themselves, so chains are walked in parallel batches and come
+// out in address order. Pointer authentication isn't simulated: signed
+// pointers are written as plain ones.
+void macho::read_chained_fixups(relocations &out, uint64_t slide, uint64_t command) {
+	const linkedit_data_command *lc = at<linkedit_data_command>(command);
+	uint64_t blob = base + lc->dataoff;
+	const dyld_chained_fixups_header *header = at<dyld_chained_fixups_header>(blob);
+
+	at<uint8_t>(blob, lc->datasize);
+
+	if (header->fixups_version != 0 || header->starts_offset >= lc->datasize) {
+		throw error("Bad chained fixups.");
+	}
+
+	std::vector<vm_segment> segments;
+	read_segments(segments);
+
+	// pointer targets are offsets from the Mach-O header
+	uint64_t image = 0;
+	for (auto &seg : segments) {
+		if (seg.fileoff == base && seg.filesize) {
+			image = seg.vmaddr;
+			break;
+		}
+	}
+
+	struct chain {
+		uint64_t addr;
+		uint64_t pos;
+		uint64_t limit;
+		uint16_t format;
+	};
+
+	uint64_t starts = blob + header->starts_offset;
+	uint32_t seg_count = *at<uint32_t>(starts);
+	const uint32_t *seg_info = at<uint32_t>(starts + sizeof(uint32_t), seg_count);
+	std::vector<chain> chains;
+
+	for (uint32_t i = 0; i < seg_count && i < segments.size(); i++) {
+		if (!seg_info[i]) {
+			continue;
+		}
+
+		uint64_t info = starts + seg_info[i];
+		const dyld_chained_starts_in_segment *ss = at<dyld_chained_starts_in_segment>(info);
+		const uint16_t *page_start = at<uint16_t>(info + offsetof(dyld_chained_starts_in_segment, page_count) +
+		                                          sizeof(uint16_t), ss->page_count);
+		const vm_segment &seg = segments[i];
+
+		switch (ss->pointer_format) {
+			case DYLD_CHAINED_PTR_ARM64E:
+			case DYLD_CHAINED_PTR_64:
+			case DYLD_CHAINED_PTR_64_OFFSET:
+			case DYLD_CHAINED_PTR_ARM64E_USERLAND:
+			case DYLD_CHAINED_PTR_ARM64E_USERLAND24:
+				break;
+			default:
+				throw error("Unsupported chained pointer format.");
+		}
+
+		for (uint32_t p = 0; p < ss->page_count; p++) {
+			if (page_start[p] == DYLD_CHAINED_PTR_START_NONE) {
+				continue;
+			}
+			if (page_start[p] & DYLD_CHAINED_PTR_START_MULTI) {
+				throw error("Unsupported chained fixup start.");
+			}
+
+			uint64_t offset = (uint64_t)p * ss->page_size + page_start[p];
+			chains.push_back({ seg.vmaddr + offset, seg.fileoff + offset, seg.fileoff + seg.filesize, ss->pointer_format });
+		}
+	}
+
+	std::vector<std::vector<relocations::fixup>> found(chains.size());
+	std::atomic<bool> bad(false);
+
+	in_batches(chains.size(), 64, [&](size_t begin, size_t end) {
+		for (size_t k = begin; k < end; k++) {
+			const chain &c = chains[k];
+			uint64_t addr = c.addr;
+			uint64_t pos = c.pos;
+
+			for (;;) {
+				if (pos > c.limit || c.limit - pos < sizeof(uint64_t)) {
+					bad.store(true, std::memory_order_relaxed);
+					break;
+				}
+
+				uint64_t raw, next, stride, value;
+				std::memcpy(&raw, mapping + pos, sizeof(raw));
+
+				if (c.format == DYLD_CHAINED_PTR_64 || c.format == DYLD_CHAINED_PTR_64_OFFSET) {
+					uint64_t target = raw & ((1ull << 36) - 1);
+					uint64_t high8 = (raw >> 36) & 0xff;
+
+					next = (raw >> 51) & 0xfff;
+					stride = 4;
+
+					if (raw >> 63) {
+						value = 0;
+					}
+					else {
+						value = (high8 << 56) | ((c.format == DYLD_CHAINED_PTR_64 ? target : image + target) + slide);
+					}
+				}
+				else {
+					next = (raw >> 51) & 0x7ff;
+					stride = 8;
+
+					if ((raw >> 62) & 1) {
+						value = 0;
+					}
+					else if (raw >> 63) {
+						value = image + (raw & 0xffffffff) + slide;
+					}
+					else {
+						uint64_t target = raw & ((1ull << 43) - 1);
+						uint64_t high8 = (raw >> 43) & 0xff;
+
+						value = (high8 << 56) | ((c.format == DYLD_CHAINED_PTR_ARM64E ? target : image + target) + slide);
+					}
+				}
+
+				found[k].push_back({ addr + slide, value });
+
+				if (!next) {
+					break;
+				}
+				addr += next * stride;
+				pos += next * stride;
+			}
+		}
+	});
+
+	if (bad.load()) {
+		throw error("Chained fixup outside of its segment.");
+	}
+
+	size_t total = 0;
+	for (auto &f : found) {
+		total += f.size();
+	}
+
+	std::vector<relocations::fixup> all;
+	all.reserve(total);
+	for (auto &f : found) {
+		all.insert(all.end(), f.begin(), f.end());
+	}
+
+	out.add(std::move(all));
+}
+
+// The opcodes are a little program and have to be run in order; reading
+// the pointers they name is done in parallel afterwards.
+void macho::read_rebases(relocations &out, uint64_t slide, uint64_t command) {
+	const dyld_info_command *info = at<dyld_info_command>(command);
+
+	if (!info->rebase_size) {
+		return;
+	}
+
+	const uint8_t *p = at<uint8_t>(base + info->rebase_off, info->rebase_size);
+	const uint8_t *end = p + info->rebase_size;
+
+	std::vector<vm_segment> segments;
+	read_segments(segments);
+
+	struct site {
+		uint64_t addr;
+		uint64_t pos;
+	};
+
+	std::vector<site> sites;
+	uint64_t seg = segments.size();
+	uint64_t offset = 0;
+	uint8_t type = 0;
+
+	auto rebase = [&]() {
+		if (seg >= segments.size() || offset > segments[seg].filesize ||
+		    segments[seg].filesize - offset < sizeof(uint64_t)) {
+			throw error("Rebase outside of its segment.");
+		}
+		if (type == REBASE_TYPE_POINTER) {
+			sites.push_back({ segments[seg].vmaddr + offset, segments[seg].fileoff + offset });
+		}
+	};
+
+	while (p < end) {
+		uint8_t op = *p & REBASE_OPCODE_MASK;
+		uint8_t imm = *p & REBASE_IMMEDIATE_MASK;
+		uint64_t count, skip;
+
+		p++;
+
+		switch (op) {
+			case REBASE_OPCODE_DONE:
+				p = end;
+				break;
+			case REBASE_OPCODE_SET_TYPE_IMM:
+				type = imm;
+				break;
+			case REBASE_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB:
+				seg = imm;
+				offset = read_uleb(p, end);
+				break;
+			case REBASE_OPCODE_ADD_ADDR_ULEB:
+				offset += read_uleb(p, end);
+				break;
+			case REBASE_OPCODE_ADD_ADDR_IMM_SCALED:
+				offset += imm * sizeof(uint64_t);
+				break;
+			case REBASE_OPCODE_DO_REBASE_IMM_TIMES:
+			case REBASE_OPCODE_DO_REBASE_ULEB_TIMES:
+				count = op == REBASE_OPCODE_DO_REBASE_IMM_TIMES ? imm : read_uleb(p, end);
+				for (uint64_t k = 0; k < count; k++) {
+					rebase();
+					offset += sizeof(uint64_t);
+				}
+				break;
+			case REBASE_OPCODE_DO_REBASE_ADD_ADDR_ULEB:
+				rebase();
+				offset += read_uleb(p, end) + sizeof(uint64_t);
+				break;
+			case REBASE_OPCODE_DO_REBASE_ULEB_TIMES_SKIPPING_ULEB:
+				count = read_uleb(p, end);
+				skip = read_uleb(p, end);
+				for (uint64_t k = 0; k < count; k++) {
+					rebase();
+					offset += skip + sizeof(uint64_t);
+				}
+				break;
+			default:
+				throw error("Bad rebase opcode.");
+		}
+	}
+
+	out.resolve(sites.size(), [&](size_t k, relocations::fixup &f) {
+		uint64_t value;
 
+		std::memcpy(&value, mapping + sites[k].pos, sizeof(value));
+		f.addr = sites[k].addr + slide;
+		f.value = value + slide;
+		return true;
+	});
 }
 
 }
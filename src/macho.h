@@ -25,18 +25,136 @@
 
 #include "loader.h"
 
+#include <thread>
+#include <exception>
+#include <utility>
+#include <memory>
+#include <type_traits>
+
 namespace insn {
 
+// What macho::each_slice keeps of one slice's work: what it returned, held
+// so that R needs no default constructor, or nothing when R is void.
+template <typename R>
+struct slice_value {
+	std::unique_ptr<R> value;
+
+	template <typename F, typename M>
+	void keep(F &work, M &m) { value.reset(new R(work(m))); }
+};
+
+template <>
+struct slice_value<void> {
+	template <typename F, typename M>
+	void keep(F &work, M &m) { work(m); }
+};
+
 class macho : public loader {
 public:
-	macho(std::string filename);
+	// a slice of a universal binary, or the whole of a thin one
+	struct slice {
+		std::string arch;
+		uint32_t cputype;
+		uint64_t offset;
+		uint64_t size;
+	};
+
+	// value is null when error is set
+	template <typename R>
+	struct slice_result : slice_value<R> {
+		slice where;
+		std::exception_ptr error;
+	};
+
+	template <typename F>
+	using slice_results = std::vector<slice_result<
+		typename std::decay<decltype(std::declval<F &>()(std::declval<macho &>()))>::type>>;
+
+	// the first x86-64 or arm64 slice
+	macho(std::string filename, std::shared_ptr<mapped_file> image = nullptr);
+	// a given slice, sharing the file's mapping
+	macho(std::string filename, std::shared_ptr<mapped_file> image, const slice &s);
 	static bool check_magic(uint32_t magic);
 
+	const std::vector<slice> &slices() const { return fat; }
+
+	// Loads every slice and runs work on it, one thread per slice, and
+	// returns what each returned, in slice order. A slice that can't be
+	// loaded or whose work throws reports the exception instead.
+	template <typename F>
+	slice_results<F> each_slice(F work);
+
+	// Chained fixups, or rebase opcodes when the image moves. Binds have
+	// no dylib to go to and resolve to zero.
+	void read_relocations(relocations &out, uint64_t slide);
+
 private:
+	// a segment's place in the file and in memory, by load command order
+	struct vm_segment {
+		uint64_t vmaddr;
+		uint64_t vmsize;
+		uint64_t fileoff;
+		uint64_t filesize;
+		uint32_t initprot;
+	};
+
 	void load_code();
-	void seek_to_header();	
+	void read_loadables(std::vector<loadable> &out, uint64_t slide);
+	void read_segments(std::vector<vm_segment> &out) const;
+	void read_chained_fixups(relocations &out, uint64_t slide, uint64_t command);
+	void read_rebases(relocations &out, uint64_t slide, uint64_t command);
+	uint64_t find_command(uint32_t cmd) const;
+	void read_symbols(std::vector<symbol> &out);
+	void read_functions(std::vector<uint64_t> &out);
+	uint64_t cache_seed() const;
+	void read_fat();
+	void check_header();
+	void index_sections();
+
+	std::vector<slice> fat;
+
+	// where the Mach-O image sits in the file, all of it unless fat
+	uint64_t base;
+	uint64_t slice_size;
 };
 
+// Threads already started are joined before a failure to start another
+// one goes on to the caller: they write into results.
+template <typename F>
+macho::slice_results<F> macho::each_slice(F work) {
+	slice_results<F> results(fat.size());
+	std::vector<std::thread> threads;
+
+	try {
+		for (size_t i = 0; i < fat.size(); i++) {
+			results[i].where = fat[i];
+
+			threads.emplace_back([this, &work, &results, i] {
+				try {
+					macho m(filename, image, fat[i]);
+					m.load();
+					results[i].keep(work, m);
+				}
+				catch (...) {
+					results[i].error = std::current_exception();
+				}
+			});
+		}
+	}
+	catch (...) {
+		for (auto &t : threads) {
+			t.join();
+		}
+		throw;
+	}
+
+	for (auto &t : threads) {
+		t.join();
+	}
+
+	return results;
+}
+
 }
 
 #endif
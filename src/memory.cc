@@ -0,0 +1,236 @@
+/**
+ * Copyright (c) 2014, Floris Chabert. All rights reserved.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "memory.h"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <poll.h>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <linux/userfaultfd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+namespace insn {
+
+namespace {
+
+// uffd before the first demand range, and once userfaultfd has failed
+const int untried = -1;
+const int unavailable = -2;
+
+int host_prot(int prot) {
+	return ((prot & memory::read) ? PROT_READ : 0) |
+	       ((prot & memory::write) ? PROT_WRITE : 0);
+}
+
+}
+
+memory::memory(uint64_t size) : length(size), faults(0), uffd(untried), user_only(false) {
+	void *p = mmap(nullptr, length, PROT_NONE,
+	               MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (p == MAP_FAILED) {
+		throw std::runtime_error("Can't reserve guest memory.");
+	}
+	base = (uint8_t *)p;
+}
+
+memory::~memory() {
+	if (handler.joinable()) {
+		char stop = 0;
+		while (::write(wake[1], &stop, 1) < 0 && errno == EINTR) {
+		}
+		handler.join();
+		close(wake[0]);
+		close(wake[1]);
+	}
+	if (uffd >= 0) {
+		close(uffd);
+	}
+	munmap(base, length);
+}
+
+uint64_t memory::page_size() {
+	static const uint64_t size = sysconf(_SC_PAGESIZE);
+	return size;
+}
+
+void memory::check(uint64_t addr, uint64_t size) const {
+	if (addr > length || size > length - addr) {
+		throw std::runtime_error("Mapping outside of guest memory.");
+	}
+	if ((addr | size) & (page_size() - 1)) {
+		throw std::runtime_error("Mapping not page aligned.");
+	}
+}
+
+void memory::map(int fd, uint64_t offset, uint64_t addr, uint64_t size, int prot) {
+	check(addr, size);
+
+	if (mmap(base + addr, size, host_prot(prot), MAP_PRIVATE | MAP_FIXED, fd, offset) == MAP_FAILED) {
+		throw std::runtime_error("Can't map into guest memory.");
+	}
+	mapped.push_back({ addr, size, prot });
+}
+
+void memory::zero(uint64_t addr, uint64_t size, int prot) {
+	check(addr, size);
+
+	if (mmap(base + addr, size, host_prot(prot),
+	         MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE, -1, 0) == MAP_FAILED) {
+		throw std::runtime_error("Can't map into guest memory.");
+	}
+	mapped.push_back({ addr, size, prot });
+}
+
+// Registering needs anonymous memory underneath, so the range is mapped
+// anonymous first and its pages only ever come from fill.
+void memory::demand(uint64_t addr, uint64_t size, int prot, filler fill) {
+	check(addr, size);
+
+	if (!listen()) {
+		zero(addr, size, read | write);
+		for (uint64_t at = addr; at < addr + size; at += page_size()) {
+			fill(at, host(at));
+		}
+		mprotect(base + addr, size, host_prot(prot));
+		mapped.back().prot = prot;
+		return;
+	}
+
+	zero(addr, size, prot);
+
+	{
+		std::lock_guard<std::mutex> hold(lazy_lock);
+		lazy.push_back({ addr, size, fill });
+	}
+
+#ifdef __linux__
+	uffdio_register reg = {};
+	reg.range.start = (uintptr_t)(base + addr);
+	reg.range.len = size;
+	reg.mode = UFFDIO_REGISTER_MODE_MISSING;
+
+	if (ioctl(uffd, UFFDIO_REGISTER, &reg) < 0) {
+		throw std::runtime_error("Can't register demand filled guest memory.");
+	}
+#endif
+}
+
+// Opens userfaultfd and starts the handler on the first demand range. A
+// full one is tried first, as only that serves faults the kernel takes on
+// the guest's behalf; without privileges it may only hand out one for
+// faults from user mode.
+bool memory::listen() {
+	if (uffd != untried) {
+		return uffd >= 0;
+	}
+	uffd = unavailable;
+
+#ifdef __linux__
+	int fd = syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK);
+
+#ifdef UFFD_USER_MODE_ONLY
+	if (fd < 0) {
+		fd = syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK | UFFD_USER_MODE_ONLY);
+		user_only = fd >= 0;
+	}
+#endif
+	if (fd < 0) {
+		return false;
+	}
+
+	uffdio_api api = {};
+	api.api = UFFD_API;
+
+	if (ioctl(fd, UFFDIO_API, &api) < 0 || pipe(wake) < 0) {
+		close(fd);
+		return false;
+	}
+
+	uffd = fd;
+	handler = std::thread(&memory::serve, this);
+	return true;
+#else
+	return false;
+#endif
+}
+
+// One fault at a time: the page is built in a scratch buffer and copied in
+// atomically, which also wakes the faulting thread. Another thread touching
+// the same page before the copy lands just faults again and finds it there.
+void memory::serve() {
+#ifdef __linux__
+	const uint64_t page = page_size();
+	std::vector<uint8_t> scratch(page);
+
+	for (;;) {
+		pollfd fds[2] = { { uffd, POLLIN, 0 }, { wake[0], POLLIN, 0 } };
+
+		if (poll(fds, 2, -1) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return;
+		}
+		if (fds[1].revents) {
+			return;
+		}
+
+		uffd_msg msg;
+
+		if (::read(uffd, &msg, sizeof(msg)) != sizeof(msg) || msg.event != UFFD_EVENT_PAGEFAULT) {
+			continue;
+		}
+
+		uint64_t at = (msg.arg.pagefault.address & ~(page - 1)) - (uintptr_t)base;
+
+		std::memset(scratch.data(), 0, page);
+		{
+			std::lock_guard<std::mutex> hold(lazy_lock);
+			for (const lazy_range &r : lazy) {
+				if (at - r.addr < r.size) {
+					r.fill(at, scratch.data());
+					break;
+				}
+			}
+		}
+
+		uffdio_copy copy = {};
+		copy.dst = (uintptr_t)(base + at);
+		copy.src = (uintptr_t)scratch.data();
+		copy.len = page;
+
+		if (ioctl(uffd, UFFDIO_COPY, &copy) == 0) {
+			faults.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+#endif
+}
+
+}
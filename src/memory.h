@@ -0,0 +1,117 @@
+/**
+ * Copyright (c) 2014, Floris Chabert. All rights reserved.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef MEMORY_H__
+#define MEMORY_H__
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace insn {
+
+// Guest address space: one host reservation that guest addresses are
+// offsets into. Nothing is committed until a range is mapped, and file
+// ranges are mapped private from the file itself, so pages are read on
+// first touch and copied on first write.
+//
+// The host never executes guest code, so ranges are mapped readable and
+// writable as the guest asks; execute permission is only recorded.
+//
+// Ranges can also be demand filled: on Linux they are registered with
+// userfaultfd and a handler thread builds each page the first time it is
+// touched, so neither the time to set them up nor resident memory grow with
+// their size. Where userfaultfd isn't available they are filled up front.
+class memory {
+public:
+	enum {
+		read  = 1,
+		write = 2,
+		exec  = 4,
+	};
+
+	struct region {
+		uint64_t addr;
+		uint64_t size;
+		int prot;
+	};
+
+	// writes the page at guest addr into a zeroed host page
+	typedef std::function<void(uint64_t addr, uint8_t *page)> filler;
+
+	explicit memory(uint64_t size);
+	~memory();
+
+	memory(const memory &) = delete;
+	memory &operator=(const memory &) = delete;
+
+	uint8_t *host(uint64_t addr) const { return base + addr; }
+	uint64_t size() const { return length; }
+	static uint64_t page_size();
+
+	// page aligned addr and offset
+	void map(int fd, uint64_t offset, uint64_t addr, uint64_t size, int prot);
+	void zero(uint64_t addr, uint64_t size, int prot);
+	// Where userfaultfd only serves faults from user mode (unprivileged,
+	// with vm.unprivileged_userfaultfd off), the kernel touching a page
+	// that isn't filled yet, as a read(2) into it would, fails with EFAULT
+	// instead; user_mode_only() says so, and the caller touches such pages
+	// itself first.
+	void demand(uint64_t addr, uint64_t size, int prot, filler fill);
+	bool user_mode_only() const { return user_only; }
+
+	const std::vector<region> &regions() const { return mapped; }
+
+	// pages demand filled so far
+	uint64_t faulted() const { return faults.load(std::memory_order_relaxed); }
+
+private:
+	struct lazy_range {
+		uint64_t addr;
+		uint64_t size;
+		filler fill;
+	};
+
+	uint8_t *base;
+	uint64_t length;
+	std::vector<region> mapped;
+
+	std::vector<lazy_range> lazy;
+	std::mutex lazy_lock;
+	std::atomic<uint64_t> faults;
+	std::thread handler;
+	int uffd;
+	bool user_only;
+	int wake[2];
+
+	void check(uint64_t addr, uint64_t size) const;
+	bool listen();
+	void serve();
+};
+
+}
+
+#endif
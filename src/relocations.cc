@@ -0,0 +1,143 @@
+/**
+ * Copyright (c) 2014, Floris Chabert. All rights reserved.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "relocations.h"
+#include "memory.h"
+#include "loader.h"
+
+#include <atomic>
+#include <cstring>
+
+namespace insn {
+
+namespace {
+
+bool by_addr(const relocations::fixup &a, const relocations::fixup &b) {
+	return a.addr < b.addr;
+}
+
+}
+
+// Linkers emit a handful of sorted runs, relative fixups first and then
+// the rest by symbol, so runs are merged and only a table with many of
+// them gets a full sort.
+void relocations::add(std::vector<fixup> more) {
+	const size_t max_runs = 32;
+
+	if (fixups.empty()) {
+		fixups = std::move(more);
+	}
+	else {
+		fixups.insert(fixups.end(), more.begin(), more.end());
+	}
+
+	std::vector<size_t> runs(1, 0);
+
+	for (size_t k = 1; k < fixups.size(); k++) {
+		if (fixups[k].addr < fixups[k - 1].addr) {
+			if (runs.size() == max_runs) {
+				std::stable_sort(fixups.begin(), fixups.end(), by_addr);
+				return;
+			}
+			runs.push_back(k);
+		}
+	}
+	runs.push_back(fixups.size());
+
+	while (runs.size() > 2) {
+		std::vector<size_t> merged(1, 0);
+
+		for (size_t i = 0; i + 1 < runs.size(); i += 2) {
+			size_t end = i + 2 < runs.size() ? runs[i + 2] : runs[i + 1];
+
+			std::inplace_merge(fixups.begin() + runs[i], fixups.begin() + runs[i + 1],
+			                   fixups.begin() + end, by_addr);
+			merged.push_back(end);
+		}
+		runs = std::move(merged);
+	}
+}
+
+// Batches are cut at page boundaries, fixups straddling one go with the
+// page they start in. A fixup outside writable guest memory fails the
+// whole lot, after the others have been written.
+void relocations::apply(memory &guest) const {
+	const uint64_t page = memory::page_size();
+	const size_t count = fixups.size();
+	std::vector<memory::region> writable;
+	std::atomic<bool> bad(false);
+
+	for (auto &r : guest.regions()) {
+		if (r.prot & memory::write) {
+			writable.push_back(r);
+		}
+	}
+	std::sort(writable.begin(), writable.end(), [](const memory::region &a, const memory::region &b) {
+		return a.addr < b.addr;
+	});
+
+	in_batches(count, 1 << 14, [&](size_t begin, size_t end) {
+		while (begin > 0 && begin < count && fixups[begin].addr / page == fixups[begin - 1].addr / page) {
+			begin++;
+		}
+		while (end < count && fixups[end].addr / page == fixups[end - 1].addr / page) {
+			end++;
+		}
+
+		size_t r = 0;
+
+		for (size_t k = begin; k < end; k++) {
+			const fixup &f = fixups[k];
+
+			while (r < writable.size() && f.addr >= writable[r].addr + writable[r].size) {
+				r++;
+			}
+			if (r == writable.size() || f.addr < writable[r].addr ||
+			    writable[r].addr + writable[r].size - f.addr < sizeof(f.value)) {
+				bad.store(true, std::memory_order_relaxed);
+				continue;
+			}
+
+			std::memcpy(guest.host(f.addr), &f.value, sizeof(f.value));
+		}
+	});
+
+	if (bad.load()) {
+		throw error("Relocation outside of writable memory.");
+	}
+}
+
+// Includes a fixup that starts just before the page and runs into it.
+void relocations::patch(uint64_t addr, uint8_t *page, uint64_t size) const {
+	const uint64_t width = sizeof(fixup::value);
+	fixup key = { addr >= width ? addr - width + 1 : 0, 0 };
+	auto f = std::lower_bound(fixups.begin(), fixups.end(), key, by_addr);
+
+	for (; f != fixups.end() && f->addr < addr + size; ++f) {
+		uint64_t from = std::max(f->addr, addr);
+		uint64_t to = std::min(f->addr + width, addr + size);
+
+		std::memcpy(page + (from - addr), (const uint8_t *)&f->value + (from - f->addr), to - from);
+	}
+}
+
+}
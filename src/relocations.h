@@ -0,0 +1,110 @@
+/**
+ * Copyright (c) 2014, Floris Chabert. All rights reserved.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef RELOCATIONS_H__
+#define RELOCATIONS_H__
+
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+namespace insn {
+
+class memory;
+
+// Runs work(begin, end) over [0, count) in batches of at least grain, one
+// thread per batch, the calling thread taking the last one.
+template <typename F>
+void in_batches(size_t count, size_t grain, F work) {
+	size_t threads = std::max<size_t>(1, std::thread::hardware_concurrency());
+	size_t batches = std::max<size_t>(1, std::min(threads, count / std::max<size_t>(grain, 1)));
+	size_t step = (count + batches - 1) / batches;
+	std::vector<std::thread> running;
+
+	for (size_t begin = step; begin < count; begin += step) {
+		running.emplace_back(work, begin, std::min(count, begin + step));
+	}
+	work(0, std::min(count, step));
+
+	for (auto &t : running) {
+		t.join();
+	}
+}
+
+// The 64-bit values an image's relocations resolve to, sorted by the
+// guest address they go to, ready to be written all at once or a page at
+// a time.
+class relocations {
+public:
+	struct fixup {
+		uint64_t addr;
+		uint64_t value;
+	};
+
+	// Resolves count entries with entry(k, out), which returns false for
+	// one that needs nothing written, in parallel batches.
+	template <typename F>
+	void resolve(size_t count, F entry);
+
+	// takes fixups already resolved, in any order; where two go to the
+	// same address the one added last wins
+	void add(std::vector<fixup> more);
+
+	// writes every fixup into mapped guest memory, in page-aligned batches
+	// so that no two threads touch the same page
+	void apply(memory &guest) const;
+
+	// writes the fixups that land in the page at addr into its host copy
+	void patch(uint64_t addr, uint8_t *page, uint64_t size) const;
+
+	const std::vector<fixup> &all() const { return fixups; }
+	size_t size() const { return fixups.size(); }
+
+private:
+	std::vector<fixup> fixups;
+};
+
+template <typename F>
+void relocations::resolve(size_t count, F entry) {
+	const uint64_t none = ~0ull;
+	std::vector<fixup> out(count);
+
+	in_batches(count, 1 << 14, [&](size_t begin, size_t end) {
+		for (size_t k = begin; k < end; k++) {
+			if (!entry(k, out[k])) {
+				out[k].addr = none;
+			}
+		}
+	});
+
+	out.erase(std::remove_if(out.begin(), out.end(), [none](const fixup &f) {
+		return f.addr == none;
+	}), out.end());
+
+	add(std::move(out));
+}
+
+}
+
+#endif
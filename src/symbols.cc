@@ -0,0 +1,144 @@
+/**
+ * Copyright (c) 2014, Floris Chabert. All rights reserved.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "symbols.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace insn {
+
+namespace {
+
+const uint32_t empty = UINT32_MAX;
+
+}
+
+bool symbol::is(const char *s, size_t n) const {
+	return n == length && std::memcmp(s, name, n) == 0;
+}
+
+// Aliases share an address and all stay findable by name; address lookups
+// return the last of them by name, whatever order the file had them in.
+symbol_table::symbol_table(std::vector<symbol> symbols) : sorted(std::move(symbols)) {
+	std::sort(sorted.begin(), sorted.end(), [](const symbol &a, const symbol &b) {
+		if (a.addr != b.addr) {
+			return a.addr < b.addr;
+		}
+		int c = std::memcmp(a.name, b.name, std::min(a.length, b.length));
+		return c ? c < 0 : a.length < b.length;
+	});
+	tree.resize(sorted.size() + 1);
+	rank.resize(sorted.size() + 1);
+
+	size_t next = 0;
+	layout(next, 1);
+
+	size_t n = 16;
+	while (n < sorted.size() * 2) {
+		n <<= 1;
+	}
+	buckets.assign(n, empty);
+	mask = n - 1;
+
+	for (uint32_t i = 0; i < sorted.size(); i++) {
+		uint64_t b = hash(sorted[i].name, sorted[i].length) & mask;
+
+		while (buckets[b] != empty) {
+			if (sorted[buckets[b]].is(sorted[i].name, sorted[i].length)) {
+				break;
+			}
+			b = (b + 1) & mask;
+		}
+		if (buckets[b] == empty) {
+			buckets[b] = i;
+		}
+	}
+}
+
+symbol_table::symbol_table(std::vector<symbol> sorted_, std::vector<uint64_t> tree_,
+                           std::vector<uint32_t> rank_, std::vector<uint32_t> buckets_)
+	: sorted(std::move(sorted_)), tree(std::move(tree_)), rank(std::move(rank_)),
+	  buckets(std::move(buckets_)), mask(buckets.size() - 1) {
+}
+
+// in-order walk of the implicit tree hands out the sorted elements
+void symbol_table::layout(size_t &next, size_t k) {
+	if (k < tree.size()) {
+		layout(next, 2 * k);
+		tree[k] = sorted[next].addr;
+		rank[k] = next++;
+		layout(next, 2 * k + 1);
+	}
+}
+
+// FNV-1a
+uint64_t symbol_table::hash(const char *s, size_t n) {
+	uint64_t h = 0xcbf29ce484222325ull;
+
+	for (size_t i = 0; i < n; i++) {
+		h = (h ^ (uint8_t)s[i]) * 0x100000001b3ull;
+	}
+	return h;
+}
+
+// Descends to the first start past addr; the trailing ones of k are the
+// right turns taken since its slot, and shifting them out lands on it, or
+// on 0 when every start is at or before addr.
+const symbol *symbol_table::lookup(uint64_t addr) const {
+	size_t n = sorted.size();
+	size_t k = 1;
+
+	while (k <= n) {
+		k = 2 * k + (tree[k] <= addr);
+	}
+	k >>= __builtin_ffsll(~k);
+
+	size_t after = k ? rank[k] : n;
+
+	if (after == 0) {
+		return nullptr;
+	}
+
+	const symbol *s = &sorted[after - 1];
+
+	if (s->size && addr - s->addr >= s->size) {
+		return nullptr;
+	}
+	return s;
+}
+
+const symbol *symbol_table::find(const char *name, size_t length) const {
+	uint64_t b = hash(name, length) & mask;
+
+	while (buckets[b] != empty) {
+		const symbol *s = &sorted[buckets[b]];
+
+		if (s->is(name, length)) {
+			return s;
+		}
+		b = (b + 1) & mask;
+	}
+	return nullptr;
+}
+
+}
@@ -0,0 +1,88 @@
+/**
+ * Copyright (c) 2014, Floris Chabert. All rights reserved.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef SYMBOLS_H__
+#define SYMBOLS_H__
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace insn {
+
+// A symbol as found in the file. The name points into the file's string
+// table and is not NUL terminated in general.
+struct symbol {
+	uint64_t addr;
+	uint64_t size;
+	const char *name;
+	uint32_t length;
+
+	std::string str() const { return std::string(name, length); }
+	bool is(const char *s, size_t n) const;
+};
+
+// Address and name lookups over a file's symbols. Start addresses are kept
+// in Eytzinger order, the implicit tree of a binary search laid out breadth
+// first, so a lookup walks down a path that stays in cache for its top
+// levels and has no branch to mispredict. Names go through an open
+// addressing hash of indices into the symbols, with no string copies.
+class symbol_table {
+public:
+	explicit symbol_table(std::vector<symbol> symbols);
+
+	size_t size() const { return sorted.size(); }
+	const std::vector<symbol> &all() const { return sorted; }
+
+	// the closest symbol at or before addr, nullptr if there is none or
+	// addr is past its size
+	const symbol *lookup(uint64_t addr) const;
+
+	const symbol *find(const char *name, size_t length) const;
+	const symbol *find(const std::string &name) const {
+		return find(name.data(), name.size());
+	}
+
+private:
+	friend class loader;
+
+	// the arrays of a table built before, taken as they are
+	symbol_table(std::vector<symbol> sorted, std::vector<uint64_t> tree,
+	             std::vector<uint32_t> rank, std::vector<uint32_t> buckets);
+
+	std::vector<symbol> sorted;
+
+	// 1-based Eytzinger order, with the sorted index of each slot
+	std::vector<uint64_t> tree;
+	std::vector<uint32_t> rank;
+
+	std::vector<uint32_t> buckets;
+	uint64_t mask;
+
+	void layout(size_t &next, size_t k);
+	static uint64_t hash(const char *s, size_t n);
+};
+
+}
+
+#endif
@@ -0,0 +1,77 @@
+#include "../../src/avr/avr.h"
+#include "../../src/avr/bridge.h"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+
+using namespace coresim;
+
+// Echo firmware on USART0 at UBRR 0: everything received is sent back.
+static const uint16_t echo[] = {
+	0xe108,             // ldi r16, RXEN | TXEN
+	0x9300, 0x00c1,     // sts UCSR0B, r16
+	0x9100, 0x00c0,     // loop: lds r16, UCSR0A
+	0xff07,             // sbrs r16, RXC
+	0xcffc,             // rjmp loop
+	0x9110, 0x00c6,     // lds r17, UDR0
+	0x9100, 0x00c0,     // wait: lds r16, UCSR0A
+	0xff05,             // sbrs r16, UDRE
+	0xcffc,             // rjmp wait
+	0x9310, 0x00c6,     // sts UDR0, r17
+	0xcff3,             // rjmp loop
+};
+
+int main() {
+	const std::string text = "The quick brown fox jumps over the lazy dog.\n";
+	int in[2], out[2];
+
+	if (pipe(in) || pipe(out)) {
+		perror("pipe");
+		return 1;
+	}
+	if (write(in[1], text.data(), text.size()) != (ssize_t)text.size()) {
+		perror("write");
+		return 1;
+	}
+	close(in[1]);
+
+	vmem flash;
+	vio io;
+
+	for (size_t k = 0; k < sizeof(echo) / sizeof(echo[0]); k++) {
+		flash.set(k * 2, echo[k]);
+	}
+
+	{
+		avr core(flash, io);
+		uart_bridge bridge(out[1], in[0]);
+
+		bridge.attach(core.serial());
+
+		// 160 cycles a frame, and the reader thread gets some time to
+		// pick the input up
+		for (int k = 0; k < 100; k++) {
+			core.run(text.size() * 160 * 2 / 10);
+			usleep(1000);
+		}
+		bridge.flush();
+	}
+	close(out[1]);
+
+	std::string echoed;
+	char buf[256];
+	ssize_t n;
+
+	while ((n = read(out[0], buf, sizeof(buf))) > 0) {
+		echoed.append(buf, n);
+	}
+
+	if (echoed != text) {
+		fprintf(stderr, "echoed %zu bytes: \"%s\"\n", echoed.size(), echoed.c_str());
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,86 @@
+#include "../../src/avr/firmware.h"
+
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+using namespace coresim;
+
+// a data record for 16 bytes at addr, with its checksum
+static std::string record(uint16_t addr, const uint8_t *bytes) {
+	char text[64];
+	uint8_t sum = 0x10 + (addr >> 8) + (addr & 0xff);
+	int n = std::sprintf(text, ":10%04X00", addr);
+
+	for (int k = 0; k < 16; k++) {
+		n += std::sprintf(text + n, "%02X", bytes[k]);
+		sum += bytes[k];
+	}
+	std::sprintf(text + n, "%02X\n", (uint8_t)-sum);
+
+	return text;
+}
+
+// the text fed in two pieces, the first cut short at cut
+static int split(const std::string &text, size_t cut, vmem &flash, std::string &error) {
+	ihex parser(flash, 0x8000);
+
+	try {
+		parser.feed(text.data(), cut);
+		parser.feed(text.data() + cut, text.size() - cut);
+		return parser.finish();
+	}
+	catch (std::runtime_error &e) {
+		error = e.what();
+		return -1;
+	}
+}
+
+int main() {
+	uint8_t bytes[16];
+	int failed = 0;
+
+	for (int k = 0; k < 16; k++) {
+		bytes[k] = k * 17 + 3;
+	}
+
+	const std::string good = record(0x0120, bytes);
+	const std::string eof = ":00000001FF\n";
+
+	std::string bad = good;
+	bad[bad.size() - 2] ^= 1;
+
+	for (size_t cut = 1; cut < good.size(); cut++) {
+		vmem flash;
+		std::string error;
+		int end = split(good + eof, cut, flash, error);
+
+		if (end != 0x0130) {
+			std::fprintf(stderr, "cut at %zu: end %d %s\n", cut, end, error.c_str());
+			failed++;
+			continue;
+		}
+
+		uint8_t back[16];
+		flash.get(0x0120, &back);
+
+		if (std::memcmp(back, bytes, sizeof(bytes))) {
+			std::fprintf(stderr, "cut at %zu: wrong bytes in flash\n", cut);
+			failed++;
+		}
+	}
+
+	for (size_t cut = 1; cut < bad.size(); cut++) {
+		vmem flash;
+		std::string error;
+
+		if (split(bad + eof, cut, flash, error) >= 0 ||
+		    error.find("bad checksum") == std::string::npos) {
+			std::fprintf(stderr, "cut at %zu: checksum not caught (%s)\n", cut, error.c_str());
+			failed++;
+		}
+	}
+
+	return failed != 0;
+}
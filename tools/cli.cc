@@ -27,6 +27,7 @@
 
 #include "repl.h"
 #include "run.h"
+#include "fuzz.h"
 
 using namespace std;
 
@@ -35,6 +36,9 @@ int main(int argc, char const *argv[]) {
 		if (argc == 1) {
 			repl().loop();
 		}
+		else if (argc == 3 && string(argv[1]) == "fuzz") {
+			fuzz(string(argv[2])).go();
+		}
 		else {
 			run(string(argv[1])).go();
 		}
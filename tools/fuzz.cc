@@ -0,0 +1,193 @@
+/**
+ * Copyright (c) 2014, Floris Chabert. All rights reserved.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "fuzz.h"
+#include "../src/avr/firmware.h"
+
+#include <stdexcept>
+#include <cstdlib>
+#include <csignal>
+#include <unistd.h>
+#include <sys/shm.h>
+#include <sys/wait.h>
+
+namespace {
+
+// AFL fork server control and status pipes
+const int forksrv_fd = 198;
+
+// test cases per child before a fresh fork
+const int persistent_runs = 10000;
+
+// the part coresim::avr is built for
+typedef coresim::atmega328p chip;
+
+}
+
+fuzz::fuzz(std::string filename) : core(mem, io), input(0x100), budget(1000000) {
+	coresim::load_firmware(filename, mem, chip::flash_words * 2);
+
+	// the length word has to be in SRAM with room for a byte after it
+	if (const char *s = std::getenv("AVR_FUZZ_INPUT")) {
+		unsigned long at = std::strtoul(s, nullptr, 0);
+
+		if (at < chip::io_end || at + 2 > chip::ramend) {
+			throw std::runtime_error("AVR_FUZZ_INPUT must be in SRAM");
+		}
+		input = at;
+	}
+	if (const char *s = std::getenv("AVR_FUZZ_CYCLES")) {
+		budget = std::strtoull(s, nullptr, 0);
+	}
+
+	bitmap = map();
+
+	core.reset();
+	core.cover(bitmap);
+	start.reset(new coresim::avr::snapshot(core));
+}
+
+uint8_t *fuzz::map() {
+	const char *id = std::getenv("__AFL_SHM_ID");
+
+	if (!id) {
+		local.assign(coresim::avr::coverage_size, 0);
+		return local.data();
+	}
+
+	void *p = shmat(std::atoi(id), nullptr, 0);
+
+	if (p == (void *)-1) {
+		throw std::runtime_error("Can't attach the coverage bitmap");
+	}
+
+	return (uint8_t *)p;
+}
+
+// AFL rewrites the same file behind stdin for every test case
+std::vector<uint8_t> fuzz::read_input() {
+	std::vector<uint8_t> data;
+	uint8_t buf[4096];
+	ssize_t n;
+
+	lseek(0, 0, SEEK_SET);
+
+	while ((n = read(0, buf, sizeof(buf))) > 0) {
+		data.insert(data.end(), buf, buf + n);
+	}
+
+	return data;
+}
+
+// Faults and illegal opcodes are crashes; an unimplemented instruction
+// just ends the run.
+void fuzz::one(const std::vector<uint8_t> &data) {
+	size_t n = std::min<size_t>(data.size(), chip::ramend + 1 - input - 2);
+	uint8_t len[2] = { (uint8_t)(n & 0xff), (uint8_t)(n >> 8) };
+
+	core.restore(*start);
+	core.write(input, len, 2);
+	core.write(input + 2, data.data(), n);
+
+	try {
+		core.run(budget);
+	}
+	catch (coresim::unimplemented &) {
+	}
+	catch (std::exception &) {
+		std::abort();
+	}
+}
+
+void fuzz::go() {
+	uint32_t hello = 0;
+
+	if (write(forksrv_fd + 1, &hello, 4) != 4) {
+		one(read_input());
+		return;
+	}
+
+	serve();
+}
+
+// The parent only forks and reports. A child that stopped itself after a
+// test case is resumed for the next one instead of forking again.
+void fuzz::serve() {
+	pid_t child = -1;
+	bool stopped = false;
+
+	for (;;) {
+		uint32_t killed;
+		int status;
+
+		if (read(forksrv_fd, &killed, 4) != 4) {
+			_exit(0);
+		}
+
+		if (stopped && killed) {
+			waitpid(child, &status, 0);
+			stopped = false;
+		}
+
+		if (stopped) {
+			kill(child, SIGCONT);
+			stopped = false;
+		}
+		else {
+			child = fork();
+
+			if (child < 0) {
+				_exit(1);
+			}
+			if (child == 0) {
+				close(forksrv_fd);
+				close(forksrv_fd + 1);
+				persist();
+			}
+		}
+
+		if (write(forksrv_fd + 1, &child, 4) != 4) {
+			_exit(1);
+		}
+
+		if (waitpid(child, &status, WUNTRACED) < 0) {
+			_exit(1);
+		}
+
+		stopped = WIFSTOPPED(status);
+
+		if (write(forksrv_fd + 1, &status, 4) != 4) {
+			_exit(1);
+		}
+	}
+}
+
+void fuzz::persist() {
+	for (int n = 0; n < persistent_runs; n++) {
+		if (n) {
+			raise(SIGSTOP);
+		}
+		one(read_input());
+	}
+
+	_exit(0);
+}
@@ -0,0 +1,65 @@
+/**
+ * Copyright (c) 2014, Floris Chabert. All rights reserved.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef FUZZ_H__
+#define FUZZ_H__
+
+#include <string>
+#include <vector>
+#include <memory>
+
+#include "../src/avr/avr.h"
+
+// AFL driver for AVR firmware. Runs as a fork server in persistent mode:
+// one child serves many test cases, each one restoring a snapshot taken
+// after reset, writing the input into SRAM and running for a fixed cycle
+// budget, with edge coverage going straight into AFL's shared bitmap.
+// The firmware is an Intel HEX file or a raw binary, see load_firmware().
+//
+// The firmware finds the input length as a little-endian word at
+// AVR_FUZZ_INPUT (default 0x100), followed by the bytes, cut short at the
+// end of SRAM.
+class fuzz {
+public:
+	fuzz(std::string filename);
+	void go();
+
+private:
+	coresim::vmem mem;
+	coresim::vio io;
+	coresim::avr core;
+	std::unique_ptr<coresim::avr::snapshot> start;
+
+	std::vector<uint8_t> local;
+	uint8_t *bitmap;
+
+	uint16_t input;
+	uint64_t budget;
+
+	uint8_t *map();
+	std::vector<uint8_t> read_input();
+	void one(const std::vector<uint8_t> &data);
+	void serve();
+	void persist();
+};
+
+#endif
@@ -23,15 +23,55 @@
 #include "run.h"
 
 #include <string>
+#include <cstdlib>
+#include <iostream>
 
-run::run(std::string filename) {
+namespace {
+
+// address space reserved for the guest, past the 4GB zero page of 64-bit
+// Mach-O images; nothing is committed until mapped
+const uint64_t guest_size = 1ull << 36;
+
+// $INSN_CACHE, or the user's cache directory; an empty INSN_CACHE runs
+// without one
+std::string cache_dir() {
+	if (const char *dir = std::getenv("INSN_CACHE")) {
+		return dir;
+	}
+	if (const char *xdg = std::getenv("XDG_CACHE_HOME")) {
+		return std::string(xdg) + "/insn";
+	}
+	if (const char *home = std::getenv("HOME")) {
+		return std::string(home) + "/.cache/insn";
+	}
+	return "";
+}
+
+}
+
+run::run(std::string filename) : guest(guest_size) {
 	loader = insn::loader::for_file(filename);
 	decoder = insn::decoder::for_arch(loader->arch);
 }
 
 void run::go() {
-	loader->load();
-	decoder->reset(loader->code);
+	std::string dir = cache_dir();
+
+	if (dir.empty()) {
+		loader->load();
+	}
+	else {
+		loader->load(dir);
+	}
+
+	const char *lazy = std::getenv("INSN_ON_DEMAND");
+
+	loader->map_segments(guest, lazy && *lazy);
+	decoder->reset((uintptr_t)guest.host(loader->guest_code()));
+
+	if (lazy && *lazy) {
+		std::cerr << guest.faulted() << " guest pages filled on demand" << std::endl;
+	}
 
 	while (true) {
 		// decoder->next();
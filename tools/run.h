@@ -28,7 +28,11 @@
 #include "run.h"
 #include "../src/loader.h"
 #include "../src/decoder.h"
+#include "../src/memory.h"
 
+// Loads an image into guest memory and decodes from there, so what runs is
+// the relocated copy. With INSN_ON_DEMAND set, pages are only built the
+// first time they are touched.
 class run {
 public:
 	run(std::string filename);
@@ -37,6 +41,7 @@ public:
 private:
 	std::unique_ptr<insn::loader> loader;
 	std::unique_ptr<insn::decoder> decoder;
+	insn::memory guest;
 };
  
 #endif